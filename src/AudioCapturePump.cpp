@@ -0,0 +1,67 @@
+#include "AudioCapturePump.hpp"
+#include "ThreadPriority.hpp"
+#include "Timeline.hpp"
+
+#include <algorithm>
+
+AudioCapturePump::AudioCapturePump() : m_running(false), m_overruns(0) {
+}
+
+AudioCapturePump::~AudioCapturePump() {
+  this->stop();
+}
+
+void AudioCapturePump::addEncoder(std::shared_ptr<AudioEncoder> encoder) {
+  encoder->setPumped(true);
+  m_encoders.push_back(std::move(encoder));
+}
+
+void AudioCapturePump::clear() {
+  this->stop();
+  m_encoders.clear();
+}
+
+void AudioCapturePump::start() {
+  if (m_running) {
+    return;
+  }
+  m_overruns = 0;
+  m_running = true;
+  m_thread = std::thread(&AudioCapturePump::threadProc, this);
+}
+
+void AudioCapturePump::stop() {
+  m_running = false;
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+}
+
+int64_t AudioCapturePump::getOverrunCount() const {
+  return m_overruns;
+}
+
+int64_t AudioCapturePump::getWakeInterval(const AudioEncoder::PumpStatus &status) {
+  if (status.frameUs == 0) {
+    return kMaxWakeUs;
+  }
+  // aim to come back when one codec frame is waiting, scaled down when we found the ring filling up
+  auto wake = static_cast<int64_t>(static_cast<double>(status.frameUs) * (1.0 - std::min(status.fill * 4.0, 1.0)));
+  return std::clamp(wake, kMinWakeUs, kMaxWakeUs);
+}
+
+void AudioCapturePump::threadProc() {
+  placeCurrentThread(ThreadRole::Capture);
+  Timeline::setThreadName("audio pump");
+  while (m_running) {
+    int64_t wakeUs = kMaxWakeUs;
+    for (const auto &encoder : m_encoders) {
+      auto status = encoder->pump();
+      if (status.overrun) {
+        m_overruns++;
+      }
+      wakeUs = std::min(wakeUs, getWakeInterval(status));
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(wakeUs));
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef REPLAYBUFFER_AUDIOCAPTUREPUMP_HPP
+#define REPLAYBUFFER_AUDIOCAPTUREPUMP_HPP
+
+#include "AudioEncoder.hpp"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// one thread that drains the fmod record rings of every AudioEncoder. it sleeps for about one codec frame of
+// audio, and less when the rings were found fuller than expected
+class AudioCapturePump {
+  std::vector<std::shared_ptr<AudioEncoder>> m_encoders;
+  std::thread m_thread;
+  std::atomic<bool> m_running;
+  std::atomic<int64_t> m_overruns;
+
+  void threadProc();
+
+public:
+  static constexpr int64_t kMinWakeUs = 1000;
+  static constexpr int64_t kMaxWakeUs = 50000;
+
+  AudioCapturePump();
+  ~AudioCapturePump();
+
+  void addEncoder(std::shared_ptr<AudioEncoder> encoder);
+  void clear();
+  void start();
+  void stop();
+  int64_t getOverrunCount() const;
+
+  static int64_t getWakeInterval(const AudioEncoder::PumpStatus &status);
+};
+
+#endif
@@ -1,15 +1,30 @@
 #include "AudioEncoder.hpp"
+#include "AudioCapturePump.hpp"
+#include "ThreadPool.hpp"
+#include "Timeline.hpp"
 
-extern "C" {
-#include <libavutil/audio_fifo.h>
-}
+#include <algorithm>
+#include <cmath>
 
-AudioEncoder::AudioEncoder() : m_swrCtx(nullptr), m_swrBuffer(nullptr), m_fmodDeviceID(0), m_fmodSound(nullptr),
+AudioEncoder::AudioEncoder() : m_swrCtx(nullptr), m_fmodDeviceID(0), m_fmodSound(nullptr),
                                m_recordPos(0),
                                m_lastRecordPos(0),
                                m_soundLen(0),
-                               m_maxOutSamples(0),
-                               m_audioChannels(0), m_audioSampleRate(0) {
+                               m_audioChannels(0), m_audioSampleRate(0),
+                               m_mixerSource(-1),
+                               m_encodingEnabled(true),
+                               m_frameFill(0),
+                               m_nextPts(AV_NOPTS_VALUE),
+                               m_drift(0.0),
+                               m_lastPumpTime(0),
+                               m_isPumped(false),
+                               m_outSampleRate(0),
+                               m_isDeferred(false),
+                               m_encodeTimeUs(0),
+                               m_encodedSamples(0),
+                               m_lastDeferredEncodeUs(0),
+                               m_isReplayed(false),
+                               m_traceStream(-1) {
 }
 
 AudioEncoder::~AudioEncoder() {
@@ -17,7 +32,9 @@ AudioEncoder::~AudioEncoder() {
 }
 
 void AudioEncoder::init() {
-  this->initFMOD();
+  if (!m_isReplayed) {
+    this->initFMOD();
+  }
   this->initCodecContext();
 }
 
@@ -30,13 +47,37 @@ void AudioEncoder::destroy() {
   this->destroyCodecContext();
 }
 
+void AudioEncoder::reset() {
+  // the fmod record sound stays, aac and swresample are cheap to set up again
+  this->destroyCodecContext();
+  this->initCodecContext();
+}
+
 void AudioEncoder::start() {
-  FMODAudioEngine::sharedEngine()->m_system->recordStart(m_fmodDeviceID, m_fmodSound, true);
-  BaseEncoder::start();
+  if (!m_isReplayed) {
+    FMODAudioEngine::sharedEngine()->m_system->recordStart(m_fmodDeviceID, m_fmodSound, true);
+  }
+  m_recordPos = 0;
+  m_lastRecordPos = 0;
+  m_nextPts = AV_NOPTS_VALUE;
+  m_drift = 0.0;
+  m_encodeTimeUs = 0;
+  m_encodedSamples = 0;
+  m_frameFill = 0;
+  if (m_isPumped || m_isReplayed) {
+    // an AudioCapturePump or a trace replay services this encoder, no thread of our own
+    m_running = true;
+    m_startTime = m_clock->now();
+  } else {
+    BaseEncoder::start();
+  }
+  m_lastPumpTime = m_startTime;
 }
 
 void AudioEncoder::stop() {
-  FMODAudioEngine::sharedEngine()->m_system->recordStop(m_fmodDeviceID);
+  if (!m_isReplayed) {
+    FMODAudioEngine::sharedEngine()->m_system->recordStop(m_fmodDeviceID);
+  }
   BaseEncoder::stop();
 }
 
@@ -48,73 +89,259 @@ bool AudioEncoder::isVideo() {
 }
 
 void AudioEncoder::threadProc() {
-  auto *system = FMODAudioEngine::sharedEngine()->m_system;
-  int64_t pts = 0;
-  AVAudioFifo *fifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_FLTP, 2, m_codecCtx->frame_size);
-  uint8_t *swrInBuf[] = { reinterpret_cast<uint8_t *>(m_fmodBuffer.data()) };
-  m_recordPos = 0;
-  m_lastRecordPos = 0;
   while (m_running) {
-    system->getRecordPosition(m_fmodDeviceID, &m_recordPos);
-    if (m_recordPos < 0) {
-      break;
-    } else if (m_recordPos == m_lastRecordPos) {
-      continue;
-    }
+    auto status = this->pump();
+    std::this_thread::sleep_for(std::chrono::microseconds(AudioCapturePump::getWakeInterval(status)));
+  }
+}
+
+AudioEncoder::PumpStatus AudioEncoder::pump() {
+  PumpStatus status{};
+  if (!m_running) {
+    return status;
+  }
+  status.frameUs = av_rescale(m_codecCtx->frame_size, 1000000, m_codecCtx->sample_rate);
 
-    unsigned bytesToRead = 0;
-    if (m_recordPos >= m_lastRecordPos) {
-      bytesToRead = (m_recordPos - m_lastRecordPos);
-    } else {
-      bytesToRead = (m_soundLen - m_lastRecordPos + m_recordPos);
+  auto *system = FMODAudioEngine::sharedEngine()->m_system;
+  system->getRecordPosition(m_fmodDeviceID, &m_recordPos);
+
+  // the ring holds one second of audio, so if we haven't been here for that long fmod has lapped us
+  int64_t now = m_clock->now();
+  status.overrun = now - m_lastPumpTime >= 1000000;
+  m_lastPumpTime = now;
+
+  if (m_recordPos == m_lastRecordPos) {
+    return status;
+  }
+
+  // the record position is in pcm frames, the sound's length and what lock takes are in bytes
+  const unsigned bytesPerFrame = sizeof(int16_t) * m_audioChannels;
+  const unsigned soundFrames = m_soundLen / bytesPerFrame;
+  unsigned framesToRead = 0;
+  if (m_recordPos >= m_lastRecordPos) {
+    framesToRead = m_recordPos - m_lastRecordPos;
+  } else {
+    framesToRead = soundFrames - m_lastRecordPos + m_recordPos;
+  }
+  status.fill = static_cast<double>(framesToRead) / soundFrames;
+
+  void *ptr1, *ptr2;
+  unsigned int len1, len2;
+  FMOD_RESULT result = m_fmodSound->lock(m_lastRecordPos * bytesPerFrame, framesToRead * bytesPerFrame, &ptr1, &ptr2,
+                                         &len1, &len2);
+  if (result != FMOD_OK) {
+    return status;
+  }
+
+  // fmod hands back up to two regions of the ring, both are read in place while it's locked
+  const auto *region1 = static_cast<const int16_t *>(ptr1);
+  const auto *region2 = static_cast<const int16_t *>(ptr2);
+  int frames1 = ptr1 ? static_cast<int>(len1 / (sizeof(int16_t) * m_audioChannels)) : 0;
+  int frames2 = ptr2 ? static_cast<int>(len2 / (sizeof(int16_t) * m_audioChannels)) : 0;
+  m_lastRecordPos = m_recordPos;
+  if (m_trace) {
+    m_trace->writeAudio(m_traceStream, now, m_audioChannels, m_audioSampleRate, region1, frames1, region2, frames2);
+  }
+  this->consume(region1, frames1, region2, frames2, now);
+  m_fmodSound->unlock(ptr1, ptr2, len1, len2);
+  return status;
+}
+
+void AudioEncoder::feed(const int16_t *samples, int frames, int64_t capturedUs) {
+  this->consume(samples, frames, nullptr, 0, capturedUs);
+}
+
+void AudioEncoder::consume(const int16_t *region1, int frames1, const int16_t *region2, int frames2, int64_t now) {
+  int64_t frames = frames1 + frames2;
+  if (m_isDeferred) {
+    int64_t endPts = av_rescale_q(now, { 1, 1000000 }, { 1, m_audioSampleRate });
+    if (frames1 > 0) {
+      m_pcmRing.write(region1, frames1, endPts - frames);
     }
+    if (frames2 > 0) {
+      m_pcmRing.write(region2, frames2, endPts - frames2);
+    }
+    if (!m_mixer) {
+      return;
+    }
+  }
+
+  Timer encodeTimer;
+  encodeTimer.start();
+
+  // the last sample we just read was captured now, so what comes out of swresample next starts that far back
+  int64_t capturedPts = av_rescale_q(now, { 1, 1000000 }, { 1, m_outSampleRate });
+  int64_t expectedPts = capturedPts - swr_get_delay(m_swrCtx, m_outSampleRate) -
+                        av_rescale(frames, m_outSampleRate, m_audioSampleRate);
+  if (m_nextPts == AV_NOPTS_VALUE || expectedPts - m_nextPts > kResyncThreshold) {
+    // first chunk, or we lost a chunk of audio: jump the timeline forward instead of stretching over the gap
+    m_nextPts = expectedPts;
+    m_drift = 0.0;
+  } else {
+    // device clocks wander away from ours, stretch or squeeze over the next second to follow
+    m_drift = m_drift * 0.9 + static_cast<double>(expectedPts - m_nextPts) * 0.1;
+    int delta = std::abs(m_drift) > kDriftThreshold ? static_cast<int>(m_drift) : 0;
+    swr_set_compensation(m_swrCtx, delta, m_codecCtx->sample_rate);
+  }
+
+  this->ingest(region1, frames1);
+  this->ingest(region2, frames2);
 
-    void *ptr1, *ptr2;
-    unsigned int len1, len2;
-    FMOD_RESULT result = m_fmodSound->lock(m_lastRecordPos, bytesToRead, &ptr1, &ptr2, &len1, &len2);
-    if (result != FMOD_OK) {
+  m_encodeTimeUs += encodeTimer.stop();
+  m_encodedSamples += frames;
+}
+
+void AudioEncoder::ingest(const int16_t *samples, int frames) {
+  const int frameSize = m_codecCtx->frame_size;
+  while (frames > 0) {
+    if (m_frameFill == 0) {
+      av_frame_make_writable(m_frame);
+    }
+    // swresample writes straight into the rest of the encoder frame. the input is sliced to about what fits, and
+    // the little it can't place stays queued inside it (and in swr_get_delay) until the next slice
+    int space = frameSize - m_frameFill;
+    int slice = std::clamp(static_cast<int>(av_rescale(space, m_audioSampleRate, m_outSampleRate)), 1, frames);
+    const uint8_t *in[] = { reinterpret_cast<const uint8_t *>(samples) };
+    uint8_t *out[] = {
+      m_frame->data[0] + static_cast<size_t>(m_frameFill) * sizeof(float),
+      m_frame->data[1] + static_cast<size_t>(m_frameFill) * sizeof(float)
+    };
+    int outSamples = swr_convert(m_swrCtx, out, space, in, slice);
+    samples += static_cast<size_t>(slice) * m_audioChannels;
+    frames -= slice;
+    if (outSamples <= 0) {
       continue;
     }
 
-    size_t totalSamples = (len1 + len2) / sizeof(short);
-    if (ptr1 && len1 > 0) {
-      memcpy(m_fmodBuffer.data(), ptr1, len1);
+    if (m_mixer) {
+      m_mixer->write(m_mixerSource, out, outSamples, m_nextPts);
     }
-    if (ptr2 && len2 > 0) {
-      memcpy(m_fmodBuffer.data() + (len1 / sizeof(short)), ptr2, len2);
+    m_nextPts += outSamples;
+    m_frameFill += outSamples;
+    if (m_frameFill == frameSize) {
+      m_frameFill = 0;
+      if (m_encodingEnabled) {
+        this->encodeFrame(m_nextPts - frameSize);
+      }
     }
+  }
+}
 
-    m_fmodSound->unlock(ptr1, ptr2, len1, len2);
+void AudioEncoder::encodeFrame(int64_t pts) {
+  m_frame->pts = pts;
+  int ret;
+  {
+    Timeline::Scope scope("audio send_frame");
+    ret = avcodec_send_frame(m_codecCtx, m_frame);
+  }
+  if (ret < 0) {
+    m_running = false;
+    return;
+  }
 
-    m_lastRecordPos = m_recordPos;
+  while (ret >= 0) {
+    {
+      Timeline::Scope scope("audio receive_packet");
+      ret = avcodec_receive_packet(m_codecCtx, m_packet);
+    }
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+      break;
+    }
 
-    int outSamples = swr_convert(m_swrCtx, m_swrBuffer, m_maxOutSamples, swrInBuf, totalSamples / m_audioChannels);
-    av_audio_fifo_write(fifo, reinterpret_cast<void **>(m_swrBuffer), outSamples);
+    this->pushPacket(m_packet);
+  }
+}
 
-    while (av_audio_fifo_size(fifo) >= m_codecCtx->frame_size) {
-      av_frame_make_writable(m_frame);
+std::deque<AVPacket *> AudioEncoder::snapshotPackets() {
+  if (!m_isDeferred) {
+    return BaseEncoder::snapshotPackets();
+  }
 
-      av_audio_fifo_read(fifo, reinterpret_cast<void **>(m_frame->data), m_codecCtx->frame_size);
-      m_frame->pts = pts;
-      pts += m_codecCtx->frame_size;
+  Timer timer;
+  timer.start();
+
+  // split the ring into frame-aligned chunks and encode them side by side, each with its own encoder
+  auto [first, end] = m_pcmRing.getRange();
+  int frameSize = m_codecCtx->frame_size;
+  first = end - (end - first) / frameSize * frameSize;
+
+  std::vector<std::future<std::vector<AVPacket *>>> futures;
+  int64_t lastEndPts = AV_NOPTS_VALUE;
+  for (int64_t chunkStart = first; chunkStart < end; chunkStart += kDeferredChunkFrames) {
+    int64_t chunkEnd = std::min(chunkStart + kDeferredChunkFrames, end);
+    int64_t chunkPts = m_pcmRing.getPts(chunkStart);
+    if (lastEndPts != AV_NOPTS_VALUE) {
+      chunkPts = std::max(chunkPts, lastEndPts);
+    }
+    lastEndPts = chunkPts + (chunkEnd - chunkStart);
 
-      int ret = avcodec_send_frame(m_codecCtx, m_frame);
-      if (ret < 0) {
-        m_running = false;
-        break;
-      }
+    futures.push_back(ThreadPool::getInstance()->submit([this, first, chunkStart, chunkEnd, chunkPts] {
+      return this->encodeChunk(std::max(first, chunkStart - kPrimingFrames), chunkStart, chunkEnd, chunkPts);
+    }));
+  }
 
-      while (ret >= 0) {
-        ret = avcodec_receive_packet(m_codecCtx, m_packet);
-        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-          break;
-        }
+  std::deque<AVPacket *> snapshot;
+  for (auto &future : futures) {
+    for (AVPacket *pkt : future.get()) {
+      snapshot.push_back(pkt);
+    }
+  }
+
+  m_lastDeferredEncodeUs = timer.stop();
+  return snapshot;
+}
 
-        this->pushPacket(m_packet);
+std::vector<AVPacket *> AudioEncoder::encodeChunk(int64_t primeStart, int64_t start, int64_t end, int64_t pts) const {
+  std::vector<int16_t> pcm(static_cast<size_t>((end - primeStart) * m_audioChannels));
+  m_pcmRing.read(primeStart, end - primeStart, pcm.data());
+
+  AVCodecContext *ctx = createAacContext(m_audioSampleRate);
+  SwrContext *swrCtx = createConverter(m_audioChannels, m_audioSampleRate, m_audioSampleRate, false);
+  AVFrame *frame = av_frame_alloc();
+  AVPacket *packet = av_packet_alloc();
+  frame->nb_samples = ctx->frame_size;
+  frame->format = ctx->sample_fmt;
+  av_channel_layout_copy(&frame->ch_layout, &ctx->ch_layout);
+  av_frame_get_buffer(frame, 0);
+
+  // the primed frames in front of the chunk only exist to warm the encoder up, their packets get dropped
+  std::vector<AVPacket *> out;
+  auto drain = [&] {
+    while (avcodec_receive_packet(ctx, packet) >= 0) {
+      if (packet->pts >= pts && packet->pts < pts + (end - start)) {
+        out.push_back(av_packet_clone(packet));
       }
+      av_packet_unref(packet);
+    }
+  };
+
+  int64_t framePts = pts - (start - primeStart);
+  for (int64_t pos = primeStart; pos < end; pos += ctx->frame_size) {
+    int count = static_cast<int>(std::min<int64_t>(ctx->frame_size, end - pos));
+    const uint8_t *in[] = { reinterpret_cast<const uint8_t *>(pcm.data() + (pos - primeStart) * m_audioChannels) };
+    av_frame_make_writable(frame);
+    frame->nb_samples = swr_convert(swrCtx, frame->data, ctx->frame_size, in, count);
+    frame->pts = framePts;
+    framePts += count;
+    if (avcodec_send_frame(ctx, frame) >= 0) {
+      drain();
     }
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
   }
+  avcodec_send_frame(ctx, nullptr);
+  drain();
+
+  av_packet_free(&packet);
+  av_frame_free(&frame);
+  swr_free(&swrCtx);
+  avcodec_free_context(&ctx);
+  return out;
+}
+
+bool AudioEncoder::isPacketAvailable() const {
+  if (m_isDeferred) {
+    return !m_pcmRing.isEmpty();
+  }
+  return BaseEncoder::isPacketAvailable();
 }
 
 void AudioEncoder::initFMOD() {
@@ -133,7 +360,6 @@ void AudioEncoder::initFMOD() {
   create_info.numchannels = m_audioChannels;
   create_info.length = m_audioSampleRate * sizeof(short) * m_audioChannels;
   m_soundLen = create_info.length;
-  m_fmodBuffer.resize(m_soundLen);
   FMOD_RESULT result = system->createSound(nullptr, FMOD_2D | FMOD_LOOP_NORMAL | FMOD_OPENUSER, &create_info, &this->m_fmodSound);
   if (m_fmodSound == nullptr) {
     throw fmt::format("failed to create sound, result={}", static_cast<int>(result));
@@ -147,24 +373,62 @@ void AudioEncoder::destroyFMOD() {
   
   if (m_fmodSound != nullptr) {
     m_fmodSound->release();
+    m_fmodSound = nullptr;
   }
 }
 
-void AudioEncoder::initCodecContext() {
-  m_codec = avcodec_find_encoder(AV_CODEC_ID_AAC);
-  m_codecCtx = avcodec_alloc_context3(m_codec);
-  m_codecCtx->bit_rate = 192000;
-  m_codecCtx->sample_rate = m_audioSampleRate;
-  m_codecCtx->sample_fmt = AV_SAMPLE_FMT_FLTP;
-  m_codecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
-  m_codecCtx->time_base = {1, m_codecCtx->sample_rate};
-  av_channel_layout_default(&m_codecCtx->ch_layout, 2);
-  int ret = avcodec_open2(m_codecCtx, m_codec, nullptr);
+AVCodecContext *AudioEncoder::createAacContext(int sampleRate) {
+  const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_AAC);
+  AVCodecContext *ctx = avcodec_alloc_context3(codec);
+  ctx->bit_rate = 192000;
+  ctx->sample_rate = sampleRate;
+  ctx->sample_fmt = AV_SAMPLE_FMT_FLTP;
+  ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  ctx->time_base = {1, ctx->sample_rate};
+  av_channel_layout_default(&ctx->ch_layout, 2);
+  int ret = avcodec_open2(ctx, codec, nullptr);
   if (ret < 0) {
+    avcodec_free_context(&ctx);
     char errStr[64];
     av_make_error_string(errStr, 64, ret);
     throw fmt::format("could not open codec, error: {}", errStr);
   }
+  return ctx;
+}
+
+SwrContext *AudioEncoder::createConverter(int inChannels, int inSampleRate, int outSampleRate, bool compensate) {
+  AVChannelLayout inLayout, outLayout;
+  av_channel_layout_default(&inLayout, inChannels);
+  av_channel_layout_default(&outLayout, 2);
+
+  SwrContext *swrCtx = swr_alloc();
+  av_opt_set_chlayout(swrCtx, "in_chlayout", &inLayout, 0);
+  av_opt_set_chlayout(swrCtx, "out_chlayout", &outLayout, 0);
+  av_opt_set_int(swrCtx, "in_sample_rate", inSampleRate, 0);
+  av_opt_set_int(swrCtx, "out_sample_rate", outSampleRate, 0);
+  av_opt_set_sample_fmt(swrCtx, "in_sample_fmt", AV_SAMPLE_FMT_S16, 0);
+  av_opt_set_sample_fmt(swrCtx, "out_sample_fmt", AV_SAMPLE_FMT_FLTP, 0);
+  if (compensate) {
+    // drift compensation needs the resampler even when the rates match
+    av_opt_set_int(swrCtx, "swr_flags", SWR_FLAG_RESAMPLE, 0);
+  }
+  int ret = swr_init(swrCtx);
+  if (ret < 0) {
+    swr_free(&swrCtx);
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not init swresample, error: {}", errStr);
+  }
+  return swrCtx;
+}
+
+void AudioEncoder::initCodecContext() {
+  // everything fed into the mixer has to share one rate, so let swresample do the conversion here. deferred
+  // tracks encode straight from the ring later, so they stay at the device rate
+  m_outSampleRate = m_mixer ? AudioMixer::kSampleRate : m_audioSampleRate;
+  m_codecCtx = createAacContext(m_isDeferred ? m_audioSampleRate : m_outSampleRate);
+  m_codec = m_codecCtx->codec;
+  int ret = 0;
 
   m_packet = av_packet_alloc();
   if (m_packet == nullptr) {
@@ -196,31 +460,14 @@ void AudioEncoder::initCodecContext() {
     throw fmt::format("could not allocate buffer for frame, error: {}", errStr);
   }
 
-  AVChannelLayout channelLayout;
-  av_channel_layout_default(&channelLayout, m_audioChannels);
+  m_swrCtx = createConverter(m_audioChannels, m_audioSampleRate, m_outSampleRate, true);
 
-  m_swrCtx = swr_alloc();
-  av_opt_set_chlayout(m_swrCtx, "in_chlayout", &channelLayout, 0);
-  av_opt_set_chlayout(m_swrCtx, "out_chlayout", &m_codecCtx->ch_layout, 0);
-  av_opt_set_int(m_swrCtx, "in_sample_rate", m_audioSampleRate, 0);
-  av_opt_set_int(m_swrCtx, "out_sample_rate", m_codecCtx->sample_rate, 0);
-  av_opt_set_sample_fmt(m_swrCtx, "in_sample_fmt", AV_SAMPLE_FMT_S16, 0);
-  av_opt_set_sample_fmt(m_swrCtx, "out_sample_fmt", AV_SAMPLE_FMT_FLTP, 0);
-  ret = swr_init(m_swrCtx);
-  if (ret < 0) {
-    char errStr[64];
-    av_make_error_string(errStr, 64, ret);
-    throw fmt::format("could not init swresample, error: {}", errStr);
+  if (m_isDeferred) {
+    // room for the whole clip window plus a little slack for the time it takes to encode it
+    m_pcmRing.reset(m_audioChannels, static_cast<int64_t>(m_maxDuration + 2) * m_audioSampleRate);
+  } else {
+    m_pcmRing.reset(m_audioChannels, 0);
   }
-
-  m_maxOutSamples = av_rescale_rnd(
-    swr_get_delay(m_swrCtx, m_audioSampleRate) + m_soundLen,
-    m_codecCtx->sample_rate,
-    m_audioSampleRate,
-    AV_ROUND_UP
-    );
-
-  av_samples_alloc_array_and_samples(&m_swrBuffer, nullptr, 2, this->m_maxOutSamples, AV_SAMPLE_FMT_FLTP, 0);
 }
 
 void AudioEncoder::destroyCodecContext() {
@@ -228,13 +475,6 @@ void AudioEncoder::destroyCodecContext() {
     swr_free(&m_swrCtx);
   }
 
-  if (m_swrBuffer != nullptr) {
-    // for (int i = 0; i < m_audioChannels; i++) {
-    //   av_free(m_swrBuffer[i]);
-    // }
-    av_free(m_swrBuffer);
-  }
-
   if (m_frame != nullptr) {
     av_frame_free(&m_frame);
   }
@@ -270,3 +510,43 @@ std::vector<std::string> AudioEncoder::getDeviceList() {
 void AudioEncoder::setDeviceID(int deviceID) {
   m_fmodDeviceID = deviceID;
 }
+
+void AudioEncoder::setMixer(std::shared_ptr<AudioMixer> mixer, int source) {
+  m_mixer = std::move(mixer);
+  m_mixerSource = source;
+}
+
+void AudioEncoder::setEncodingEnabled(bool enabled) {
+  m_encodingEnabled = enabled;
+}
+
+void AudioEncoder::setPumped(bool pumped) {
+  m_isPumped = pumped;
+}
+
+void AudioEncoder::setReplayFormat(int channels, int sampleRate) {
+  m_isReplayed = true;
+  m_audioChannels = channels;
+  m_audioSampleRate = sampleRate;
+}
+
+void AudioEncoder::setTrace(std::shared_ptr<CaptureTrace> trace, int stream) {
+  m_trace = std::move(trace);
+  m_traceStream = stream;
+}
+
+void AudioEncoder::setDeferred(bool deferred) {
+  m_isDeferred = deferred;
+}
+
+double AudioEncoder::getEncodeCost() const {
+  // microseconds of encoder cpu per second of captured audio
+  if (m_encodedSamples == 0 || m_audioSampleRate == 0) {
+    return 0.0;
+  }
+  return static_cast<double>(m_encodeTimeUs) * m_audioSampleRate / static_cast<double>(m_encodedSamples);
+}
+
+int64_t AudioEncoder::getLastDeferredEncodeTime() const {
+  return m_lastDeferredEncodeUs;
+}
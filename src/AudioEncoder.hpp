@@ -2,31 +2,69 @@
 #define REPLAYBUFFER_AUDIOENCODER_HPP
 
 #include "BaseEncoder.hpp"
+#include "AudioMixer.hpp"
+#include "CaptureTrace.hpp"
+#include "PcmRing.hpp"
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <Geode/binding/FMODAudioEngine.hpp>
 
 class AudioEncoder : public BaseEncoder {
   SwrContext *m_swrCtx;
-  uint8_t **m_swrBuffer;
   int m_fmodDeviceID;
   FMOD::Sound *m_fmodSound;
   unsigned int m_recordPos, m_lastRecordPos;
   int m_soundLen;
-  std::vector<short> m_fmodBuffer;
-  int m_maxOutSamples;
   int m_audioChannels;
   int m_audioSampleRate;
+  std::shared_ptr<AudioMixer> m_mixer;
+  int m_mixerSource;
+  bool m_encodingEnabled;
+  int m_frameFill; // samples already converted into m_frame
+  int64_t m_nextPts; // capture clock position of the next sample out of swresample
+  double m_drift;
+  int64_t m_lastPumpTime;
+  bool m_isPumped;
+  int m_outSampleRate;
+  bool m_isDeferred;
+  PcmRing m_pcmRing;
+  std::atomic<int64_t> m_encodeTimeUs;
+  std::atomic<int64_t> m_encodedSamples;
+  std::atomic<int64_t> m_lastDeferredEncodeUs;
+  bool m_isReplayed;
+  std::shared_ptr<CaptureTrace> m_trace;
+  int m_traceStream;
 
 public:
+  // in samples at the codec rate
+  static constexpr int kDriftThreshold = 16;
+  static constexpr int kResyncThreshold = 24000;
+  // deferred tracks are encoded in chunks of ~10 seconds, each primed with two aac frames of overlap
+  static constexpr int64_t kDeferredChunkFrames = 1024 * 470;
+  static constexpr int64_t kPrimingFrames = 2048;
+
+  struct PumpStatus {
+    double fill;     // fraction of the fmod ring that was waiting to be read
+    int64_t frameUs; // how much audio one codec frame holds
+    bool overrun;    // the ring wrapped before we got to it, so audio was lost
+  };
+
   AudioEncoder();
   ~AudioEncoder();
 
   void init() override;
   void destroy() override;
+  void reset() override;
   void start() override;
   void stop() override;
   void update() override;
   bool isVideo() override;
+  PumpStatus pump();
+  // what pump does with the samples it read, for a trace replay. capturedUs is when the last one was captured
+  void feed(const int16_t *samples, int frames, int64_t capturedUs);
+  std::deque<AVPacket *> snapshotPackets() override;
+  bool isPacketAvailable() const override;
 
 protected:
   void threadProc() override;
@@ -36,10 +74,29 @@ private:
   void destroyFMOD();
   void initCodecContext();
   void destroyCodecContext();
+  // everything past reading the device: the deferred ring, drift correction and conversion
+  void consume(const int16_t *region1, int frames1, const int16_t *region2, int frames2, int64_t now);
+  // converts interleaved device samples into m_frame, handing full frames to the mixer and the encoder
+  void ingest(const int16_t *samples, int frames);
+  void encodeFrame(int64_t pts);
+  std::vector<AVPacket *> encodeChunk(int64_t primeStart, int64_t start, int64_t end, int64_t pts) const;
+
+  static AVCodecContext *createAacContext(int sampleRate);
+  static SwrContext *createConverter(int inChannels, int inSampleRate, int outSampleRate, bool compensate);
 
 public:
   static std::vector<std::string> getDeviceList();
   void setDeviceID(int deviceID);
+  void setMixer(std::shared_ptr<AudioMixer> mixer, int source);
+  void setEncodingEnabled(bool enabled);
+  void setPumped(bool pumped);
+  // takes pcm in this format through feed instead of recording an fmod device
+  void setReplayFormat(int channels, int sampleRate);
+  // every chunk read from the device is also written to the trace under stream, nullptr stops that
+  void setTrace(std::shared_ptr<CaptureTrace> trace, int stream);
+  void setDeferred(bool deferred);
+  double getEncodeCost() const;
+  int64_t getLastDeferredEncodeTime() const;
 };
 
 
@@ -0,0 +1,55 @@
+#include "AudioKernels.hpp"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define REPLAYBUFFER_SSE
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define REPLAYBUFFER_NEON
+#include <arm_neon.h>
+#endif
+
+void mixSamples(float *dst, const float *src, float gain, size_t count) {
+  size_t i = 0;
+#if defined(REPLAYBUFFER_SSE)
+  const __m128 g = _mm_set1_ps(gain);
+  for (; i + 8 <= count; i += 8) {
+    __m128 a0 = _mm_loadu_ps(dst + i);
+    __m128 a1 = _mm_loadu_ps(dst + i + 4);
+    __m128 b0 = _mm_loadu_ps(src + i);
+    __m128 b1 = _mm_loadu_ps(src + i + 4);
+    _mm_storeu_ps(dst + i, _mm_add_ps(a0, _mm_mul_ps(b0, g)));
+    _mm_storeu_ps(dst + i + 4, _mm_add_ps(a1, _mm_mul_ps(b1, g)));
+  }
+#elif defined(REPLAYBUFFER_NEON)
+  const float32x4_t g = vdupq_n_f32(gain);
+  for (; i + 8 <= count; i += 8) {
+    vst1q_f32(dst + i, vmlaq_f32(vld1q_f32(dst + i), vld1q_f32(src + i), g));
+    vst1q_f32(dst + i + 4, vmlaq_f32(vld1q_f32(dst + i + 4), vld1q_f32(src + i + 4), g));
+  }
+#endif
+  for (; i < count; i++) {
+    dst[i] += src[i] * gain;
+  }
+}
+
+void clampSamples(float *samples, size_t count) {
+  size_t i = 0;
+#if defined(REPLAYBUFFER_SSE)
+  const __m128 lo = _mm_set1_ps(-1.0f);
+  const __m128 hi = _mm_set1_ps(1.0f);
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_ps(samples + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(samples + i), lo), hi));
+  }
+#elif defined(REPLAYBUFFER_NEON)
+  const float32x4_t lo = vdupq_n_f32(-1.0f);
+  const float32x4_t hi = vdupq_n_f32(1.0f);
+  for (; i + 4 <= count; i += 4) {
+    vst1q_f32(samples + i, vminq_f32(vmaxq_f32(vld1q_f32(samples + i), lo), hi));
+  }
+#endif
+  for (; i < count; i++) {
+    samples[i] = std::clamp(samples[i], -1.0f, 1.0f);
+  }
+}
@@ -0,0 +1,13 @@
+#ifndef REPLAYBUFFER_AUDIOKERNELS_HPP
+#define REPLAYBUFFER_AUDIOKERNELS_HPP
+
+#include <cstddef>
+
+// vectorized sample kernels, sse on x86 and neon on arm with a scalar fallback everywhere else
+
+// dst[i] += src[i] * gain
+void mixSamples(float *dst, const float *src, float gain, size_t count);
+// clamps to [-1, 1] so the summed tracks don't wrap in the encoder
+void clampSamples(float *samples, size_t count);
+
+#endif
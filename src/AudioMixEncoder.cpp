@@ -0,0 +1,123 @@
+#include "AudioMixEncoder.hpp"
+#include "Timeline.hpp"
+
+AudioMixEncoder::AudioMixEncoder() {
+}
+
+AudioMixEncoder::~AudioMixEncoder() {
+  this->AudioMixEncoder::destroy();
+}
+
+void AudioMixEncoder::init() {
+  this->initCodecContext();
+}
+
+void AudioMixEncoder::destroy() {
+  if (m_running) {
+    this->stop();
+    this->joinThread();
+  }
+  this->destroyCodecContext();
+}
+
+void AudioMixEncoder::update() {
+}
+
+bool AudioMixEncoder::isVideo() {
+  return false;
+}
+
+void AudioMixEncoder::threadProc() {
+  Timeline::setThreadName("audio mix encoder");
+  while (m_running) {
+    av_frame_make_writable(m_frame);
+    int64_t pts;
+    if (!m_mixer->read(m_frame->data, m_codecCtx->frame_size, pts, std::chrono::milliseconds(100))) {
+      continue;
+    }
+    m_frame->pts = pts;
+
+    int ret;
+    {
+      Timeline::Scope scope("mix send_frame");
+      ret = avcodec_send_frame(m_codecCtx, m_frame);
+    }
+    if (ret < 0) {
+      m_running = false;
+      break;
+    }
+
+    while (ret >= 0) {
+      {
+        Timeline::Scope scope("mix receive_packet");
+        ret = avcodec_receive_packet(m_codecCtx, m_packet);
+      }
+      if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+        break;
+      }
+
+      this->pushPacket(m_packet);
+    }
+  }
+}
+
+void AudioMixEncoder::initCodecContext() {
+  m_codec = avcodec_find_encoder(AV_CODEC_ID_AAC);
+  m_codecCtx = avcodec_alloc_context3(m_codec);
+  m_codecCtx->bit_rate = 192000;
+  m_codecCtx->sample_rate = AudioMixer::kSampleRate;
+  m_codecCtx->sample_fmt = AV_SAMPLE_FMT_FLTP;
+  m_codecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  m_codecCtx->time_base = {1, m_codecCtx->sample_rate};
+  av_channel_layout_default(&m_codecCtx->ch_layout, AudioMixer::kChannels);
+  int ret = avcodec_open2(m_codecCtx, m_codec, nullptr);
+  if (ret < 0) {
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not open codec, error: {}", errStr);
+  }
+
+  m_packet = av_packet_alloc();
+  if (m_packet == nullptr) {
+    throw fmt::format("could not alloc packet");
+  }
+
+  m_frame = av_frame_alloc();
+  if (m_frame == nullptr) {
+    throw fmt::format("could not alloc frame");
+  }
+
+  m_frame->nb_samples = m_codecCtx->frame_size;
+  m_frame->format = m_codecCtx->sample_fmt;
+  ret = av_channel_layout_copy(&m_frame->ch_layout, &m_codecCtx->ch_layout);
+  if (ret < 0) {
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not init channel layout, error: {}", errStr);
+  }
+
+  ret = av_frame_get_buffer(m_frame, 0);
+  if (ret < 0) {
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not allocate buffer for frame, error: {}", errStr);
+  }
+}
+
+void AudioMixEncoder::destroyCodecContext() {
+  if (m_frame != nullptr) {
+    av_frame_free(&m_frame);
+  }
+
+  if (m_packet != nullptr) {
+    av_packet_free(&m_packet);
+  }
+
+  if (m_codecCtx != nullptr) {
+    avcodec_free_context(&m_codecCtx);
+  }
+}
+
+void AudioMixEncoder::setMixer(std::shared_ptr<AudioMixer> mixer) {
+  m_mixer = std::move(mixer);
+}
@@ -0,0 +1,32 @@
+#ifndef REPLAYBUFFER_AUDIOMIXENCODER_HPP
+#define REPLAYBUFFER_AUDIOMIXENCODER_HPP
+
+#include "BaseEncoder.hpp"
+#include "AudioMixer.hpp"
+#include <memory>
+
+// encodes the output of an AudioMixer as a single aac track
+class AudioMixEncoder : public BaseEncoder {
+  std::shared_ptr<AudioMixer> m_mixer;
+
+public:
+  AudioMixEncoder();
+  ~AudioMixEncoder();
+
+  void init() override;
+  void destroy() override;
+  void update() override;
+  bool isVideo() override;
+
+protected:
+  void threadProc() override;
+
+private:
+  void initCodecContext();
+  void destroyCodecContext();
+
+public:
+  void setMixer(std::shared_ptr<AudioMixer> mixer);
+};
+
+#endif
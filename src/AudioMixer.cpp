@@ -0,0 +1,137 @@
+#include "AudioMixer.hpp"
+#include "AudioKernels.hpp"
+#include "Timer.hpp"
+
+#include <algorithm>
+#include <climits>
+
+AudioMixer::AudioMixer() : m_mixPts(AV_NOPTS_VALUE), m_mixTimeUs(0), m_mixedFrames(0) {
+  m_silence.resize(kSampleRate);
+}
+
+AudioMixer::~AudioMixer() {
+  this->reset();
+}
+
+void AudioMixer::reset() {
+  std::lock_guard lock(m_mutex);
+  for (auto &source : m_sources) {
+    av_audio_fifo_free(source.fifo);
+  }
+  m_sources.clear();
+  m_mixPts = AV_NOPTS_VALUE;
+  m_mixTimeUs = 0;
+  m_mixedFrames = 0;
+}
+
+int AudioMixer::addSource(float gain) {
+  std::lock_guard lock(m_mutex);
+  AVAudioFifo *fifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_FLTP, kChannels, kSampleRate);
+  if (fifo == nullptr) {
+    throw fmt::format("could not allocate mixer fifo");
+  }
+  m_sources.push_back({ fifo, gain, AV_NOPTS_VALUE });
+  return static_cast<int>(m_sources.size()) - 1;
+}
+
+void AudioMixer::write(int source, uint8_t *const *planes, int nbSamples, int64_t pts) {
+  {
+    std::lock_guard lock(m_mutex);
+    if (source < 0 || source >= static_cast<int>(m_sources.size())) {
+      return;
+    }
+
+    Source &src = m_sources[source];
+    if (m_mixPts == AV_NOPTS_VALUE) {
+      m_mixPts = pts;
+    }
+    if (src.endPts == AV_NOPTS_VALUE) {
+      src.endPts = m_mixPts;
+    }
+
+    // keep every source on the shared timeline: fill gaps with silence, drop anything we already mixed past
+    int skip = 0;
+    if (pts > src.endPts) {
+      auto gap = static_cast<int>(std::min<int64_t>(pts - src.endPts, kSampleRate));
+      void *silence[] = { m_silence.data(), m_silence.data() };
+      av_audio_fifo_write(src.fifo, silence, gap);
+    } else if (pts < src.endPts) {
+      skip = static_cast<int>(std::min<int64_t>(src.endPts - pts, nbSamples));
+    }
+
+    if (nbSamples > skip) {
+      void *offsetPlanes[] = {
+        planes[0] + skip * sizeof(float),
+        planes[1] + skip * sizeof(float)
+      };
+      av_audio_fifo_write(src.fifo, offsetPlanes, nbSamples - skip);
+    }
+    src.endPts = std::max(src.endPts, pts + nbSamples);
+  }
+  m_cv.notify_one();
+}
+
+bool AudioMixer::read(uint8_t *const *planes, int nbSamples, int64_t &pts, std::chrono::milliseconds timeout) {
+  std::unique_lock lock(m_mutex);
+  bool ready = m_cv.wait_for(lock, timeout, [&] {
+    if (m_sources.empty()) {
+      return false;
+    }
+    int minSize = INT_MAX, maxSize = 0;
+    for (const auto &source : m_sources) {
+      int size = av_audio_fifo_size(source.fifo);
+      minSize = std::min(minSize, size);
+      maxSize = std::max(maxSize, size);
+    }
+    return minSize >= nbSamples || maxSize - minSize >= kMaxLagSamples;
+  });
+  if (!ready) {
+    return false;
+  }
+
+  Timer timer;
+  timer.start();
+
+  for (auto &scratch : m_scratch) {
+    if (scratch.size() < static_cast<size_t>(nbSamples)) {
+      scratch.resize(nbSamples);
+    }
+  }
+  for (int c = 0; c < kChannels; c++) {
+    std::fill_n(reinterpret_cast<float *>(planes[c]), nbSamples, 0.0f);
+  }
+
+  for (const auto &source : m_sources) {
+    void *scratch[] = { m_scratch[0].data(), m_scratch[1].data() };
+    int samples = std::max(av_audio_fifo_read(source.fifo, scratch, nbSamples), 0);
+    for (int c = 0; c < kChannels; c++) {
+      mixSamples(reinterpret_cast<float *>(planes[c]), m_scratch[c].data(), source.gain, samples);
+    }
+  }
+
+  for (int c = 0; c < kChannels; c++) {
+    clampSamples(reinterpret_cast<float *>(planes[c]), nbSamples);
+  }
+
+  pts = m_mixPts;
+  m_mixPts += nbSamples;
+  for (auto &source : m_sources) {
+    // a source that was padded with silence picks up from here when it comes back
+    source.endPts = source.endPts == AV_NOPTS_VALUE ? m_mixPts : std::max(source.endPts, m_mixPts);
+  }
+
+  m_mixTimeUs += timer.stop();
+  m_mixedFrames++;
+  return true;
+}
+
+bool AudioMixer::isEmpty() const {
+  return m_sources.empty();
+}
+
+double AudioMixer::getAverageMixTime() const {
+  if (m_mixedFrames == 0) {
+    return 0.0;
+  }
+  return static_cast<double>(m_mixTimeUs) / static_cast<double>(m_mixedFrames);
+}
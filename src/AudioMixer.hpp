@@ -0,0 +1,49 @@
+#ifndef REPLAYBUFFER_AUDIOMIXER_HPP
+#define REPLAYBUFFER_AUDIOMIXER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include <libavutil/audio_fifo.h>
+}
+
+// sums the float output of several AudioEncoders into one track. every source writes stereo planar
+// samples at kSampleRate stamped with their capture clock pts, and a frame is only handed out once all
+// sources have caught up to it
+class AudioMixer {
+  struct Source {
+    AVAudioFifo *fifo;
+    float gain;
+    int64_t endPts;
+  };
+
+  std::vector<Source> m_sources;
+  std::vector<float> m_scratch[2];
+  std::vector<float> m_silence;
+  int64_t m_mixPts;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  int64_t m_mixTimeUs;
+  int64_t m_mixedFrames;
+
+public:
+  static constexpr int kSampleRate = 48000;
+  static constexpr int kChannels = 2;
+  // a source that falls this far behind (a loopback device with nothing playing, for example) is padded with silence
+  static constexpr int kMaxLagSamples = kSampleRate / 5;
+
+  AudioMixer();
+  ~AudioMixer();
+
+  void reset();
+  int addSource(float gain);
+  void write(int source, uint8_t *const *planes, int nbSamples, int64_t pts);
+  bool read(uint8_t *const *planes, int nbSamples, int64_t &pts, std::chrono::milliseconds timeout);
+  bool isEmpty() const;
+  double getAverageMixTime() const;
+};
+
+#endif
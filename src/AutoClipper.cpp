@@ -0,0 +1,130 @@
+#include "AutoClipper.hpp"
+
+#include <algorithm>
+
+AutoClipper::AutoClipper() : m_mergedTriggers(0) {
+}
+
+void AutoClipper::setClock(std::shared_ptr<CaptureClock> clock) {
+  m_clock = std::move(clock);
+}
+
+void AutoClipper::setExport(Export exporter) {
+  m_export = std::move(exporter);
+}
+
+void AutoClipper::setSettings(const Settings &settings) {
+  m_settings = settings;
+}
+
+void AutoClipper::trigger(Trigger trigger) {
+  if (!m_settings.enabled[static_cast<size_t>(trigger)]) {
+    return;
+  }
+  int64_t now = m_clock->now();
+  int64_t startUs = std::max(now - m_settings.preRollUs, static_cast<int64_t>(0));
+  int64_t endUs = now + m_settings.postRollUs;
+  if (!m_pending.empty() && m_pending.back().endUs >= startUs) {
+    // overlaps the last one, which just gets longer
+    Pending &pending = m_pending.back();
+    pending.startUs = std::min(pending.startUs, startUs);
+    pending.endUs = std::max(pending.endUs, endUs);
+    pending.counts[static_cast<size_t>(trigger)]++;
+    m_mergedTriggers++;
+    return;
+  }
+  Pending pending { startUs, endUs };
+  pending.counts[static_cast<size_t>(trigger)]++;
+  m_pending.push_back(pending);
+}
+
+void AutoClipper::update() {
+  if (m_clock) {
+    int64_t now = m_clock->now();
+    while (!m_pending.empty() && m_pending.front().endUs <= now) {
+      this->exportPending(m_pending.front());
+      m_pending.pop_front();
+    }
+  }
+
+  for (auto it = m_running.begin(); it != m_running.end();) {
+    if (it->wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      ++it;
+      continue;
+    }
+    try {
+      m_log.push_back(it->get());
+    } catch (const std::string &e) {
+      m_log.push_back("failed: " + e);
+    }
+    if (m_log.size() > kLogLength) {
+      m_log.pop_front();
+    }
+    it = m_running.erase(it);
+  }
+}
+
+void AutoClipper::flush() {
+  for (Pending &pending : m_pending) {
+    pending.endUs = std::min(pending.endUs, m_clock->now());
+    this->exportPending(pending);
+  }
+  m_pending.clear();
+}
+
+void AutoClipper::clear() {
+  m_pending.clear();
+  m_mergedTriggers = 0;
+}
+
+void AutoClipper::exportPending(const Pending &pending) {
+  if (m_export) {
+    m_running.push_back(m_export(pending.startUs, pending.endUs, getName(pending)).share());
+  }
+}
+
+std::string AutoClipper::getName(const Pending &pending) {
+  static constexpr const char *kNames[kTriggerCount][2] = {
+    { "level complete", "level completes" },
+    { "death", "deaths" },
+  };
+  std::string name;
+  for (size_t i = 0; i < kTriggerCount; i++) {
+    int count = pending.counts[i];
+    if (count == 0) {
+      continue;
+    }
+    if (!name.empty()) {
+      name += ", ";
+    }
+    name += count == 1 ? kNames[i][0] : std::to_string(count) + " " + kNames[i][1];
+  }
+  return name;
+}
+
+size_t AutoClipper::getPendingCount() const {
+  return m_pending.size();
+}
+
+int64_t AutoClipper::getNextExportIn() const {
+  if (m_pending.empty() || !m_clock) {
+    return -1;
+  }
+  return std::max(m_pending.front().endUs - m_clock->now(), static_cast<int64_t>(0));
+}
+
+size_t AutoClipper::getRunningCount() const {
+  return m_running.size();
+}
+
+std::vector<std::shared_future<std::string>> AutoClipper::getRunning() const {
+  return m_running;
+}
+
+size_t AutoClipper::getMergedTriggerCount() const {
+  return m_mergedTriggers;
+}
+
+const std::deque<std::string> &AutoClipper::getLog() const {
+  return m_log;
+}
@@ -0,0 +1,77 @@
+#ifndef REPLAYBUFFER_AUTOCLIPPER_HPP
+#define REPLAYBUFFER_AUTOCLIPPER_HPP
+
+#include "CaptureClock.hpp"
+#include <array>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+// clips that game events ask for. a trigger covers some pre-roll before it and some post-roll after it, the
+// recording carries on through the post-roll and the clip is exported once it's over. triggers whose windows
+// overlap are merged into one clip, so a run of deaths in practice mode is one export of one snapshot instead
+// of one per death
+class AutoClipper {
+public:
+  enum class Trigger { LevelComplete, Death };
+  static constexpr size_t kTriggerCount = 2;
+  static constexpr size_t kLogLength = 5;
+
+  struct Settings {
+    std::array<bool, kTriggerCount> enabled {};
+    int64_t preRollUs = 10000000;
+    int64_t postRollUs = 3000000;
+  };
+
+  // exports [startUs, endUs) of the buffer off the main thread. the future has the clip's path or throws a
+  // std::string
+  using Export = std::function<std::future<std::string>(int64_t startUs, int64_t endUs, const std::string &name)>;
+
+private:
+  struct Pending {
+    int64_t startUs, endUs;
+    std::array<int, kTriggerCount> counts {};
+  };
+
+  // main thread only
+  std::shared_ptr<CaptureClock> m_clock;
+  Export m_export;
+  Settings m_settings;
+  std::deque<Pending> m_pending;
+  std::vector<std::shared_future<std::string>> m_running;
+  std::deque<std::string> m_log;
+  size_t m_mergedTriggers;
+
+  void exportPending(const Pending &pending);
+  static std::string getName(const Pending &pending);
+
+public:
+  AutoClipper();
+
+  void setClock(std::shared_ptr<CaptureClock> clock);
+  void setExport(Export exporter);
+  void setSettings(const Settings &settings);
+
+  void trigger(Trigger trigger);
+  // exports clips whose post-roll is over and picks up the ones that finished
+  void update();
+  // exports everything pending right away with whatever post-roll there is, for when recording stops
+  void flush();
+  // forgets pending clips, the clock they were timed against is about to restart
+  void clear();
+
+  size_t getPendingCount() const;
+  // capture clock microseconds until the next pending clip is exported, -1 if there's none
+  int64_t getNextExportIn() const;
+  size_t getRunningCount() const;
+  // the exports still reading from the encoders, whoever stops or restarts those has to wait for them first
+  std::vector<std::shared_future<std::string>> getRunning() const;
+  size_t getMergedTriggerCount() const;
+  // newest last, paths of saved clips and errors of failed ones
+  const std::deque<std::string> &getLog() const;
+};
+
+#endif
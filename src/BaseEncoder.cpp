@@ -1,36 +1,54 @@
 #include "BaseEncoder.hpp"
+#include "ThreadPriority.hpp"
+#include "Timeline.hpp"
 
-#include <ranges>
+#include <algorithm>
+#include <limits>
 
 void BaseEncoder::trimBuffer() {
+  Timeline::Scope scope("trimBuffer");
   int64_t maxDurationPts = av_rescale_q(m_maxDuration + 1, { 1, 1 }, m_codecCtx->time_base);
-  int64_t cutoff = m_packetBuffer.back()->pts - maxDurationPts;
+  int64_t cutoff = m_packetIndex.pts(m_packetIndex.size() - 1) - maxDurationPts;
 
-  while (m_packetBuffer.front()->pts < cutoff) {
+  while (m_packetIndex.pts(0) < cutoff) {
     av_packet_free(&m_packetBuffer.front());
     m_packetBuffer.pop_front();
+    m_packetIndex.popFront();
   }
 }
 
 void BaseEncoder::pushPacket(AVPacket *pkt) {
-  //std::lock_guard lock(m_packetBufferMutex); // praying commenting this doesn't crash the game randomly
+  Timeline::Scope scope("pushPacket");
+  if (m_journal) {
+    m_journal->append(m_journalStream, pkt);
+  }
+  std::lock_guard lock(m_packetBufferMutex);
   m_packetBuffer.push_back(av_packet_clone(pkt));
+  m_packetIndex.push(pkt);
   av_packet_unref(pkt);
   this->trimBuffer();
 }
 
 BaseEncoder::BaseEncoder() : m_codec(nullptr), m_codecCtx(nullptr), m_frame(nullptr), m_packet(nullptr), m_startTime(0),
                              m_running(false),
-                             m_maxDuration(0) {
+                             m_maxDuration(0), m_journalStream(-1) {
 }
 
 BaseEncoder::~BaseEncoder() {
 }
 
+void BaseEncoder::reset() {
+  this->destroy();
+  this->init();
+}
+
 void BaseEncoder::start() {
   m_running = true;
-  m_startTime = m_timer.stop();
-  m_thread = std::thread(&BaseEncoder::threadProc, this);
+  m_startTime = m_clock->now();
+  m_thread = std::thread([this] {
+    placeCurrentThread(ThreadRole::Encode);
+    this->threadProc();
+  });
 }
 
 void BaseEncoder::stop() {
@@ -38,24 +56,149 @@ void BaseEncoder::stop() {
 }
 
 void BaseEncoder::joinThread() {
-  m_thread.join();
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
 }
 
 void BaseEncoder::clearPacketBuffer() {
+  std::lock_guard lock(m_packetBufferMutex);
   for (auto &packet : m_packetBuffer) {
     av_packet_free(&packet);
   }
   m_packetBuffer.clear();
+  m_packetIndex.clear();
 }
 
 const std::deque<AVPacket *> &BaseEncoder::getPacketBuffer() {
   return m_packetBuffer;
 }
 
+std::deque<AVPacket *> BaseEncoder::snapshotPackets() {
+  std::lock_guard lock(m_packetBufferMutex);
+  std::deque<AVPacket *> snapshot;
+  for (const AVPacket *pkt : m_packetBuffer) {
+    snapshot.push_back(av_packet_clone(pkt));
+  }
+  return snapshot;
+}
+
+std::deque<AVPacket *> BaseEncoder::snapshotPackets(PacketIndex &index) {
+  std::lock_guard lock(m_packetBufferMutex);
+  std::deque<AVPacket *> snapshot;
+  for (const AVPacket *pkt : m_packetBuffer) {
+    snapshot.push_back(av_packet_clone(pkt));
+  }
+  index = m_packetIndex;
+  return snapshot;
+}
+
 bool BaseEncoder::isPacketAvailable() const {
   return !m_packetBuffer.empty();
 }
 
+std::vector<AVPacket *> BaseEncoder::cloneGop(int64_t fromPts, int64_t minAge) {
+  std::lock_guard lock(m_packetBufferMutex);
+  std::vector<AVPacket *> gop;
+  if (m_packetBuffer.empty()) {
+    return gop;
+  }
+
+  auto begin = m_packetIndex.keyframeAtOrAfter(fromPts);
+  if (!begin) {
+    return gop;
+  }
+  size_t end = m_packetIndex.nextKeyframe(*begin);
+  // the next keyframe has to exist, otherwise the gop is still being encoded
+  if (end >= m_packetIndex.size() || m_packetIndex.pts(end) > m_packetIndex.pts(m_packetIndex.size() - 1) - minAge) {
+    return gop;
+  }
+
+  for (size_t i = *begin; i < end; i++) {
+    if (m_packetBuffer[i]) {
+      gop.push_back(av_packet_clone(m_packetBuffer[i]));
+    }
+  }
+  return gop;
+}
+
+bool BaseEncoder::replaceGop(int64_t keyPts, std::vector<AVPacket *> &&packets) {
+  std::lock_guard lock(m_packetBufferMutex);
+  auto key = m_packetIndex.keyframeAtOrAfter(keyPts);
+  // one packet per slot, so the buffer and the index are patched in place instead of being rebuilt
+  if (!key || m_packetIndex.pts(*key) != keyPts || m_packetIndex.nextKeyframe(*key) - *key != packets.size()) {
+    for (AVPacket *&pkt : packets) {
+      av_packet_free(&pkt);
+    }
+    return false;
+  }
+
+  for (size_t i = 0; i < packets.size(); i++) {
+    av_packet_free(&m_packetBuffer[*key + i]);
+    m_packetBuffer[*key + i] = packets[i];
+  }
+  m_packetIndex.replace(*key, packets);
+  packets.clear();
+  return true;
+}
+
+size_t BaseEncoder::getBufferedBytes() {
+  std::lock_guard lock(m_packetBufferMutex);
+  return m_packetIndex.bytes();
+}
+
+std::vector<AVPacket *> BaseEncoder::cloneKeyframes(int64_t afterPts) {
+  std::lock_guard lock(m_packetBufferMutex);
+  std::vector<AVPacket *> keyframes;
+  auto first = afterPts == std::numeric_limits<int64_t>::max() ? std::nullopt : m_packetIndex.keyframeAtOrAfter(afterPts + 1);
+  if (!first) {
+    return keyframes;
+  }
+  for (size_t i = *first; i < m_packetIndex.size(); i = m_packetIndex.nextKeyframe(i)) {
+    keyframes.push_back(av_packet_clone(m_packetBuffer[i]));
+  }
+  return keyframes;
+}
+
+std::vector<AVPacket *> BaseEncoder::clonePacketsAfter(int64_t afterDts) {
+  std::lock_guard lock(m_packetBufferMutex);
+  // dts only goes up in encode order, so the first one past afterDts is a binary search away
+  size_t low = 0, high = m_packetIndex.size();
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (m_packetIndex.dts(mid) <= afterDts) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  std::vector<AVPacket *> packets;
+  packets.reserve(m_packetIndex.size() - low);
+  for (size_t i = low; i < m_packetIndex.size(); i++) {
+    if (m_packetBuffer[i]) {
+      packets.push_back(av_packet_clone(m_packetBuffer[i]));
+    }
+  }
+  return packets;
+}
+
+std::pair<int64_t, int64_t> BaseEncoder::getPtsRange() {
+  std::lock_guard lock(m_packetBufferMutex);
+  if (m_packetIndex.empty()) {
+    return { AV_NOPTS_VALUE, AV_NOPTS_VALUE };
+  }
+  return { m_packetIndex.pts(0), m_packetIndex.pts(m_packetIndex.size() - 1) };
+}
+
+void BaseEncoder::setClock(std::shared_ptr<CaptureClock> clock) {
+  m_clock = std::move(clock);
+}
+
+void BaseEncoder::setJournal(std::shared_ptr<PacketJournal> journal, int stream) {
+  m_journal = std::move(journal);
+  m_journalStream = stream;
+}
+
 void BaseEncoder::setMaxDuration(int duration) {
   m_maxDuration = duration;
 }
@@ -69,20 +212,12 @@ AVCodecContext * BaseEncoder::getCodecContext() {
 }
 
 int64_t BaseEncoder::getMinimumPTS() const {
-  auto filteredBufferPTS = m_packetBuffer | std::views::filter([] (AVPacket *pkt) { return pkt->pts != AV_NOPTS_VALUE; });
-  auto filteredBufferDTS = m_packetBuffer | std::views::filter([] (AVPacket *pkt) { return pkt->dts != AV_NOPTS_VALUE; });
-  auto ptsMin = std::ranges::min_element(
-    filteredBufferPTS,
-    [](AVPacket *a, AVPacket *b) { return a->pts < b->pts; }
-    );
-  auto dtsMin = std::ranges::min_element(
-    filteredBufferDTS,
-    [](AVPacket *a, AVPacket *b) { return a->dts < b->dts; }
-    );
-  if (!filteredBufferDTS) {
-   return (*ptsMin)->pts;
-  }
-  return std::min((*ptsMin)->pts, (*dtsMin)->dts);
+  int64_t minPts = m_packetIndex.minPts();
+  int64_t minDts = m_packetIndex.minDts();
+  if (minPts == AV_NOPTS_VALUE || minDts == AV_NOPTS_VALUE) {
+    return minPts == AV_NOPTS_VALUE ? minDts : minPts;
+  }
+  return std::min(minPts, minDts);
 }
 
 //void BaseEncoder::lockBuffer() {
@@ -1,9 +1,14 @@
 #ifndef REPLAYBUFFER_BASEENCODER_HPP
 #define REPLAYBUFFER_BASEENCODER_HPP
 
+#include <deque>
 #include <thread>
+#include <memory>
 #include <mutex>
-#include "Timer.hpp"
+#include <vector>
+#include "CaptureClock.hpp"
+#include "PacketIndex.hpp"
+#include "PacketJournal.hpp"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -22,12 +27,15 @@ protected:
   AVFrame *m_frame;
   AVPacket *m_packet;
   std::thread m_thread;
-  Timer m_timer;
+  std::shared_ptr<CaptureClock> m_clock;
   int64_t m_startTime;
   bool m_running;
   int m_maxDuration;
   std::deque<AVPacket *> m_packetBuffer;
+  PacketIndex m_packetIndex; // kept in step with m_packetBuffer under the same mutex
   std::mutex m_packetBufferMutex;
+  std::shared_ptr<PacketJournal> m_journal;
+  int m_journalStream;
 
   virtual void threadProc() = 0;
   void trimBuffer();
@@ -39,6 +47,8 @@ public:
 
   virtual void init() = 0;
   virtual void destroy() = 0;
+  // readies an initialised encoder for another session with the same settings, by default it's reopened
+  virtual void reset();
   virtual void start();
   virtual void stop();
   virtual void joinThread();
@@ -48,7 +58,25 @@ public:
   void clearPacketBuffer();
 
   const std::deque<AVPacket *> &getPacketBuffer();
-  bool isPacketAvailable() const;
+  // new references to everything currently buffered, the caller frees them
+  virtual std::deque<AVPacket *> snapshotPackets();
+  // the same, plus the index of exactly those packets
+  std::deque<AVPacket *> snapshotPackets(PacketIndex &index);
+  virtual bool isPacketAvailable() const;
+  // clones the first whole gop starting at or after fromPts that ended at least minAge before the newest packet
+  std::vector<AVPacket *> cloneGop(int64_t fromPts, int64_t minAge);
+  // swaps the gop starting at keyPts for packets, one for one, and takes ownership of them. false if it got
+  // trimmed meanwhile or the packet count doesn't match
+  bool replaceGop(int64_t keyPts, std::vector<AVPacket *> &&packets);
+  size_t getBufferedBytes();
+  // clones every keyframe after afterPts
+  std::vector<AVPacket *> cloneKeyframes(int64_t afterPts);
+  // clones every packet with a dts after afterDts, in the order they were encoded
+  std::vector<AVPacket *> clonePacketsAfter(int64_t afterDts);
+  // pts of the oldest and newest buffered packet, both AV_NOPTS_VALUE while empty
+  std::pair<int64_t, int64_t> getPtsRange();
+  void setClock(std::shared_ptr<CaptureClock> clock);
+  void setJournal(std::shared_ptr<PacketJournal> journal, int stream);
   void setMaxDuration(int duration);
   int getMaxDuration();
   AVCodecContext *getCodecContext();
@@ -0,0 +1,88 @@
+#ifndef REPLAYBUFFER_BOUNDEDQUEUE_HPP
+#define REPLAYBUFFER_BOUNDEDQUEUE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+// hands items from one pipeline stage to the next. a full queue makes the producer wait, which is how a slow
+// stage holds back the ones in front of it. closing wakes everyone up, pops still drain what's left
+template<typename T>
+class BoundedQueue {
+  std::mutex m_mutex;
+  std::condition_variable m_notEmpty, m_notFull;
+  std::deque<T> m_items;
+  size_t m_capacity;
+  bool m_closed;
+  std::atomic<int64_t> m_fullWaits;
+  std::atomic<int64_t> m_emptyWaits;
+
+public:
+  explicit BoundedQueue(size_t capacity = 1) : m_capacity(capacity), m_closed(false), m_fullWaits(0), m_emptyWaits(0) {
+  }
+
+  // empties it and opens it again, nobody may be waiting on it
+  void reset(size_t capacity) {
+    std::lock_guard lock(m_mutex);
+    m_items.clear();
+    m_capacity = capacity;
+    m_closed = false;
+    m_fullWaits = 0;
+    m_emptyWaits = 0;
+  }
+
+  // false once it's closed, the item isn't taken then
+  bool push(T item) {
+    std::unique_lock lock(m_mutex);
+    if (m_items.size() >= m_capacity && !m_closed) {
+      m_fullWaits++;
+      m_notFull.wait(lock, [this] { return m_items.size() < m_capacity || m_closed; });
+    }
+    if (m_closed) {
+      return false;
+    }
+    m_items.push_back(std::move(item));
+    lock.unlock();
+    m_notEmpty.notify_one();
+    return true;
+  }
+
+  // false once it's closed and nothing is left
+  bool pop(T &item) {
+    std::unique_lock lock(m_mutex);
+    if (m_items.empty() && !m_closed) {
+      m_emptyWaits++;
+      m_notEmpty.wait(lock, [this] { return !m_items.empty() || m_closed; });
+    }
+    if (m_items.empty()) {
+      return false;
+    }
+    item = std::move(m_items.front());
+    m_items.pop_front();
+    lock.unlock();
+    m_notFull.notify_one();
+    return true;
+  }
+
+  void close() {
+    {
+      std::lock_guard lock(m_mutex);
+      m_closed = true;
+    }
+    m_notEmpty.notify_all();
+    m_notFull.notify_all();
+  }
+
+  // how often a push found it full
+  int64_t getFullWaits() const {
+    return m_fullWaits;
+  }
+  // how often a pop found it empty
+  int64_t getEmptyWaits() const {
+    return m_emptyWaits;
+  }
+};
+
+#endif
@@ -0,0 +1,18 @@
+#include "CaptureClock.hpp"
+
+CaptureClock::CaptureClock() : m_manualTime(-1) {
+  m_timer.start();
+}
+
+void CaptureClock::reset() {
+  m_timer.start();
+}
+
+void CaptureClock::setManualTime(int64_t timeUs) {
+  m_manualTime = timeUs;
+}
+
+int64_t CaptureClock::now() const {
+  int64_t manualTime = m_manualTime;
+  return manualTime >= 0 ? manualTime : m_timer.stop();
+}
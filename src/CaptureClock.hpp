@@ -0,0 +1,23 @@
+#ifndef REPLAYBUFFER_CAPTURECLOCK_HPP
+#define REPLAYBUFFER_CAPTURECLOCK_HPP
+
+#include "Timer.hpp"
+#include <atomic>
+
+// the one timeline every encoder stamps its input against, in microseconds since the session started
+class CaptureClock {
+  Timer m_timer;
+  std::atomic<int64_t> m_manualTime;
+
+public:
+  CaptureClock();
+
+  // only call this while no encoder is running
+  void reset();
+  // holds the clock at timeUs until it's moved again, for replaying a trace faster than it was recorded.
+  // -1 hands it back to the timer
+  void setManualTime(int64_t timeUs);
+  int64_t now() const;
+};
+
+#endif
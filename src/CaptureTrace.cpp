@@ -0,0 +1,329 @@
+#include "CaptureTrace.hpp"
+#include "ThreadPriority.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fmt/format.h>
+
+static void putVarint(std::vector<uint8_t> &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value) | 0x80);
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+static bool getVarint(const uint8_t *&in, const uint8_t *end, uint64_t &value) {
+  value = 0;
+  for (int shift = 0; in < end && shift < 64; shift += 7) {
+    uint8_t byte = *in++;
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+CaptureTrace::CaptureTrace() : m_pendingFrames(0), m_open(false), m_closing(false), m_compress(false),
+                               m_storedBytes(0), m_rawBytes(0), m_droppedFrames(0) {
+}
+
+CaptureTrace::~CaptureTrace() {
+  this->close();
+}
+
+void CaptureTrace::create(const std::filesystem::path &path, bool compress) {
+  this->close();
+  m_file.open(path, std::ios::binary | std::ios::trunc);
+  if (!m_file) {
+    throw fmt::format("could not create trace file {}", path.string());
+  }
+  m_file.write(kMagic, sizeof(kMagic));
+  m_file.write(reinterpret_cast<const char *>(&kVersion), sizeof(kVersion));
+
+  m_compress = compress;
+  m_previous.clear();
+  m_pendingFrames = 0;
+  m_closing = false;
+  m_storedBytes = sizeof(kMagic) + sizeof(kVersion);
+  m_rawBytes = 0;
+  m_droppedFrames = 0;
+  m_open = true;
+  m_thread = std::thread(&CaptureTrace::threadProc, this);
+}
+
+void CaptureTrace::writeVideo(int64_t timeUs, const uint8_t *rgba, int width, int height) {
+  if (!m_open) {
+    return;
+  }
+  size_t size = static_cast<size_t>(width) * height * 4;
+  {
+    std::lock_guard lock(m_mutex);
+    if (m_pendingFrames >= kMaxPendingFrames) {
+      // the disk can't keep up, a replay just sees the frame before for a little longer
+      m_droppedFrames++;
+      return;
+    }
+    Pending &pending = m_pending.emplace_back();
+    pending.header = { static_cast<uint32_t>(RecordType::VideoRaw), 0, timeUs, width, height,
+                       static_cast<uint32_t>(size), static_cast<uint32_t>(size) };
+    pending.data.assign(rgba, rgba + size);
+    m_pendingFrames++;
+  }
+  m_cv.notify_one();
+}
+
+void CaptureTrace::writeAudio(int stream, int64_t timeUs, int channels, int sampleRate, const int16_t *first,
+                              int firstFrames, const int16_t *second, int secondFrames) {
+  if (!m_open) {
+    return;
+  }
+  size_t firstSize = first != nullptr ? static_cast<size_t>(firstFrames) * channels * sizeof(int16_t) : 0;
+  size_t secondSize = second != nullptr ? static_cast<size_t>(secondFrames) * channels * sizeof(int16_t) : 0;
+  {
+    std::lock_guard lock(m_mutex);
+    Pending &pending = m_pending.emplace_back();
+    pending.header = { static_cast<uint32_t>(RecordType::Audio), stream, timeUs, channels, sampleRate,
+                       static_cast<uint32_t>(firstSize + secondSize), static_cast<uint32_t>(firstSize + secondSize) };
+    pending.data.resize(firstSize + secondSize);
+    if (firstSize > 0) {
+      std::memcpy(pending.data.data(), first, firstSize);
+    }
+    if (secondSize > 0) {
+      std::memcpy(pending.data.data() + firstSize, second, secondSize);
+    }
+  }
+  m_cv.notify_one();
+}
+
+void CaptureTrace::close() {
+  {
+    std::lock_guard lock(m_mutex);
+    m_closing = true;
+  }
+  m_cv.notify_all();
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+  m_open = false;
+  if (m_file.is_open()) {
+    m_file.close();
+  }
+  m_previous.clear();
+  m_previous.shrink_to_fit();
+}
+
+bool CaptureTrace::isOpen() const {
+  return m_open;
+}
+
+uint64_t CaptureTrace::getStoredBytes() const {
+  return m_storedBytes;
+}
+
+uint64_t CaptureTrace::getRawBytes() const {
+  return m_rawBytes;
+}
+
+int64_t CaptureTrace::getDroppedFrames() const {
+  return m_droppedFrames;
+}
+
+void CaptureTrace::threadProc() {
+  placeCurrentThread(ThreadRole::Background);
+  while (true) {
+    Pending pending;
+    {
+      std::unique_lock lock(m_mutex);
+      m_cv.wait(lock, [this] { return m_closing || !m_pending.empty(); });
+      if (m_pending.empty()) {
+        break; // closing and everything is written
+      }
+      pending = std::move(m_pending.front());
+      m_pending.pop_front();
+      if (pending.header.type != static_cast<uint32_t>(RecordType::Audio)) {
+        m_pendingFrames--;
+      }
+    }
+    this->writeRecord(pending);
+  }
+  m_file.flush();
+}
+
+void CaptureTrace::writeRecord(Pending &pending) {
+  RecordHeader &header = pending.header;
+  const std::vector<uint8_t> *payload = &pending.data;
+  if (header.type == static_cast<uint32_t>(RecordType::VideoRaw)) {
+    if (m_compress) {
+      // the first frame and one after a resize are diffed against black, which is still a lot of zero runs
+      if (m_previous.size() != pending.data.size()) {
+        m_previous.assign(pending.data.size(), 0);
+      }
+      encodeDelta(pending.data.data(), m_previous.data(), pending.data.size(), m_encoded);
+      header.type = static_cast<uint32_t>(RecordType::VideoDelta);
+      payload = &m_encoded;
+    }
+  }
+  header.storedSize = static_cast<uint32_t>(payload->size());
+  m_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  m_file.write(reinterpret_cast<const char *>(payload->data()), static_cast<std::streamsize>(payload->size()));
+  m_storedBytes += sizeof(header) + payload->size();
+  m_rawBytes += header.size;
+  if (header.type != static_cast<uint32_t>(RecordType::Audio)) {
+    m_previous.swap(pending.data);
+  }
+}
+
+void CaptureTrace::encodeDelta(const uint8_t *frame, const uint8_t *previous, size_t size, std::vector<uint8_t> &out) {
+  // pairs of (unchanged bytes to skip, changed bytes to xor in) followed by those bytes
+  out.clear();
+  size_t position = 0;
+  while (position < size) {
+    size_t literalStart = position;
+    while (literalStart < size && frame[literalStart] == previous[literalStart]) {
+      literalStart++;
+    }
+    size_t literalEnd = literalStart;
+    size_t unchanged = 0;
+    while (literalEnd < size) {
+      unchanged = frame[literalEnd] == previous[literalEnd] ? unchanged + 1 : 0;
+      literalEnd++;
+      if (unchanged == kMinZeroRun) {
+        literalEnd -= kMinZeroRun;
+        break;
+      }
+    }
+    putVarint(out, literalStart - position);
+    putVarint(out, literalEnd - literalStart);
+    for (size_t i = literalStart; i < literalEnd; i++) {
+      out.push_back(frame[i] ^ previous[i]);
+    }
+    position = literalEnd;
+  }
+}
+
+bool CaptureTrace::applyDelta(const uint8_t *delta, size_t deltaSize, std::vector<uint8_t> &frame) {
+  const uint8_t *end = delta + deltaSize;
+  size_t position = 0;
+  while (delta < end) {
+    uint64_t skip, literals;
+    if (!getVarint(delta, end, skip) || !getVarint(delta, end, literals)) {
+      return false;
+    }
+    if (skip > frame.size() - position || literals > frame.size() - position - skip ||
+        literals > static_cast<uint64_t>(end - delta)) {
+      return false;
+    }
+    position += skip;
+    for (uint64_t i = 0; i < literals; i++) {
+      frame[position++] ^= *delta++;
+    }
+  }
+  return true;
+}
+
+void CaptureTrace::Reader::open(const std::filesystem::path &path) {
+  m_file.open(path, std::ios::binary);
+  if (!m_file) {
+    throw fmt::format("could not open trace file {}", path.string());
+  }
+  char magic[sizeof(kMagic)];
+  uint32_t version = 0;
+  m_file.read(magic, sizeof(magic));
+  m_file.read(reinterpret_cast<char *>(&version), sizeof(version));
+  if (!m_file || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+    throw fmt::format("{} is not a trace file", path.filename().string());
+  }
+  if (version != kVersion) {
+    throw fmt::format("trace file version {} isn't supported", version);
+  }
+  m_frame.clear();
+}
+
+bool CaptureTrace::Reader::next(Record &record) {
+  RecordHeader header;
+  if (!m_file.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+    if (m_file.gcount() == 0) {
+      return false;
+    }
+    throw std::string("trace file is cut off");
+  }
+  m_stored.resize(header.storedSize);
+  if (!m_file.read(reinterpret_cast<char *>(m_stored.data()), header.storedSize)) {
+    throw std::string("trace file is cut off");
+  }
+
+  record.type = static_cast<RecordType>(header.type);
+  record.stream = header.stream;
+  record.timeUs = header.timeUs;
+  record.width = record.height = record.channels = record.sampleRate = 0;
+  switch (record.type) {
+    case RecordType::VideoRaw:
+      m_frame.swap(m_stored);
+      break;
+    case RecordType::VideoDelta:
+      if (m_frame.size() != header.size) {
+        m_frame.assign(header.size, 0);
+      }
+      if (!applyDelta(m_stored.data(), m_stored.size(), m_frame)) {
+        throw std::string("trace file has a corrupt frame");
+      }
+      break;
+    case RecordType::Audio:
+      record.channels = header.width;
+      record.sampleRate = header.height;
+      record.data = m_stored.data();
+      record.size = m_stored.size();
+      return true;
+    default:
+      throw fmt::format("trace file has an unknown record type {}", header.type);
+  }
+  if (m_frame.size() != static_cast<size_t>(header.width) * header.height * 4) {
+    throw std::string("trace file has a frame of the wrong size");
+  }
+  record.width = header.width;
+  record.height = header.height;
+  record.data = m_frame.data();
+  record.size = m_frame.size();
+  return true;
+}
+
+CaptureTrace::Summary CaptureTrace::scan(const std::filesystem::path &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw fmt::format("could not open trace file {}", path.string());
+  }
+  char magic[sizeof(kMagic)];
+  uint32_t version = 0;
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char *>(&version), sizeof(version));
+  if (!file || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 || version != kVersion) {
+    throw fmt::format("{} is not a trace file this version can read", path.filename().string());
+  }
+
+  Summary summary;
+  summary.storedBytes = sizeof(kMagic) + sizeof(kVersion);
+  RecordHeader header;
+  while (file.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+    if (header.type == static_cast<uint32_t>(RecordType::Audio)) {
+      auto &stream = summary.audioStreams[header.stream];
+      stream.channels = header.width;
+      stream.sampleRate = header.height;
+      stream.chunks++;
+    } else {
+      if (summary.videoFrames++ == 0) {
+        summary.width = header.width;
+        summary.height = header.height;
+      }
+    }
+    if (summary.startUs < 0) {
+      summary.startUs = header.timeUs;
+    }
+    summary.endUs = std::max(summary.endUs, header.timeUs);
+    summary.storedBytes += sizeof(header) + header.storedSize;
+    summary.rawBytes += header.size;
+    file.seekg(header.storedSize, std::ios::cur);
+  }
+  return summary;
+}
@@ -0,0 +1,127 @@
+#ifndef REPLAYBUFFER_CAPTURETRACE_HPP
+#define REPLAYBUFFER_CAPTURETRACE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// what the encoders were fed during a session, so the same input can be pushed through the pipeline again
+// without playing the game. the file is a header followed by records: every rgba readback with its capture time
+// and every chunk of pcm an audio encoder pulled out of fmod. frames can be stored as the xor against the frame
+// before with the runs of unchanged bytes left out, which is most of the screen in gd. records are written by
+// a thread of its own so the main thread only pays for a copy
+class CaptureTrace {
+public:
+  static constexpr char kMagic[8] = { 'G', 'D', 'R', 'T', 'R', 'A', 'C', 'E' };
+  static constexpr uint32_t kVersion = 1;
+  // frames waiting for the writer before new ones are dropped, audio is small and never dropped
+  static constexpr size_t kMaxPendingFrames = 8;
+  // a literal run is only broken up for at least this many unchanged bytes, shorter runs cost more than they save
+  static constexpr size_t kMinZeroRun = 8;
+
+  enum class RecordType : uint32_t { VideoRaw = 1, VideoDelta = 2, Audio = 3 };
+
+  struct RecordHeader {
+    uint32_t type;
+    int32_t stream;      // replay buffer stream index of an audio encoder, 0 for video
+    int64_t timeUs;      // capture clock time of the frame, or of the chunk's last sample like AudioEncoder sees it
+    int32_t width;       // channels for audio
+    int32_t height;      // sample rate for audio
+    uint32_t size;       // bytes of the decoded frame or samples
+    uint32_t storedSize; // bytes following this header
+  };
+
+  struct Record {
+    RecordType type;
+    int stream;
+    int64_t timeUs;
+    int width, height;
+    int channels, sampleRate;
+    // bottom up rgba like gl reads it, or interleaved s16. valid until the next record is read
+    const uint8_t *data;
+    size_t size;
+  };
+
+  struct AudioStream {
+    int channels, sampleRate;
+    size_t chunks;
+  };
+
+  struct Summary {
+    int width = 0, height = 0; // of the first frame
+    size_t videoFrames = 0;
+    std::map<int, AudioStream> audioStreams;
+    int64_t startUs = -1, endUs = -1;
+    uint64_t storedBytes = 0, rawBytes = 0;
+  };
+
+  // reads records back in the order they were written
+  class Reader {
+    std::ifstream m_file;
+    std::vector<uint8_t> m_frame; // the last decoded frame, deltas apply on top of it
+    std::vector<uint8_t> m_stored;
+
+  public:
+    // throws a std::string
+    void open(const std::filesystem::path &path);
+    // false at the end of the file, throws a std::string when it's cut off or corrupt
+    bool next(Record &record);
+  };
+
+  CaptureTrace();
+  ~CaptureTrace();
+
+  // throws a std::string
+  void create(const std::filesystem::path &path, bool compress);
+  // both copy what they're given and return, safe from any thread
+  void writeVideo(int64_t timeUs, const uint8_t *rgba, int width, int height);
+  // an fmod lock can hand back two regions of its ring, they're stored as one chunk
+  void writeAudio(int stream, int64_t timeUs, int channels, int sampleRate, const int16_t *first, int firstFrames,
+                  const int16_t *second = nullptr, int secondFrames = 0);
+  // writes out what's still queued
+  void close();
+  bool isOpen() const;
+
+  uint64_t getStoredBytes() const;
+  uint64_t getRawBytes() const;
+  int64_t getDroppedFrames() const;
+
+  // headers only, throws a std::string
+  static Summary scan(const std::filesystem::path &path);
+
+private:
+  struct Pending {
+    RecordHeader header;
+    std::vector<uint8_t> data;
+  };
+
+  std::ofstream m_file;
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<Pending> m_pending;
+  size_t m_pendingFrames;
+  std::atomic<bool> m_open;
+  bool m_closing;
+  bool m_compress;
+  std::vector<uint8_t> m_previous; // writer thread only
+  std::vector<uint8_t> m_encoded;
+  std::atomic<uint64_t> m_storedBytes;
+  std::atomic<uint64_t> m_rawBytes;
+  std::atomic<int64_t> m_droppedFrames;
+
+  void threadProc();
+  void writeRecord(Pending &pending);
+
+  static void encodeDelta(const uint8_t *frame, const uint8_t *previous, size_t size, std::vector<uint8_t> &out);
+  static bool applyDelta(const uint8_t *delta, size_t deltaSize, std::vector<uint8_t> &frame);
+};
+
+#endif
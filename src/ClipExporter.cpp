@@ -0,0 +1,143 @@
+#include "ClipExporter.hpp"
+#include "GopTranscoder.hpp"
+#include "ThreadPool.hpp"
+#include "Timer.hpp"
+
+#include <algorithm>
+#include <future>
+#include <numeric>
+#include <optional>
+#include <string>
+
+ClipExporter::ClipExporter(std::shared_ptr<VideoEncoder> encoder, int width, int height)
+  : m_encoder(std::move(encoder)), m_width(width), m_height(height) {
+  const AVCodecContext *live = m_encoder->getCodecContext();
+  if (m_width <= 0 || m_height <= 0) {
+    m_width = live->width;
+    m_height = live->height;
+  }
+}
+
+void ClipExporter::getOutputParameters(AVCodecParameters *params) const {
+  AVCodecContext *ctx = m_encoder->createCompatibleContext({ .bitrate = this->getScaledBitrate(), .width = m_width,
+                                                             .height = m_height });
+  avcodec_parameters_from_context(params, ctx);
+  avcodec_free_context(&ctx);
+}
+
+int64_t ClipExporter::getScaledBitrate() const {
+  const AVCodecContext *live = m_encoder->getCodecContext();
+  double scale = static_cast<double>(m_width) * m_height / (static_cast<double>(live->width) * live->height);
+  return std::max<int64_t>(static_cast<int64_t>(static_cast<double>(live->bit_rate) * scale), 100000);
+}
+
+std::vector<AVPacket *> ClipExporter::transcode(std::span<AVPacket *const> packets, int64_t firstPts,
+                                                int64_t videoBytes, Stats &stats) const {
+  Timer timer;
+  timer.start();
+
+  std::vector<Gop> gops;
+  for (AVPacket *pkt : packets) {
+    if (!pkt) {
+      continue;
+    }
+    if (pkt->flags & AV_PKT_FLAG_KEY) {
+      gops.push_back({ {}, std::max(pkt->pts, firstPts), 0 });
+    }
+    if (gops.empty()) {
+      continue;
+    }
+    gops.back().packets.push_back(pkt);
+    if (pkt->pts >= gops.back().firstPts) {
+      gops.back().frames++;
+    }
+  }
+  std::erase_if(gops, [](const Gop &gop) { return gop.frames == 0; });
+
+  stats = {};
+  stats.gops = static_cast<int>(gops.size());
+
+  double frameSeconds = av_q2d(m_encoder->getCodecContext()->time_base);
+  std::vector<VideoEncoder::CompatibleOptions> options(gops.size(), { .bitrate = this->getScaledBitrate(),
+                                                                      .width = m_width, .height = m_height });
+  if (videoBytes > 0 && !gops.empty()) {
+    // first pass at constant quality: the size each gop comes out at is how much it needs relative to the others
+    for (auto &option : options) {
+      option.crf = kProbeCrf;
+    }
+    auto probe = this->runPass(gops, options, stats);
+    std::vector<double> weights(gops.size());
+    for (size_t i = 0; i < gops.size(); i++) {
+      int64_t bytes = 0;
+      for (AVPacket *&pkt : probe[i]) {
+        bytes += pkt->size;
+        av_packet_free(&pkt);
+      }
+      weights[i] = static_cast<double>(std::max<int64_t>(bytes, 1));
+    }
+
+    double totalWeight = std::accumulate(weights.begin(), weights.end(), 0.0);
+    for (size_t i = 0; i < gops.size(); i++) {
+      double bits = static_cast<double>(videoBytes) * 8.0 * weights[i] / totalWeight;
+      double seconds = static_cast<double>(gops[i].frames) * frameSeconds;
+      options[i].crf = 0;
+      options[i].bitrate = std::max<int64_t>(static_cast<int64_t>(bits / seconds), 50000);
+    }
+  }
+
+  auto encoded = this->runPass(gops, options, stats);
+  std::vector<AVPacket *> out;
+  for (auto &gop : encoded) {
+    out.insert(out.end(), gop.begin(), gop.end());
+  }
+
+  stats.wallUs = timer.stop();
+  return out;
+}
+
+std::vector<std::vector<AVPacket *>> ClipExporter::runPass(const std::vector<Gop> &gops,
+                                                           const std::vector<VideoEncoder::CompatibleOptions> &options,
+                                                           Stats &stats) const {
+  struct Result {
+    std::vector<AVPacket *> packets;
+    int64_t cpuUs;
+  };
+
+  std::vector<std::future<Result>> futures;
+  for (size_t i = 0; i < gops.size(); i++) {
+    futures.push_back(ThreadPool::getInstance()->submit([this, &gop = gops[i], &option = options[i]] {
+      Timer timer;
+      timer.start();
+      GopTranscoder transcoder(m_encoder->getCodecContext(), [this, &option] {
+        return m_encoder->createCompatibleContext(option);
+      });
+      auto packets = transcoder.transcode(gop.packets, gop.firstPts);
+      return Result { std::move(packets), timer.stop() };
+    }));
+  }
+
+  // collect everything before rethrowing so no worker is left holding references into gops
+  std::vector<std::vector<AVPacket *>> results;
+  std::optional<std::string> error;
+  for (auto &future : futures) {
+    try {
+      Result result = future.get();
+      stats.cpuUs += result.cpuUs;
+      results.push_back(std::move(result.packets));
+    } catch (const std::string &e) {
+      error = e;
+      results.emplace_back();
+    }
+  }
+  stats.passes++;
+
+  if (error) {
+    for (auto &packets : results) {
+      for (AVPacket *&pkt : packets) {
+        av_packet_free(&pkt);
+      }
+    }
+    throw *error;
+  }
+  return results;
+}
@@ -0,0 +1,62 @@
+#ifndef REPLAYBUFFER_CLIPEXPORTER_HPP
+#define REPLAYBUFFER_CLIPEXPORTER_HPP
+
+#include "VideoEncoder.hpp"
+#include <array>
+#include <memory>
+#include <span>
+#include <vector>
+
+struct ExportPreset {
+  const char *name;
+  int width;           // 0 keeps the recorded size
+  int height;
+  int64_t targetBytes; // 0 keeps the recorded bitrate, scaled to the new size
+};
+
+// re-encodes the video of a clip gop by gop on the thread pool. every gop starts at a keyframe, so they decode
+// independently and the re-encoded pieces can be laid back to back. with a target size the clip is encoded
+// twice: once at constant quality to see how hard each gop is, then with the byte budget split to match
+class ClipExporter {
+  std::shared_ptr<VideoEncoder> m_encoder;
+  int m_width, m_height;
+
+public:
+  static constexpr std::array kPresets = {
+    ExportPreset { "original", 0, 0, 0 },
+    ExportPreset { "720p", 1280, 720, 0 },
+    ExportPreset { "480p", 854, 480, 0 },
+    ExportPreset { "under 25 MB", 0, 0, 25 * 1000 * 1000 },
+    ExportPreset { "under 10 MB, 720p", 1280, 720, 10 * 1000 * 1000 },
+  };
+  // quality used to measure how complex each gop is during the first pass
+  static constexpr int kProbeCrf = 26;
+
+  struct Stats {
+    int gops = 0;
+    int passes = 0;
+    int64_t wallUs = 0;
+    int64_t cpuUs = 0; // summed over the workers, cpuUs / wallUs is how well it spread over the pool
+  };
+
+  ClipExporter(std::shared_ptr<VideoEncoder> encoder, int width, int height);
+
+  void getOutputParameters(AVCodecParameters *params) const;
+  // packets has to start at a keyframe. videoBytes of 0 keeps the bitrate of the recording
+  std::vector<AVPacket *> transcode(std::span<AVPacket *const> packets, int64_t firstPts, int64_t videoBytes,
+                                    Stats &stats) const;
+
+private:
+  struct Gop {
+    std::vector<AVPacket *> packets;
+    int64_t firstPts;
+    int64_t frames;
+  };
+
+  std::vector<std::vector<AVPacket *>> runPass(const std::vector<Gop> &gops,
+                                               const std::vector<VideoEncoder::CompatibleOptions> &options,
+                                               Stats &stats) const;
+  int64_t getScaledBitrate() const;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include "CodecBenchmark.hpp"
+#include "GopTranscoder.hpp"
+#include "Timer.hpp"
+
+#include <algorithm>
+#include <span>
+
+CodecBenchmark::Input CodecBenchmark::capture(const std::shared_ptr<VideoEncoder> &encoder) {
+  Input input;
+  input.packets = encoder->snapshotPackets();
+  const AVCodecContext *live = encoder->getCodecContext();
+  input.params.reset(avcodec_parameters_alloc());
+  avcodec_parameters_from_context(input.params.get(), live);
+  input.timeBase = live->time_base;
+  input.compatible = encoder->getCompatibleSource();
+  return input;
+}
+
+std::vector<CodecBenchmark::Result> CodecBenchmark::run(Input input) {
+  std::deque<AVPacket *> &packets = input.packets;
+  // a decoder context of our own to describe the stream, the live one goes away with the session
+  AVCodecContext *source = avcodec_alloc_context3(nullptr);
+  avcodec_parameters_to_context(source, input.params.get());
+  source->time_base = input.timeBase;
+
+  std::vector<AVPacket *> window;
+  if (!packets.empty()) {
+    // back up to the keyframe in front of the window so the decoder can start there
+    int64_t from = packets.back()->pts - av_rescale_q(kSeconds, { 1, 1 }, source->time_base);
+    size_t start = 0;
+    for (size_t i = 0; i < packets.size(); i++) {
+      if ((packets[i]->flags & AV_PKT_FLAG_KEY) && packets[i]->pts <= from) {
+        start = i;
+      }
+    }
+    window.assign(packets.begin() + static_cast<std::ptrdiff_t>(start), packets.end());
+  }
+
+  std::vector<Result> results;
+  for (int i = 0; i < static_cast<int>(VideoEncoder::kSoftwareCodecs.size()); i++) {
+    const auto &codec = VideoEncoder::kSoftwareCodecs[i];
+    Result result { codec.label, false, 0.0, 0.0 };
+    if (window.size() < 2 || avcodec_find_encoder_by_name(codec.encoder) == nullptr) {
+      results.push_back(result);
+      continue;
+    }
+
+    try {
+      GopTranscoder transcoder(source, [&input, i, &codec] {
+        VideoEncoder::CompatibleOptions options;
+        options.softwareCodec = i;
+        options.crf = codec.equalQualityCrf;
+        return VideoEncoder::createSoftwareContext(input.compatible, options);
+      });
+      Timer timer;
+      timer.start();
+      std::vector<AVPacket *> out = transcoder.transcode(std::span(window), window.front()->pts);
+      int64_t elapsedUs = timer.stop();
+
+      size_t bytes = 0;
+      for (AVPacket *pkt : out) {
+        bytes += pkt->size;
+        av_packet_free(&pkt);
+      }
+      double seconds = av_q2d(source->time_base) * static_cast<double>(window.back()->pts - window.front()->pts + 1);
+      result.available = true;
+      result.fps = elapsedUs > 0 ? static_cast<double>(out.size()) * 1000000.0 / static_cast<double>(elapsedUs) : 0.0;
+      result.bytesPerSecond = seconds > 0.0 ? static_cast<double>(bytes) / seconds : 0.0;
+    } catch (const std::string &) {
+      // an encoder that won't open with these settings is reported as unavailable
+    }
+    results.push_back(result);
+  }
+
+  for (AVPacket *pkt : packets) {
+    av_packet_free(&pkt);
+  }
+  avcodec_free_context(&source);
+  return results;
+}
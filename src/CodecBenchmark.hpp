@@ -0,0 +1,40 @@
+#ifndef REPLAYBUFFER_CODECBENCHMARK_HPP
+#define REPLAYBUFFER_CODECBENCHMARK_HPP
+
+#include "VideoEncoder.hpp"
+#include <deque>
+#include <memory>
+#include <vector>
+
+// re-encodes the newest few seconds of the video buffer with every software codec at its equal quality crf, so
+// the codecs are compared on the footage that's actually being recorded rather than on a test clip
+class CodecBenchmark {
+public:
+  static constexpr int kSeconds = 5;
+
+  struct Result {
+    const char *label;
+    bool available;
+    double fps;            // frames encoded per second of wall time
+    double bytesPerSecond; // per second of footage, what the buffer would hold
+  };
+
+  struct ParametersDeleter {
+    void operator()(AVCodecParameters *params) const { avcodec_parameters_free(&params); }
+  };
+
+  // everything run needs from the live encoder, copied so recording can stop or restart while it goes
+  struct Input {
+    std::deque<AVPacket *> packets;
+    std::unique_ptr<AVCodecParameters, ParametersDeleter> params;
+    AVRational timeBase;
+    VideoEncoder::CompatibleSource compatible;
+  };
+
+  // main thread, while recording
+  static Input capture(const std::shared_ptr<VideoEncoder> &encoder);
+  // blocking, run it on a thread of its own. frees the packets
+  static std::vector<Result> run(Input input);
+};
+
+#endif
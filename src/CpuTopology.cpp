@@ -0,0 +1,175 @@
+#include "CpuTopology.hpp"
+
+#include <algorithm>
+#include <map>
+#include <thread>
+
+#if defined(GEODE_IS_WINDOWS64)
+#include <Windows.h>
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>
+#else
+#include <charconv>
+#include <fstream>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#endif
+
+const CpuTopology &CpuTopology::get() {
+  static CpuTopology topology = [] {
+    CpuTopology t;
+    t.l3Count = 1;
+    t.detect();
+    if (t.cores.empty()) {
+      // nothing readable, treat every logical processor as its own core
+      for (int i = 0; i < static_cast<int>(std::thread::hardware_concurrency()); i++) {
+        t.cores.push_back({ { i }, 0, 0 });
+      }
+    }
+    t.maxEfficiencyClass = 0;
+    for (const auto &core : t.cores) {
+      t.maxEfficiencyClass = std::max(t.maxEfficiencyClass, core.efficiencyClass);
+    }
+    return t;
+  }();
+  return topology;
+}
+
+#if defined(GEODE_IS_WINDOWS64)
+
+static std::vector<int> maskToLogical(KAFFINITY mask) {
+  std::vector<int> logical;
+  for (int i = 0; i < 64; i++) {
+    if (mask & (static_cast<KAFFINITY>(1) << i)) {
+      logical.push_back(i);
+    }
+  }
+  return logical;
+}
+
+void CpuTopology::detect() {
+  DWORD length = 0;
+  GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+  std::vector<uint8_t> buffer(length);
+  auto *info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *>(buffer.data());
+  if (length == 0 || !GetLogicalProcessorInformationEx(RelationAll, info, &length)) {
+    length = 0;
+  }
+
+  std::vector<KAFFINITY> l3Masks;
+  for (DWORD offset = 0; offset < length;) {
+    auto *entry = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *>(buffer.data() + offset);
+    if (entry->Relationship == RelationProcessorCore && entry->Processor.GroupMask[0].Group == 0) {
+      cores.push_back({ maskToLogical(entry->Processor.GroupMask[0].Mask), entry->Processor.EfficiencyClass, 0 });
+    } else if (entry->Relationship == RelationCache && entry->Cache.Level == 3 && entry->Cache.GroupMask.Group == 0) {
+      l3Masks.push_back(entry->Cache.GroupMask.Mask);
+    }
+    offset += entry->Size;
+  }
+
+  for (auto &core : cores) {
+    for (int i = 0; i < static_cast<int>(l3Masks.size()); i++) {
+      if (!core.logical.empty() && (l3Masks[i] & (static_cast<KAFFINITY>(1) << core.logical[0]))) {
+        core.l3 = i;
+      }
+    }
+  }
+  l3Count = std::max(static_cast<int>(l3Masks.size()), 1);
+}
+
+#elif defined(__APPLE__)
+
+void CpuTopology::detect() {
+  // threads can't be pinned here, qos classes steer them between performance and efficiency cores instead,
+  // so only the counts matter. perflevel0 is the fastest
+  int logical = static_cast<int>(std::thread::hardware_concurrency());
+  int performance = 0;
+  size_t size = sizeof(performance);
+  if (sysctlbyname("hw.perflevel0.logicalcpu", &performance, &size, nullptr, 0) != 0 || performance <= 0) {
+    performance = logical;
+  }
+  for (int i = 0; i < logical; i++) {
+    cores.push_back({ { i }, i < performance ? 1 : 0, 0 });
+  }
+  l3Count = 1;
+}
+
+#else
+
+static std::string readLine(const std::string &path) {
+  std::ifstream file(path);
+  std::string line;
+  std::getline(file, line);
+  return line;
+}
+
+static std::optional<int> parseInt(std::string_view text) {
+  int value;
+  auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+  if (error != std::errc() || end != text.data() + text.size()) {
+    return std::nullopt;
+  }
+  return value;
+}
+
+// "0-3,8,10-11", anything that doesn't parse is skipped
+static std::vector<int> parseCpuList(const std::string &list) {
+  std::vector<int> cpus;
+  std::stringstream stream(list);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    if (range.empty()) {
+      continue;
+    }
+    size_t dash = range.find('-');
+    auto first = parseInt(std::string_view(range).substr(0, dash));
+    auto last = dash == std::string::npos ? first : parseInt(std::string_view(range).substr(dash + 1));
+    if (!first || !last) {
+      continue;
+    }
+    for (int i = *first; i <= *last; i++) {
+      cpus.push_back(i);
+    }
+  }
+  return cpus;
+}
+
+void CpuTopology::detect() {
+  const std::string root = "/sys/devices/system/cpu/";
+  int logical = static_cast<int>(std::thread::hardware_concurrency());
+
+  // intel hybrid parts list their atom cores separately, arm big.little reports a capacity per cpu
+  std::set<int> atomCpus;
+  for (int cpu : parseCpuList(readLine("/sys/devices/cpu_atom/cpus"))) {
+    atomCpus.insert(cpu);
+  }
+
+  std::set<int> seen;
+  std::map<std::string, int> l3Ids;
+  for (int cpu = 0; cpu < logical; cpu++) {
+    if (seen.contains(cpu)) {
+      continue;
+    }
+    std::string dir = root + "cpu" + std::to_string(cpu) + "/";
+    std::vector<int> siblings = parseCpuList(readLine(dir + "topology/thread_siblings_list"));
+    if (siblings.empty()) {
+      siblings = { cpu };
+    }
+    seen.insert(siblings.begin(), siblings.end());
+
+    int efficiencyClass = atomCpus.contains(cpu) ? 0 : 1;
+    if (auto capacity = parseInt(readLine(dir + "cpu_capacity"))) {
+      efficiencyClass = *capacity;
+    }
+
+    std::string l3 = readLine(dir + "cache/index3/shared_cpu_list");
+    auto [it, _inserted] = l3Ids.try_emplace(l3, static_cast<int>(l3Ids.size()));
+    cores.push_back({ siblings, efficiencyClass, it->second });
+  }
+  l3Count = std::max(static_cast<int>(l3Ids.size()), 1);
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef REPLAYBUFFER_CPUTOPOLOGY_HPP
+#define REPLAYBUFFER_CPUTOPOLOGY_HPP
+
+#include <vector>
+
+// the logical processors grouped into physical cores, read once from the os. the efficiency class is higher
+// for faster cores and is the same everywhere on a machine without performance and efficiency cores. only
+// the first 64 logical processors are seen on windows, that's one processor group
+struct CpuTopology {
+  struct Core {
+    std::vector<int> logical; // smt siblings
+    int efficiencyClass;
+    int l3; // index of the last level cache the core sits behind
+  };
+
+  std::vector<Core> cores;
+  int l3Count;
+  int maxEfficiencyClass;
+
+  static const CpuTopology &get();
+
+private:
+  void detect();
+};
+
+#endif
@@ -0,0 +1,453 @@
+#include "FragmentRing.hpp"
+#include "ReplayBuffer.hpp"
+#include "ThreadPriority.hpp"
+#include "Timer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <optional>
+#include <utility>
+
+static constexpr AVRational kMicroseconds = { 1, 1000000 };
+
+static uint32_t readBe32(const uint8_t *data) {
+  return static_cast<uint32_t>(data[0]) << 24 | static_cast<uint32_t>(data[1]) << 16 |
+         static_cast<uint32_t>(data[2]) << 8 | data[3];
+}
+
+static uint64_t readBe64(const uint8_t *data) {
+  return static_cast<uint64_t>(readBe32(data)) << 32 | readBe32(data + 4);
+}
+
+// calls visit(type, offset, size) for every box between begin and end, stops at one that doesn't fit
+template<typename Visit>
+static void forEachBox(const std::vector<uint8_t> &data, size_t begin, size_t end, Visit &&visit) {
+  size_t position = begin;
+  while (position + 8 <= end) {
+    uint64_t size = readBe32(data.data() + position);
+    if (size == 1 && position + 16 <= end) {
+      size = readBe64(data.data() + position + 8);
+    }
+    if (size < 8 || size > end - position) {
+      return;
+    }
+    visit(reinterpret_cast<const char *>(data.data() + position + 4), position, static_cast<size_t>(size));
+    position += size;
+  }
+}
+
+static void freePackets(std::vector<AVPacket *> &packets) {
+  for (AVPacket *&pkt : packets) {
+    av_packet_free(&pkt);
+  }
+  packets.clear();
+}
+
+FragmentRing::FragmentRing() : m_formatCtx(nullptr), m_firstUs(-1), m_clipUs(0), m_running(false),
+                               m_cutRequested(false), m_cutGeneration(0), m_bytes(0), m_muxUs(0),
+                               m_muxedFragments(0), m_lastClipBytes(0), m_lastClipUs(0) {
+}
+
+FragmentRing::~FragmentRing() {
+  this->stop();
+}
+
+void FragmentRing::start(const std::vector<std::pair<int, std::shared_ptr<BaseEncoder>>> &streams, int64_t clipUs) {
+  this->stop();
+
+  int ret = avformat_alloc_output_context2(&m_formatCtx, nullptr, "mp4", nullptr);
+  if (m_formatCtx == nullptr) {
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not allocate fragment muxer, error: {}", errStr);
+  }
+  auto *buffer = static_cast<uint8_t *>(av_malloc(kIoBufferSize));
+  m_formatCtx->pb = avio_alloc_context(buffer, kIoBufferSize, 1, this, nullptr, &FragmentRing::writeOutput, nullptr);
+  if (m_formatCtx->pb == nullptr) {
+    av_free(buffer);
+    this->closeMuxer();
+    throw std::string("could not allocate fragment muxer output");
+  }
+  m_formatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+  for (const auto &[idx, encoder] : streams) {
+    AVStream *stream = avformat_new_stream(m_formatCtx, nullptr);
+    if (stream == nullptr) {
+      this->closeMuxer();
+      throw std::string("couldn't allocate fragment muxer stream");
+    }
+    avcodec_parameters_from_context(stream->codecpar, encoder->getCodecContext());
+    stream->time_base = encoder->getCodecContext()->time_base;
+    m_tracks.push_back({ idx, encoder, stream, std::numeric_limits<int64_t>::min() });
+    m_streams.push_back(idx);
+  }
+  std::ranges::sort(m_streams);
+
+  // the parameter sets only come in-band, so the moov waits for the first fragment to find them there
+  AVDictionary *muxOptions = nullptr;
+  av_dict_set(&muxOptions, "movflags", "frag_custom+empty_moov+delay_moov+default_base_moof", 0);
+  ret = avformat_write_header(m_formatCtx, &muxOptions);
+  av_dict_free(&muxOptions);
+  if (ret < 0) {
+    this->closeMuxer();
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not start fragment muxer, error: {}", errStr);
+  }
+  // the muxer picks its own timescales, track ids follow the stream order
+  for (const Track &track : m_tracks) {
+    m_trackTimeBases.push_back(track.stream->time_base);
+  }
+
+  m_firstUs = -1;
+  m_clipUs = clipUs;
+  m_cutRequested = false;
+  m_init.reset();
+  m_fragments.clear();
+  m_bytes = 0;
+  m_muxUs = 0;
+  m_muxedFragments = 0;
+  m_lastClipBytes = 0;
+  m_lastClipUs = 0;
+  m_running = true;
+  m_thread = std::thread(&FragmentRing::threadProc, this);
+}
+
+void FragmentRing::stop() {
+  {
+    std::lock_guard lock(m_mutex);
+    m_running = false;
+  }
+  m_cv.notify_all();
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+  // never finished with a trailer, what's in memory is all that's wanted out of it
+  std::lock_guard lock(m_mutex);
+  this->closeMuxer();
+  m_init.reset();
+  m_fragments.clear();
+  m_bytes = 0;
+}
+
+void FragmentRing::closeMuxer() {
+  if (m_formatCtx != nullptr) {
+    AVIOContext *pb = m_formatCtx->pb;
+    avformat_free_context(m_formatCtx);
+    m_formatCtx = nullptr;
+    if (pb != nullptr) {
+      av_freep(&pb->buffer);
+      avio_context_free(&pb);
+    }
+  }
+  m_tracks.clear();
+  m_streams.clear();
+  m_trackTimeBases.clear();
+  m_output.clear();
+}
+
+bool FragmentRing::isRunning() const {
+  return m_running;
+}
+
+std::vector<int> FragmentRing::getStreams() {
+  std::lock_guard lock(m_mutex);
+  return m_streams;
+}
+
+FragmentRing::Stats FragmentRing::getStats() {
+  std::lock_guard lock(m_mutex);
+  return { m_fragments.size(), m_bytes, m_muxUs, m_lastClipBytes, m_lastClipUs };
+}
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+int FragmentRing::writeOutput(void *opaque, const uint8_t *buf, int size) {
+#else
+int FragmentRing::writeOutput(void *opaque, uint8_t *buf, int size) {
+#endif
+  auto *ring = static_cast<FragmentRing *>(opaque);
+  ring->m_output.insert(ring->m_output.end(), buf, buf + size);
+  return size;
+}
+
+void FragmentRing::threadProc() {
+  placeCurrentThread(ThreadRole::Background);
+  while (m_running) {
+    bool flush;
+    {
+      std::unique_lock lock(m_mutex);
+      m_cv.wait_for(lock, kIdleWait, [this] { return !m_running || m_cutRequested; });
+      if (!m_running) {
+        break;
+      }
+      flush = std::exchange(m_cutRequested, false);
+    }
+
+    try {
+      // every finished gop gets a fragment of its own first, so a clip can still start on any of them
+      while (this->muxNext(false)) {
+      }
+      if (flush) {
+        this->muxNext(true);
+      }
+    } catch (const std::string &) {
+      // the muxer is in an unknown state now, clips go the long way for the rest of the session
+      m_running = false;
+    }
+
+    if (flush) {
+      std::lock_guard lock(m_mutex);
+      m_cutGeneration++;
+    }
+    m_cv.notify_all();
+  }
+
+  // a clip may be waiting on a cut that won't happen anymore
+  {
+    std::lock_guard lock(m_mutex);
+    m_cutGeneration++;
+  }
+  m_cv.notify_all();
+}
+
+bool FragmentRing::muxNext(bool flush) {
+  Track &video = m_tracks.front();
+  AVRational videoTimeBase = video.encoder->getCodecContext()->time_base;
+  std::vector<AVPacket *> packets = video.encoder->clonePacketsAfter(video.lastDts);
+
+  // the ring starts on a keyframe, whatever came before it can't be decoded
+  size_t begin = 0;
+  if (m_firstUs < 0) {
+    while (begin < packets.size() && (!(packets[begin]->flags & AV_PKT_FLAG_KEY) || packets[begin]->dts < 0)) {
+      begin++;
+    }
+    if (begin > 0) {
+      video.lastDts = packets[begin - 1]->dts;
+    }
+  }
+  // one gop up to the next keyframe unless a clip is waiting, the one still being encoded is left for next time
+  size_t end = packets.size();
+  if (!flush) {
+    end = begin;
+    for (size_t i = begin + 1; i < packets.size() && end == begin; i++) {
+      if (packets[i]->flags & AV_PKT_FLAG_KEY) {
+        end = i;
+      }
+    }
+  }
+  if (end == begin) {
+    freePackets(packets);
+    return false;
+  }
+
+  Timer timer;
+  timer.start();
+  int64_t startUs = av_rescale_q(packets[begin]->pts, videoTimeBase, kMicroseconds);
+  int64_t cutUs = end < packets.size() ? av_rescale_q(packets[end]->pts, videoTimeBase, kMicroseconds)
+                                       : std::numeric_limits<int64_t>::max();
+  int64_t endUs = startUs;
+  bool keyframe = (packets[begin]->flags & AV_PKT_FLAG_KEY) != 0;
+  if (m_firstUs < 0) {
+    m_firstUs = startUs;
+  }
+
+  int ret = 0;
+  for (size_t i = begin; i < end && ret >= 0; i++) {
+    endUs = std::max(endUs, av_rescale_q(packets[i]->pts + packets[i]->duration, videoTimeBase, kMicroseconds));
+    ret = ReplayBuffer::writePacket(m_formatCtx, video.stream, packets[i], videoTimeBase, 0);
+  }
+  video.lastDts = packets[end - 1]->dts;
+  freePackets(packets);
+
+  // audio goes in up to where the video was cut, the rest waits for the fragment it plays under
+  for (Track &track : m_tracks) {
+    if (&track == &video) {
+      continue;
+    }
+    AVRational timeBase = track.encoder->getCodecContext()->time_base;
+    std::vector<AVPacket *> audio = track.encoder->clonePacketsAfter(track.lastDts);
+    for (const AVPacket *pkt : audio) {
+      int64_t ptsUs = av_rescale_q(pkt->pts, timeBase, kMicroseconds);
+      if (ptsUs >= cutUs || ret < 0) {
+        break;
+      }
+      if (ptsUs >= m_firstUs) {
+        ret = ReplayBuffer::writePacket(m_formatCtx, track.stream, pkt, timeBase, 0);
+      }
+      track.lastDts = pkt->dts;
+    }
+    freePackets(audio);
+  }
+
+  if (ret >= 0) {
+    ret = av_interleaved_write_frame(m_formatCtx, nullptr);
+  }
+  if (ret >= 0) {
+    ret = av_write_frame(m_formatCtx, nullptr);
+  }
+  avio_flush(m_formatCtx->pb);
+  if (ret < 0) {
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not mux a fragment, error: {}", errStr);
+  }
+
+  // the first flush also carries the ftyp and moov, everything in front of the first moof is the init segment
+  std::shared_ptr<const std::vector<uint8_t>> init;
+  if (m_init == nullptr) {
+    size_t moof = m_output.size();
+    forEachBox(m_output, 0, m_output.size(), [this, &moof](const char *type, size_t offset, size_t) {
+      if (moof == m_output.size() && std::memcmp(type, "moof", 4) == 0) {
+        moof = offset;
+      }
+    });
+    init = std::make_shared<const std::vector<uint8_t>>(m_output.begin(), m_output.begin() + moof);
+    m_output.erase(m_output.begin(), m_output.begin() + moof);
+  }
+  if (m_output.empty()) {
+    std::lock_guard lock(m_mutex);
+    m_init = init != nullptr ? init : m_init;
+    return true;
+  }
+
+  Fragment fragment{ startUs, endUs, keyframe, {}, nullptr };
+  forEachBox(m_output, 0, m_output.size(), [&](const char *type, size_t moof, size_t moofSize) {
+    if (std::memcmp(type, "moof", 4) != 0) {
+      return;
+    }
+    forEachBox(m_output, moof + 8, moof + moofSize, [&](const char *type, size_t traf, size_t trafSize) {
+      if (std::memcmp(type, "traf", 4) != 0) {
+        return;
+      }
+      // movenc always writes a version 1 tfdt, a 64 bit decode time after the version and flags
+      uint32_t trackId = 0;
+      forEachBox(m_output, traf + 8, traf + trafSize, [&](const char *type, size_t box, size_t boxSize) {
+        if (std::memcmp(type, "tfhd", 4) == 0 && boxSize >= 16) {
+          trackId = readBe32(m_output.data() + box + 12);
+        } else if (std::memcmp(type, "tfdt", 4) == 0 && boxSize >= 20 && m_output[box + 8] == 1 && trackId > 0 &&
+                   trackId <= m_trackTimeBases.size()) {
+          fragment.times.push_back({ box + 12, trackId, readBe64(m_output.data() + box + 12) });
+        }
+      });
+    });
+  });
+  fragment.data = std::make_shared<const std::vector<uint8_t>>(std::move(m_output));
+  m_output.clear();
+  double muxUs = static_cast<double>(timer.stop());
+
+  std::lock_guard lock(m_mutex);
+  if (init != nullptr) {
+    m_init = init;
+  }
+  m_bytes += fragment.data->size();
+  m_muxUs = (m_muxUs * m_muxedFragments + muxUs) / (m_muxedFragments + 1);
+  m_muxedFragments++;
+  m_fragments.push_back(std::move(fragment));
+
+  // drop fragments from the front a whole gop at a time, so the oldest one left always starts on a keyframe
+  int64_t cutoff = endUs - m_clipUs - 1000000;
+  size_t keep = 0;
+  for (size_t i = 0; i < m_fragments.size(); i++) {
+    if (m_fragments[i].keyframe && m_fragments[i].startUs <= cutoff) {
+      keep = i;
+    }
+  }
+  for (size_t i = 0; i < keep; i++) {
+    m_bytes -= m_fragments.front().data->size();
+    m_fragments.pop_front();
+  }
+  return true;
+}
+
+bool FragmentRing::write(const std::filesystem::path &path, int64_t rangeStartUs, int64_t rangeEndUs) {
+  std::shared_ptr<const std::vector<uint8_t>> init;
+  std::vector<Fragment> fragments;
+  std::vector<AVRational> timeBases;
+  {
+    // the gop that's still open is cut into a fragment of its own first, so the clip reaches the newest frame
+    std::unique_lock lock(m_mutex);
+    if (!m_running) {
+      return false;
+    }
+    uint64_t generation = m_cutGeneration;
+    m_cutRequested = true;
+    m_cv.notify_all();
+    if (!m_cv.wait_for(lock, kCutTimeout, [&] { return m_cutGeneration != generation; }) || !m_running) {
+      return false;
+    }
+    if (m_init == nullptr || m_fragments.empty()) {
+      return false;
+    }
+
+    int64_t startUs = m_fragments.back().endUs - m_clipUs;
+    int64_t endUs = std::numeric_limits<int64_t>::max();
+    bool ranged = rangeStartUs >= 0 && rangeEndUs > rangeStartUs;
+    if (ranged) {
+      startUs = std::max(startUs, rangeStartUs);
+      endUs = rangeEndUs;
+    }
+    // the last gop starting at or before the start, or the oldest one when the ring doesn't reach back that far
+    std::optional<size_t> first;
+    for (size_t i = 0; i < m_fragments.size(); i++) {
+      if (m_fragments[i].keyframe && (m_fragments[i].startUs <= startUs || !first)) {
+        first = i;
+      }
+    }
+    // a range the ring has already dropped the start of is left to the full mux, which goes back further
+    if (!first || (ranged && m_fragments[*first].startUs > rangeStartUs)) {
+      return false;
+    }
+    init = m_init;
+    timeBases = m_trackTimeBases;
+    for (size_t i = *first; i < m_fragments.size() && m_fragments[i].startUs < endUs; i++) {
+      fragments.push_back(m_fragments[i]);
+    }
+    if (fragments.empty()) {
+      return false;
+    }
+  }
+
+  // every track is moved back by the same time, the earliest one in the first fragment starts at 0
+  int64_t baseUs = std::numeric_limits<int64_t>::max();
+  for (const TrackTime &time : fragments.front().times) {
+    baseUs = std::min(baseUs, av_rescale_q(static_cast<int64_t>(time.decodeTime), timeBases[time.track - 1],
+                                           kMicroseconds));
+  }
+
+  Timer timer;
+  timer.start();
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    throw fmt::format("could not open {} for writing", path.filename().string());
+  }
+  size_t bytes = init->size();
+  file.write(reinterpret_cast<const char *>(init->data()), static_cast<std::streamsize>(init->size()));
+  for (const Fragment &fragment : fragments) {
+    const auto *data = reinterpret_cast<const char *>(fragment.data->data());
+    size_t position = 0;
+    for (const TrackTime &time : fragment.times) {
+      int64_t base = av_rescale_q(baseUs, kMicroseconds, timeBases[time.track - 1]);
+      uint64_t decodeTime = time.decodeTime - std::min(time.decodeTime, static_cast<uint64_t>(std::max<int64_t>(base, 0)));
+      char patched[8];
+      for (int i = 0; i < 8; i++) {
+        patched[i] = static_cast<char>(decodeTime >> (56 - i * 8));
+      }
+      file.write(data + position, static_cast<std::streamsize>(time.offset - position));
+      file.write(patched, sizeof(patched));
+      position = time.offset + sizeof(patched);
+    }
+    file.write(data + position, static_cast<std::streamsize>(fragment.data->size() - position));
+    bytes += fragment.data->size();
+  }
+  file.close();
+  if (!file) {
+    throw fmt::format("could not write to {}", path.filename().string());
+  }
+
+  std::lock_guard lock(m_mutex);
+  m_lastClipBytes = bytes;
+  m_lastClipUs = timer.stop();
+  return true;
+}
@@ -0,0 +1,105 @@
+#ifndef REPLAYBUFFER_FRAGMENTRING_HPP
+#define REPLAYBUFFER_FRAGMENTRING_HPP
+
+#include "BaseEncoder.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// keeps the buffer muxed ahead of time as fragmented mp4, a moof+mdat per finished gop held in memory, so saving
+// a clip is writing out the init segment and the fragments it covers instead of muxing the whole buffer again.
+// a thread of its own pulls new packets from the encoders as they come in. fragments keep the capture clock's
+// timestamps, the decode times in them are moved back to 0 while they're written out
+class FragmentRing {
+public:
+  static constexpr auto kIdleWait = std::chrono::milliseconds(100);
+  // how long a clip waits for the gop that's still being encoded to be cut into a fragment
+  static constexpr auto kCutTimeout = std::chrono::milliseconds(500);
+  static constexpr int kIoBufferSize = 64 * 1024;
+
+  struct Stats {
+    size_t fragments;
+    size_t bytes;
+    double muxUs;         // per fragment
+    size_t lastClipBytes;
+    int64_t lastClipUs;   // how long writing the last clip took
+  };
+
+  FragmentRing();
+  ~FragmentRing();
+
+  // streams are replay buffer index and encoder, video first, all of them already initialised. clipUs is what a
+  // clip without a range takes, the ring keeps a little more than that. throws a std::string
+  void start(const std::vector<std::pair<int, std::shared_ptr<BaseEncoder>>> &streams, int64_t clipUs);
+  void stop();
+  bool isRunning() const;
+  // the replay buffer indices that are muxed, ascending
+  std::vector<int> getStreams();
+  // the range works like ClipOptions'. false when the ring can't serve it and the clip has to be muxed the long
+  // way, throws a std::string when the file can't be written
+  bool write(const std::filesystem::path &path, int64_t rangeStartUs, int64_t rangeEndUs);
+  Stats getStats();
+
+private:
+  struct Track {
+    int idx;
+    std::shared_ptr<BaseEncoder> encoder;
+    AVStream *stream;
+    int64_t lastDts; // everything up to here is muxed, or was skipped
+  };
+
+  // where a tfdt's decode time sits in a fragment, so it can be patched without copying the fragment
+  struct TrackTime {
+    size_t offset;
+    uint32_t track;
+    uint64_t decodeTime;
+  };
+
+  struct Fragment {
+    int64_t startUs, endUs;
+    bool keyframe; // starts a gop, a clip can start here
+    std::vector<TrackTime> times;
+    std::shared_ptr<const std::vector<uint8_t>> data;
+  };
+
+  std::vector<Track> m_tracks;
+  std::vector<int> m_streams;
+  std::vector<AVRational> m_trackTimeBases; // by mp4 track id - 1
+  AVFormatContext *m_formatCtx;
+  std::vector<uint8_t> m_output; // what the muxer wrote since the last fragment
+  int64_t m_firstUs;             // the ring starts at the first keyframe, audio before it is dropped
+  int64_t m_clipUs;
+
+  std::thread m_thread;
+  std::atomic<bool> m_running;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_cutRequested;
+  uint64_t m_cutGeneration; // bumped every time a requested cut is done
+  std::shared_ptr<const std::vector<uint8_t>> m_init;
+  std::deque<Fragment> m_fragments;
+  size_t m_bytes;
+  double m_muxUs;
+  size_t m_muxedFragments;
+  size_t m_lastClipBytes;
+  int64_t m_lastClipUs;
+
+  void threadProc();
+  // true when a fragment was cut. flush also cuts the gop that isn't finished yet
+  bool muxNext(bool flush);
+  void closeMuxer();
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+  static int writeOutput(void *opaque, const uint8_t *buf, int size);
+#else
+  static int writeOutput(void *opaque, uint8_t *buf, int size);
+#endif
+};
+
+#endif
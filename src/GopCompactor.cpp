@@ -0,0 +1,109 @@
+#include "GopCompactor.hpp"
+#include "ThreadPriority.hpp"
+
+#include <algorithm>
+#include <limits>
+
+static size_t totalSize(const std::vector<AVPacket *> &packets) {
+  size_t bytes = 0;
+  for (const AVPacket *pkt : packets) {
+    bytes += pkt->size;
+  }
+  return bytes;
+}
+
+GopCompactor::GopCompactor() : m_running(false), m_minAgeUs(0), m_bitrate(0), m_watermark(0), m_savedBytes(0),
+                               m_compactedGops(0) {
+}
+
+GopCompactor::~GopCompactor() {
+  this->stop();
+}
+
+void GopCompactor::start(std::shared_ptr<VideoEncoder> encoder, int64_t minAgeUs, int64_t bitrate) {
+  this->stop();
+  m_encoder = std::move(encoder);
+  m_minAgeUs = minAgeUs;
+  m_bitrate = bitrate;
+  m_watermark = std::numeric_limits<int64_t>::min();
+  m_savedBytes = 0;
+  m_compactedGops = 0;
+  m_running = true;
+  m_thread = std::thread(&GopCompactor::threadProc, this);
+}
+
+void GopCompactor::stop() {
+  {
+    std::lock_guard lock(m_wakeMutex);
+    m_running = false;
+  }
+  m_wakeCv.notify_all();
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+  // the transcoder's decoder was set up from this encoder's parameters, which may change before the next start
+  m_transcoder.reset();
+  m_encoder.reset();
+}
+
+int64_t GopCompactor::getSavedBytes() const {
+  return m_savedBytes;
+}
+
+int64_t GopCompactor::getCompactedGopCount() const {
+  return m_compactedGops;
+}
+
+void GopCompactor::threadProc() {
+  placeCurrentThread(ThreadRole::Background);
+  while (m_running) {
+    if (this->compactNext()) {
+      continue;
+    }
+    std::unique_lock lock(m_wakeMutex);
+    m_wakeCv.wait_for(lock, kIdleWait, [this] { return !m_running; });
+  }
+}
+
+bool GopCompactor::compactNext() {
+  AVRational timeBase = m_encoder->getCodecContext()->time_base;
+  auto gop = m_encoder->cloneGop(m_watermark, av_rescale_q(m_minAgeUs, { 1, 1000000 }, timeBase));
+  if (gop.empty()) {
+    return false;
+  }
+
+  int64_t keyPts = gop.front()->pts;
+  int64_t lastPts = std::ranges::max(gop, {}, &AVPacket::pts)->pts;
+  size_t originalSize = totalSize(gop);
+
+  std::vector<AVPacket *> compact;
+  try {
+    if (!m_transcoder) {
+      m_transcoder = std::make_unique<GopTranscoder>(m_encoder->getCodecContext(), [this] {
+        return m_encoder->createCompatibleContext({ .bitrate = m_bitrate });
+      });
+    }
+    compact = m_transcoder->transcode(gop, keyPts);
+  } catch (const std::string &) {
+    // leave this gop at full quality and move on
+  }
+
+  // only swap when every frame made it through and we actually saved something
+  if (!compact.empty() && compact.size() == gop.size() && totalSize(compact) < originalSize) {
+    size_t compactSize = totalSize(compact);
+    if (m_encoder->replaceGop(keyPts, std::move(compact))) {
+      m_savedBytes += static_cast<int64_t>(originalSize - compactSize);
+      m_compactedGops++;
+    }
+  } else {
+    for (AVPacket *&pkt : compact) {
+      av_packet_free(&pkt);
+    }
+  }
+
+  for (AVPacket *&pkt : gop) {
+    av_packet_free(&pkt);
+  }
+  m_watermark = lastPts + 1;
+  return true;
+}
@@ -0,0 +1,43 @@
+#ifndef REPLAYBUFFER_GOPCOMPACTOR_HPP
+#define REPLAYBUFFER_GOPCOMPACTOR_HPP
+
+#include "GopTranscoder.hpp"
+#include "VideoEncoder.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// re-encodes video history older than a threshold at a lower bitrate, one gop at a time on a background thread,
+// and swaps it into the packet buffer in place of the original. every gop carries its own parameter sets in-band,
+// so clips can cross from the compact tier into the full quality one without any special handling
+class GopCompactor {
+  std::shared_ptr<VideoEncoder> m_encoder;
+  std::unique_ptr<GopTranscoder> m_transcoder;
+  std::thread m_thread;
+  std::atomic<bool> m_running;
+  std::mutex m_wakeMutex;
+  std::condition_variable m_wakeCv;
+  int64_t m_minAgeUs;
+  int64_t m_bitrate;
+  int64_t m_watermark; // everything before this pts has already been looked at
+  std::atomic<int64_t> m_savedBytes;
+  std::atomic<int64_t> m_compactedGops;
+
+  void threadProc();
+  bool compactNext();
+
+public:
+  static constexpr auto kIdleWait = std::chrono::milliseconds(250);
+
+  GopCompactor();
+  ~GopCompactor();
+
+  void start(std::shared_ptr<VideoEncoder> encoder, int64_t minAgeUs, int64_t bitrate);
+  void stop();
+  int64_t getSavedBytes() const;
+  int64_t getCompactedGopCount() const;
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include "GopTranscoder.hpp"
+
+#include <algorithm>
+
+GopTranscoder::GopTranscoder(const AVCodecContext *source, std::function<AVCodecContext *()> encoderFactory)
+  : m_decCtx(nullptr), m_swsCtx(nullptr), m_decFrame(nullptr), m_scaledFrame(nullptr), m_packet(nullptr),
+    m_encoderFactory(std::move(encoderFactory)) {
+  const AVCodec *decoder = avcodec_find_decoder(source->codec_id);
+  if (decoder == nullptr) {
+    throw fmt::format("no decoder available for {}", avcodec_get_name(source->codec_id));
+  }
+
+  m_decCtx = avcodec_alloc_context3(decoder);
+  AVCodecParameters *params = avcodec_parameters_alloc();
+  avcodec_parameters_from_context(params, source);
+  avcodec_parameters_to_context(m_decCtx, params);
+  avcodec_parameters_free(&params);
+  m_decCtx->pkt_timebase = source->time_base;
+
+  int ret = avcodec_open2(m_decCtx, decoder, nullptr);
+  if (ret < 0) {
+    avcodec_free_context(&m_decCtx);
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not open decoder, error: {}", errStr);
+  }
+
+  m_decFrame = av_frame_alloc();
+  m_scaledFrame = av_frame_alloc();
+  m_packet = av_packet_alloc();
+}
+
+GopTranscoder::~GopTranscoder() {
+  av_packet_free(&m_packet);
+  av_frame_free(&m_scaledFrame);
+  av_frame_free(&m_decFrame);
+  if (m_swsCtx != nullptr) {
+    sws_free_context(&m_swsCtx);
+  }
+  avcodec_free_context(&m_decCtx);
+}
+
+std::vector<AVPacket *> GopTranscoder::transcode(std::span<AVPacket *const> gop, int64_t firstPts) {
+  std::vector<PacketPtr> out;
+  if (gop.empty()) {
+    return {};
+  }
+
+  std::unique_ptr<AVCodecContext, CodecContextDeleter> encCtx(m_encoderFactory());
+  avcodec_flush_buffers(m_decCtx);
+
+  auto encodeDecodedFrames = [&] {
+    while (avcodec_receive_frame(m_decCtx, m_decFrame) >= 0) {
+      int64_t pts = m_decFrame->best_effort_timestamp;
+      if (pts != AV_NOPTS_VALUE && pts >= firstPts) {
+        AVFrame *frame = this->scaleFrame(m_decFrame, encCtx.get());
+        frame->pts = pts;
+        frame->pict_type = AV_PICTURE_TYPE_NONE;
+        if (avcodec_send_frame(encCtx.get(), frame) >= 0) {
+          this->drainEncoder(encCtx.get(), out);
+        }
+      }
+      av_frame_unref(m_decFrame);
+    }
+  };
+
+  for (AVPacket *pkt : gop) {
+    if (avcodec_send_packet(m_decCtx, pkt) < 0) {
+      continue;
+    }
+    encodeDecodedFrames();
+  }
+  avcodec_send_packet(m_decCtx, nullptr);
+  encodeDecodedFrames();
+
+  avcodec_send_frame(encCtx.get(), nullptr);
+  this->drainEncoder(encCtx.get(), out);
+  encCtx.reset();
+
+  // the output has no reordering, so handing it the tail of the source decode timeline keeps dts
+  // monotonic against whatever gets stream-copied after it
+  std::vector<int64_t> sourceDts;
+  for (AVPacket *pkt : gop) {
+    if (pkt->dts != AV_NOPTS_VALUE) {
+      sourceDts.push_back(pkt->dts);
+    }
+  }
+  std::ranges::sort(sourceDts);
+  if (sourceDts.size() >= out.size()) {
+    auto tail = sourceDts.end() - static_cast<std::ptrdiff_t>(out.size());
+    for (size_t i = 0; i < out.size(); i++) {
+      out[i]->dts = std::min(tail[i], out[i]->pts);
+    }
+  }
+
+  std::vector<AVPacket *> packets;
+  packets.reserve(out.size());
+  for (PacketPtr &pkt : out) {
+    packets.push_back(pkt.release());
+  }
+  return packets;
+}
+
+AVFrame *GopTranscoder::scaleFrame(AVFrame *frame, const AVCodecContext *encCtx) {
+  if (frame->width == encCtx->width && frame->height == encCtx->height && frame->format == encCtx->pix_fmt) {
+    return frame;
+  }
+
+  m_swsCtx = sws_getCachedContext(
+    m_swsCtx,
+    frame->width,
+    frame->height,
+    static_cast<AVPixelFormat>(frame->format),
+    encCtx->width,
+    encCtx->height,
+    encCtx->pix_fmt,
+    SWS_BILINEAR,
+    nullptr,
+    nullptr,
+    nullptr
+    );
+
+  if (m_scaledFrame->width != encCtx->width || m_scaledFrame->height != encCtx->height) {
+    av_frame_unref(m_scaledFrame);
+    m_scaledFrame->width = encCtx->width;
+    m_scaledFrame->height = encCtx->height;
+    m_scaledFrame->format = encCtx->pix_fmt;
+    int ret = av_frame_get_buffer(m_scaledFrame, 0);
+    if (ret < 0) {
+      char errStr[64];
+      av_make_error_string(errStr, 64, ret);
+      throw fmt::format("could not alloc frame, error: {}", errStr);
+    }
+  }
+
+  av_frame_make_writable(m_scaledFrame);
+  sws_scale(m_swsCtx, frame->data, frame->linesize, 0, frame->height, m_scaledFrame->data, m_scaledFrame->linesize);
+  return m_scaledFrame;
+}
+
+void GopTranscoder::drainEncoder(AVCodecContext *encCtx, std::vector<PacketPtr> &out) {
+  while (avcodec_receive_packet(encCtx, m_packet) >= 0) {
+    PacketPtr pkt(av_packet_alloc());
+    av_packet_move_ref(pkt.get(), m_packet);
+    out.push_back(std::move(pkt));
+  }
+}
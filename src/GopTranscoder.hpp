@@ -0,0 +1,45 @@
+#ifndef REPLAYBUFFER_GOPTRANSCODER_HPP
+#define REPLAYBUFFER_GOPTRANSCODER_HPP
+
+#include <functional>
+#include <memory>
+#include <span>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+// decodes a run of packets starting at a keyframe and re-encodes the frames from firstPts onwards.
+// the output keeps the decode timeline (dts) of the source packets so it can be spliced back in
+// between stream-copied packets
+class GopTranscoder {
+  AVCodecContext *m_decCtx;
+  SwsContext *m_swsCtx;
+  AVFrame *m_decFrame;
+  AVFrame *m_scaledFrame;
+  AVPacket *m_packet;
+  std::function<AVCodecContext *()> m_encoderFactory;
+
+  // scaleFrame can throw halfway through a gop, so the encoder and what it made so far free themselves
+  struct CodecContextDeleter {
+    void operator()(AVCodecContext *ctx) const { avcodec_free_context(&ctx); }
+  };
+  struct PacketDeleter {
+    void operator()(AVPacket *pkt) const { av_packet_free(&pkt); }
+  };
+  using PacketPtr = std::unique_ptr<AVPacket, PacketDeleter>;
+
+public:
+  GopTranscoder(const AVCodecContext *source, std::function<AVCodecContext *()> encoderFactory);
+  ~GopTranscoder();
+
+  std::vector<AVPacket *> transcode(std::span<AVPacket *const> gop, int64_t firstPts);
+
+private:
+  AVFrame *scaleFrame(AVFrame *frame, const AVCodecContext *encCtx);
+  void drainEncoder(AVCodecContext *encCtx, std::vector<PacketPtr> &out);
+};
+
+#endif
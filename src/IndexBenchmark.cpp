@@ -0,0 +1,101 @@
+#include "IndexBenchmark.hpp"
+#include "PacketIndex.hpp"
+#include "Timer.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <ranges>
+
+template<typename Fn>
+static double timeQuery(Fn &&fn) {
+  // keeps the compiler from throwing the answers away
+  volatile int64_t sink = 0;
+  Timer timer;
+  timer.start();
+  for (int i = 0; i < IndexBenchmark::kRepeats; i++) {
+    sink = sink + fn(i);
+  }
+  return static_cast<double>(timer.stop()) / IndexBenchmark::kRepeats;
+}
+
+IndexBenchmark::Result IndexBenchmark::run() {
+  // packets without payloads, only the metadata matters here. one frame per pts, a keyframe per gop and a bit
+  // of size variation so nothing is constant
+  std::deque<AVPacket *> packets;
+  int64_t frames = static_cast<int64_t>(kMinutes) * 60 * kFramerate;
+  for (int64_t i = 0; i < frames; i++) {
+    AVPacket *pkt = av_packet_alloc();
+    pkt->pts = i;
+    pkt->dts = i - 1;
+    pkt->size = 2000 + static_cast<int>(i % 7) * 100;
+    pkt->flags = i % kGopFrames == 0 ? AV_PKT_FLAG_KEY : 0;
+    packets.push_back(pkt);
+  }
+
+  Result result;
+  result.packets = packets.size();
+  Timer timer;
+  timer.start();
+  PacketIndex index(packets);
+  result.buildMs = static_cast<double>(timer.stop()) / 1000.0;
+
+  auto target = [frames](int i) { return static_cast<int64_t>(i) * 7919 % frames; };
+
+  result.queries.push_back({ "min pts/dts",
+    timeQuery([&index](int) { return std::min(index.minPts(), index.minDts()); }),
+    timeQuery([&packets](int) {
+      auto pts = packets | std::views::filter([](AVPacket *pkt) { return pkt->pts != AV_NOPTS_VALUE; });
+      auto dts = packets | std::views::filter([](AVPacket *pkt) { return pkt->dts != AV_NOPTS_VALUE; });
+      auto ptsMin = std::ranges::min_element(pts, [](AVPacket *a, AVPacket *b) { return a->pts < b->pts; });
+      auto dtsMin = std::ranges::min_element(dts, [](AVPacket *a, AVPacket *b) { return a->dts < b->dts; });
+      return std::min((*ptsMin)->pts, (*dtsMin)->dts);
+    }) });
+
+  result.queries.push_back({ "buffered bytes",
+    timeQuery([&index](int) { return static_cast<int64_t>(index.bytes()); }),
+    timeQuery([&packets](int) {
+      int64_t bytes = 0;
+      for (const AVPacket *pkt : packets) {
+        bytes += pkt->size;
+      }
+      return bytes;
+    }) });
+
+  result.queries.push_back({ "keyframe before pts",
+    timeQuery([&index, &target](int i) {
+      return static_cast<int64_t>(index.keyframeAtOrBefore(target(i)).value_or(0));
+    }),
+    timeQuery([&packets, &target](int i) {
+      int64_t pts = target(i);
+      size_t found = 0;
+      for (size_t j = 0; j < packets.size(); j++) {
+        if ((packets[j]->flags & AV_PKT_FLAG_KEY) && packets[j]->pts <= pts) {
+          found = j;
+        }
+      }
+      return static_cast<int64_t>(found);
+    }) });
+
+  result.queries.push_back({ "gop after keyframe",
+    timeQuery([&index, &target](int i) {
+      size_t begin = index.keyframeAtOrAfter(target(i)).value_or(0);
+      return static_cast<int64_t>(index.nextKeyframe(begin) - begin);
+    }),
+    timeQuery([&packets, &target](int i) {
+      int64_t pts = target(i);
+      size_t begin = 0;
+      while (begin < packets.size() && !((packets[begin]->flags & AV_PKT_FLAG_KEY) && packets[begin]->pts >= pts)) {
+        begin++;
+      }
+      size_t end = begin + 1;
+      while (end < packets.size() && !(packets[end]->flags & AV_PKT_FLAG_KEY)) {
+        end++;
+      }
+      return static_cast<int64_t>(end - begin);
+    }) });
+
+  for (AVPacket *&pkt : packets) {
+    av_packet_free(&pkt);
+  }
+  return result;
+}
@@ -0,0 +1,32 @@
+#ifndef REPLAYBUFFER_INDEXBENCHMARK_HPP
+#define REPLAYBUFFER_INDEXBENCHMARK_HPP
+
+#include <cstddef>
+#include <vector>
+
+// times the questions the encoders ask their buffer, once through the packet index and once by walking the
+// packets the way it used to be done, on a made up buffer as long as the longest one anyone records
+class IndexBenchmark {
+public:
+  static constexpr int kMinutes = 30;
+  static constexpr int kFramerate = 60;
+  static constexpr int kGopFrames = 60;
+  static constexpr int kRepeats = 200;
+
+  struct Query {
+    const char *name;
+    double indexedUs; // per query
+    double scanUs;
+  };
+
+  struct Result {
+    size_t packets;
+    double buildMs; // indexing the whole buffer from scratch, what a compacted gop costs
+    std::vector<Query> queries;
+  };
+
+  // blocking, run it off the main thread
+  static Result run();
+};
+
+#endif
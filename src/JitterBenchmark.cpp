@@ -0,0 +1,123 @@
+#include "JitterBenchmark.hpp"
+#include "ThreadPriority.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+JitterBenchmark &JitterBenchmark::getInstance() {
+  static JitterBenchmark instance;
+  return instance;
+}
+
+void JitterBenchmark::start() {
+  if (m_phase != Phase::Idle) {
+    return;
+  }
+  this->beginPhase(Phase::Unplaced);
+}
+
+void JitterBenchmark::beginPhase(Phase phase) {
+  this->stopLoad();
+  m_phase = phase;
+  if (phase == Phase::Idle) {
+    // back to whatever the setting is now, it may have been flipped meanwhile
+    placeGameThread();
+    return;
+  }
+
+  bool placed = phase == Phase::Placed;
+  placeGameThread(placed);
+  m_frame = 0;
+  m_frameTimes.clear();
+  m_frameTimes.reserve(kFrames);
+  this->startLoad(placed);
+}
+
+void JitterBenchmark::onFrame() {
+  if (m_phase == Phase::Idle) {
+    return;
+  }
+  if (m_frame > kWarmupFrames) {
+    m_frameTimes.push_back(m_frameTimer.stop());
+  }
+  m_frameTimer.start();
+  if (++m_frame <= kWarmupFrames + kFrames) {
+    return;
+  }
+
+  m_results[m_phase == Phase::Placed ? 1 : 0] = summarize(m_frameTimes);
+  if (m_phase == Phase::Unplaced) {
+    this->beginPhase(Phase::Placed);
+  } else {
+    m_hasResults = true;
+    this->beginPhase(Phase::Idle);
+  }
+}
+
+bool JitterBenchmark::isRunning() const {
+  return m_phase != Phase::Idle;
+}
+
+bool JitterBenchmark::hasResults() const {
+  return m_hasResults;
+}
+
+const JitterBenchmark::Result &JitterBenchmark::getResult(bool placed) const {
+  return m_results[placed ? 1 : 0];
+}
+
+void JitterBenchmark::startLoad(bool placed) {
+  m_loadRunning = true;
+  unsigned threads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+  for (unsigned i = 0; i < threads; i++) {
+    m_load.emplace_back(&JitterBenchmark::loadProc, this, placed);
+  }
+}
+
+void JitterBenchmark::stopLoad() {
+  m_loadRunning = false;
+  for (auto &thread : m_load) {
+    thread.join();
+  }
+  m_load.clear();
+}
+
+void JitterBenchmark::loadProc(bool placed) {
+  placeCurrentThread(ThreadRole::Encode, placed);
+  std::vector<uint32_t> buffer(kLoadBytes / sizeof(uint32_t));
+  uint32_t state = 1;
+  while (m_loadRunning) {
+    // a cache line apart, with a little arithmetic in between, about what motion search does to memory
+    for (size_t i = 0; i < buffer.size(); i += 16) {
+      state = state * 1664525u + 1013904223u;
+      buffer[i] += state;
+    }
+  }
+}
+
+JitterBenchmark::Result JitterBenchmark::summarize(const std::vector<int64_t> &frameTimes) {
+  Result result {};
+  if (frameTimes.empty()) {
+    return result;
+  }
+  double sum = 0.0;
+  for (int64_t us : frameTimes) {
+    sum += static_cast<double>(us);
+  }
+  double mean = sum / static_cast<double>(frameTimes.size());
+
+  std::vector<double> deviations;
+  double variance = 0.0;
+  for (int64_t us : frameTimes) {
+    double deviation = static_cast<double>(us) - mean;
+    variance += deviation * deviation;
+    deviations.push_back(std::abs(deviation));
+  }
+  variance /= static_cast<double>(frameTimes.size());
+  std::sort(deviations.begin(), deviations.end());
+
+  result.meanMs = mean / 1000.0;
+  result.stddevMs = std::sqrt(variance) / 1000.0;
+  result.p99Ms = deviations[std::min(deviations.size() - 1, deviations.size() * 99 / 100)] / 1000.0;
+  return result;
+}
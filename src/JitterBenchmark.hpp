@@ -0,0 +1,53 @@
+#ifndef REPLAYBUFFER_JITTERBENCHMARK_HPP
+#define REPLAYBUFFER_JITTERBENCHMARK_HPP
+
+#include "Timer.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// measures how steady the game's frames stay under encoder-like load, first with thread placement off and then
+// with it on. the load is one thread per logical processor but one, each churning through its own buffer so
+// it competes for cache as well as for cores. the setting itself is left alone, each phase places the game and
+// the load threads itself
+class JitterBenchmark {
+public:
+  static constexpr int kWarmupFrames = 60;
+  static constexpr int kFrames = 600;
+  static constexpr size_t kLoadBytes = 8 << 20;
+
+  struct Result {
+    double meanMs;
+    double stddevMs;
+    double p99Ms; // 99th percentile of how far a frame was from the mean
+  };
+
+  static JitterBenchmark &getInstance();
+
+  // main thread
+  void start();
+  void onFrame();
+  bool isRunning() const;
+  bool hasResults() const;
+  const Result &getResult(bool placed) const;
+
+private:
+  enum class Phase { Idle, Unplaced, Placed };
+
+  Phase m_phase = Phase::Idle;
+  bool m_hasResults = false;
+  std::vector<std::thread> m_load;
+  std::atomic<bool> m_loadRunning = false;
+  Timer m_frameTimer;
+  int m_frame = 0;
+  std::vector<int64_t> m_frameTimes;
+  Result m_results[2] {};
+
+  void beginPhase(Phase phase);
+  void startLoad(bool placed);
+  void stopLoad();
+  void loadProc(bool placed);
+  static Result summarize(const std::vector<int64_t> &frameTimes);
+};
+
+#endif
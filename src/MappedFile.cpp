@@ -0,0 +1,175 @@
+#include "MappedFile.hpp"
+
+#include <string>
+
+#if !defined(GEODE_IS_WINDOWS64)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(GEODE_IS_WINDOWS64)
+
+MappedFile::MappedFile() : m_file(INVALID_HANDLE_VALUE), m_mapping(nullptr), m_data(nullptr), m_size(0) {
+}
+
+void MappedFile::create(const std::filesystem::path &path, size_t size) {
+  this->close();
+  m_file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                       FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (m_file == INVALID_HANDLE_VALUE) {
+    throw fmt::format("could not create {}, error {}", path.string(), GetLastError());
+  }
+  m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32),
+                                 static_cast<DWORD>(size & 0xFFFFFFFF), nullptr);
+  if (m_mapping == nullptr) {
+    DWORD error = GetLastError();
+    this->close();
+    throw fmt::format("could not map {}, error {}", path.string(), error);
+  }
+  m_data = static_cast<uint8_t *>(MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, size));
+  if (m_data == nullptr) {
+    DWORD error = GetLastError();
+    this->close();
+    throw fmt::format("could not map {}, error {}", path.string(), error);
+  }
+  m_size = size;
+}
+
+void MappedFile::openReadOnly(const std::filesystem::path &path) {
+  this->close();
+  m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (m_file == INVALID_HANDLE_VALUE) {
+    throw fmt::format("could not open {}, error {}", path.string(), GetLastError());
+  }
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(m_file, &fileSize)) {
+    DWORD error = GetLastError();
+    this->close();
+    throw fmt::format("could not size {}, error {}", path.string(), error);
+  }
+  m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (m_mapping == nullptr) {
+    DWORD error = GetLastError();
+    this->close();
+    throw fmt::format("could not map {}, error {}", path.string(), error);
+  }
+  m_data = static_cast<uint8_t *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+  if (m_data == nullptr) {
+    DWORD error = GetLastError();
+    this->close();
+    throw fmt::format("could not map {}, error {}", path.string(), error);
+  }
+  m_size = static_cast<size_t>(fileSize.QuadPart);
+}
+
+void MappedFile::close() {
+  if (m_data != nullptr) {
+    UnmapViewOfFile(m_data);
+    m_data = nullptr;
+  }
+  if (m_mapping != nullptr) {
+    CloseHandle(m_mapping);
+    m_mapping = nullptr;
+  }
+  if (m_file != INVALID_HANDLE_VALUE) {
+    CloseHandle(m_file);
+    m_file = INVALID_HANDLE_VALUE;
+  }
+  m_size = 0;
+}
+
+void MappedFile::flush(size_t offset, size_t length) {
+  if (m_data != nullptr) {
+    FlushViewOfFile(m_data + offset, length);
+  }
+}
+
+#else
+
+MappedFile::MappedFile() : m_fd(-1), m_data(nullptr), m_size(0) {
+}
+
+void MappedFile::create(const std::filesystem::path &path, size_t size) {
+  this->close();
+  m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (m_fd < 0) {
+    throw fmt::format("could not create {}, errno {}", path.string(), errno);
+  }
+  if (ftruncate(m_fd, static_cast<off_t>(size)) < 0) {
+    int error = errno;
+    this->close();
+    throw fmt::format("could not size {}, errno {}", path.string(), error);
+  }
+  void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+  if (data == MAP_FAILED) {
+    int error = errno;
+    this->close();
+    throw fmt::format("could not map {}, errno {}", path.string(), error);
+  }
+  m_data = static_cast<uint8_t *>(data);
+  m_size = size;
+}
+
+void MappedFile::openReadOnly(const std::filesystem::path &path) {
+  this->close();
+  m_fd = ::open(path.c_str(), O_RDONLY);
+  if (m_fd < 0) {
+    throw fmt::format("could not open {}, errno {}", path.string(), errno);
+  }
+  struct stat info {};
+  if (fstat(m_fd, &info) < 0) {
+    int error = errno;
+    this->close();
+    throw fmt::format("could not size {}, errno {}", path.string(), error);
+  }
+  void *data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, m_fd, 0);
+  if (data == MAP_FAILED) {
+    int error = errno;
+    this->close();
+    throw fmt::format("could not map {}, errno {}", path.string(), error);
+  }
+  m_data = static_cast<uint8_t *>(data);
+  m_size = static_cast<size_t>(info.st_size);
+}
+
+void MappedFile::close() {
+  if (m_data != nullptr) {
+    munmap(m_data, m_size);
+    m_data = nullptr;
+  }
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  m_size = 0;
+}
+
+void MappedFile::flush(size_t offset, size_t length) {
+  if (m_data != nullptr) {
+    // msync wants a page aligned start
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t start = offset / page * page;
+    msync(m_data + start, length + (offset - start), MS_ASYNC);
+  }
+}
+
+#endif
+
+MappedFile::~MappedFile() {
+  this->close();
+}
+
+uint8_t *MappedFile::data() const {
+  return m_data;
+}
+
+size_t MappedFile::size() const {
+  return m_size;
+}
+
+bool MappedFile::isOpen() const {
+  return m_data != nullptr;
+}
@@ -0,0 +1,40 @@
+#ifndef REPLAYBUFFER_MAPPEDFILE_HPP
+#define REPLAYBUFFER_MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+#if defined(GEODE_IS_WINDOWS64)
+#include <Windows.h>
+#endif
+
+// a whole file mapped into memory, either created at a fixed size for writing or opened read only
+class MappedFile {
+#if defined(GEODE_IS_WINDOWS64)
+  HANDLE m_file;
+  HANDLE m_mapping;
+#else
+  int m_fd;
+#endif
+  uint8_t *m_data;
+  size_t m_size;
+
+public:
+  MappedFile();
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  void create(const std::filesystem::path &path, size_t size);
+  void openReadOnly(const std::filesystem::path &path);
+  void close();
+  // starts writing the range back to disk without waiting for it
+  void flush(size_t offset, size_t length);
+
+  uint8_t *data() const;
+  size_t size() const;
+  bool isOpen() const;
+};
+
+#endif
@@ -0,0 +1,278 @@
+#include "PacketIndex.hpp"
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <limits>
+
+PacketIndex::PacketIndex() : m_head(0), m_base(0), m_keyframeHead(0), m_bytes(0) {
+}
+
+PacketIndex::PacketIndex(const std::deque<AVPacket *> &packets) : PacketIndex() {
+  this->rebuild(packets);
+}
+
+size_t PacketIndex::slot(uint64_t sequence) const {
+  return m_head + static_cast<size_t>(sequence - m_base);
+}
+
+void PacketIndex::compact() {
+  if (m_head > 1024 && m_head * 2 > m_pts.size()) {
+    m_pts.erase(m_pts.begin(), m_pts.begin() + m_head);
+    m_dts.erase(m_dts.begin(), m_dts.begin() + m_head);
+    m_sizes.erase(m_sizes.begin(), m_sizes.begin() + m_head);
+    m_keys.erase(m_keys.begin(), m_keys.begin() + m_head);
+    m_head = 0;
+  }
+  if (m_keyframeHead > 64 && m_keyframeHead * 2 > m_keyframes.size()) {
+    m_keyframes.erase(m_keyframes.begin(), m_keyframes.begin() + m_keyframeHead);
+    m_keyframeHead = 0;
+  }
+}
+
+void PacketIndex::push(const AVPacket *pkt) {
+  uint64_t sequence = m_base + this->size();
+  m_pts.push_back(pkt->pts);
+  m_dts.push_back(pkt->dts);
+  m_sizes.push_back(static_cast<uint32_t>(pkt->size));
+  m_keys.push_back((pkt->flags & AV_PKT_FLAG_KEY) != 0);
+  m_bytes += pkt->size;
+  if (pkt->flags & AV_PKT_FLAG_KEY) {
+    m_keyframes.push_back(sequence);
+  }
+  this->pushWindows(sequence);
+}
+
+void PacketIndex::pushWindows(uint64_t sequence) {
+  int64_t pts = m_pts[this->slot(sequence)];
+  int64_t dts = m_dts[this->slot(sequence)];
+  // every entry in these is better than everything in front of it, so the front is the answer
+  if (pts != AV_NOPTS_VALUE) {
+    while (!m_minPts.empty() && m_pts[this->slot(m_minPts.back())] >= pts) {
+      m_minPts.pop_back();
+    }
+    m_minPts.push_back(sequence);
+    while (!m_maxPts.empty() && m_pts[this->slot(m_maxPts.back())] <= pts) {
+      m_maxPts.pop_back();
+    }
+    m_maxPts.push_back(sequence);
+  }
+  if (dts != AV_NOPTS_VALUE) {
+    while (!m_minDts.empty() && m_dts[this->slot(m_minDts.back())] >= dts) {
+      m_minDts.pop_back();
+    }
+    m_minDts.push_back(sequence);
+  }
+}
+
+void PacketIndex::rebuildWindows() {
+  m_minPts.clear();
+  m_maxPts.clear();
+  m_minDts.clear();
+  for (uint64_t sequence = m_base; sequence < m_base + this->size(); sequence++) {
+    this->pushWindows(sequence);
+  }
+}
+
+template<typename Better>
+void PacketIndex::patchWindow(std::deque<uint64_t> &window, const std::vector<int64_t> &values, uint64_t first,
+                              uint64_t last, Better better) {
+  // an entry is in the window while everything after it is worse, so the range's entries come from walking it
+  // backwards from the best value after it
+  auto from = std::lower_bound(window.begin(), window.end(), first);
+  auto to = std::lower_bound(from, window.end(), last);
+  std::optional<int64_t> best;
+  if (to != window.end()) {
+    best = values[this->slot(*to)];
+  }
+  std::vector<uint64_t> entries;
+  for (uint64_t sequence = last; sequence-- > first;) {
+    int64_t value = values[this->slot(sequence)];
+    if (value != AV_NOPTS_VALUE && (!best || better(value, *best))) {
+      entries.push_back(sequence);
+      best = value;
+    }
+  }
+  from = window.erase(from, to);
+  from = window.insert(from, entries.rbegin(), entries.rend());
+  if (entries.empty()) {
+    return;
+  }
+  // entries in front of the range that its best value is as good as drop out, like push does at the back
+  int64_t rangeBest = values[this->slot(entries.back())];
+  auto keep = from;
+  while (keep != window.begin() && !better(values[this->slot(*(keep - 1))], rangeBest)) {
+    --keep;
+  }
+  window.erase(keep, from);
+}
+
+void PacketIndex::popFront() {
+  if (this->empty()) {
+    return;
+  }
+  m_bytes -= m_sizes[m_head];
+  for (auto *window : { &m_minPts, &m_maxPts, &m_minDts }) {
+    if (!window->empty() && window->front() == m_base) {
+      window->pop_front();
+    }
+  }
+  if (m_keyframeHead < m_keyframes.size() && m_keyframes[m_keyframeHead] == m_base) {
+    m_keyframeHead++;
+  }
+  m_head++;
+  m_base++;
+  this->compact();
+}
+
+void PacketIndex::clear() {
+  m_pts.clear();
+  m_dts.clear();
+  m_sizes.clear();
+  m_keys.clear();
+  m_keyframes.clear();
+  m_minPts.clear();
+  m_maxPts.clear();
+  m_minDts.clear();
+  m_head = 0;
+  m_keyframeHead = 0;
+  m_base = 0;
+  m_bytes = 0;
+}
+
+void PacketIndex::rebuild(const std::deque<AVPacket *> &packets) {
+  this->clear();
+  m_pts.reserve(packets.size());
+  m_dts.reserve(packets.size());
+  m_sizes.reserve(packets.size());
+  m_keys.reserve(packets.size());
+  for (const AVPacket *pkt : packets) {
+    this->push(pkt);
+  }
+}
+
+void PacketIndex::replace(size_t position, const std::vector<AVPacket *> &packets) {
+  uint64_t first = m_base + position;
+  uint64_t last = first + packets.size();
+  auto extremes = [this, first, last] {
+    std::array<int64_t, 3> minPtsMaxPtsMinDts = { std::numeric_limits<int64_t>::max(),
+                                                  std::numeric_limits<int64_t>::min(),
+                                                  std::numeric_limits<int64_t>::max() };
+    for (uint64_t sequence = first; sequence < last; sequence++) {
+      int64_t pts = m_pts[this->slot(sequence)], dts = m_dts[this->slot(sequence)];
+      if (pts != AV_NOPTS_VALUE) {
+        minPtsMaxPtsMinDts[0] = std::min(minPtsMaxPtsMinDts[0], pts);
+        minPtsMaxPtsMinDts[1] = std::max(minPtsMaxPtsMinDts[1], pts);
+      }
+      if (dts != AV_NOPTS_VALUE) {
+        minPtsMaxPtsMinDts[2] = std::min(minPtsMaxPtsMinDts[2], dts);
+      }
+    }
+    return minPtsMaxPtsMinDts;
+  };
+  auto before = extremes();
+
+  std::vector<uint64_t> keyframes;
+  for (size_t i = 0; i < packets.size(); i++) {
+    size_t slot = this->slot(first + i);
+    m_bytes = m_bytes - m_sizes[slot] + packets[i]->size;
+    m_pts[slot] = packets[i]->pts;
+    m_dts[slot] = packets[i]->dts;
+    m_sizes[slot] = static_cast<uint32_t>(packets[i]->size);
+    m_keys[slot] = (packets[i]->flags & AV_PKT_FLAG_KEY) != 0;
+    if (m_keys[slot]) {
+      keyframes.push_back(first + i);
+    }
+  }
+  auto keyBegin = std::lower_bound(m_keyframes.begin() + static_cast<ptrdiff_t>(m_keyframeHead), m_keyframes.end(), first);
+  auto keyEnd = std::lower_bound(keyBegin, m_keyframes.end(), last);
+  keyBegin = m_keyframes.erase(keyBegin, keyEnd);
+  m_keyframes.insert(keyBegin, keyframes.begin(), keyframes.end());
+
+  // a range that got worse at its best could uncover entries in front of it that it used to hide, that takes a
+  // walk over everything. a re-encoded gop has the same pts and its dts only move down, so it never does
+  auto after = extremes();
+  if (after[0] > before[0] || after[1] < before[1] || after[2] > before[2]) {
+    this->rebuildWindows();
+    return;
+  }
+  this->patchWindow(m_minPts, m_pts, first, last, std::less<int64_t>());
+  this->patchWindow(m_maxPts, m_pts, first, last, std::greater<int64_t>());
+  this->patchWindow(m_minDts, m_dts, first, last, std::less<int64_t>());
+}
+
+size_t PacketIndex::size() const {
+  return m_pts.size() - m_head;
+}
+
+bool PacketIndex::empty() const {
+  return this->size() == 0;
+}
+
+int64_t PacketIndex::pts(size_t position) const {
+  return m_pts[m_head + position];
+}
+
+int64_t PacketIndex::dts(size_t position) const {
+  return m_dts[m_head + position];
+}
+
+uint32_t PacketIndex::packetSize(size_t position) const {
+  return m_sizes[m_head + position];
+}
+
+bool PacketIndex::isKey(size_t position) const {
+  return m_keys[m_head + position] != 0;
+}
+
+int64_t PacketIndex::minPts() const {
+  return m_minPts.empty() ? AV_NOPTS_VALUE : m_pts[this->slot(m_minPts.front())];
+}
+
+int64_t PacketIndex::maxPts() const {
+  return m_maxPts.empty() ? AV_NOPTS_VALUE : m_pts[this->slot(m_maxPts.front())];
+}
+
+int64_t PacketIndex::minDts() const {
+  return m_minDts.empty() ? AV_NOPTS_VALUE : m_dts[this->slot(m_minDts.front())];
+}
+
+size_t PacketIndex::bytes() const {
+  return m_bytes;
+}
+
+size_t PacketIndex::keyframeCount() const {
+  return m_keyframes.size() - m_keyframeHead;
+}
+
+size_t PacketIndex::keyframe(size_t n) const {
+  return static_cast<size_t>(m_keyframes[m_keyframeHead + n] - m_base);
+}
+
+std::optional<size_t> PacketIndex::keyframeAtOrBefore(int64_t pts) const {
+  auto begin = m_keyframes.begin() + static_cast<ptrdiff_t>(m_keyframeHead);
+  auto it = std::partition_point(begin, m_keyframes.end(), [this, pts](uint64_t sequence) {
+    return m_pts[this->slot(sequence)] <= pts;
+  });
+  if (it == begin) {
+    return std::nullopt;
+  }
+  return static_cast<size_t>(*(it - 1) - m_base);
+}
+
+std::optional<size_t> PacketIndex::keyframeAtOrAfter(int64_t pts) const {
+  auto begin = m_keyframes.begin() + static_cast<ptrdiff_t>(m_keyframeHead);
+  auto it = std::partition_point(begin, m_keyframes.end(), [this, pts](uint64_t sequence) {
+    return m_pts[this->slot(sequence)] < pts;
+  });
+  if (it == m_keyframes.end()) {
+    return std::nullopt;
+  }
+  return static_cast<size_t>(*it - m_base);
+}
+
+size_t PacketIndex::nextKeyframe(size_t position) const {
+  auto begin = m_keyframes.begin() + static_cast<ptrdiff_t>(m_keyframeHead);
+  auto it = std::upper_bound(begin, m_keyframes.end(), m_base + position);
+  return it == m_keyframes.end() ? this->size() : static_cast<size_t>(*it - m_base);
+}
@@ -0,0 +1,73 @@
+#ifndef REPLAYBUFFER_PACKETINDEX_HPP
+#define REPLAYBUFFER_PACKETINDEX_HPP
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+// the metadata of a packet buffer in flat arrays next to it, so the questions asked of the buffer all the time
+// don't have to chase a pointer per packet. entries are appended and dropped from the front in step with the
+// buffer and position i is the buffer's packet i, which is how an entry gets back to its payload. min and max
+// are sliding window minimums over the same entries, keyframes are kept in their own list in pts order
+class PacketIndex {
+  // positions are sequence numbers minus m_base, the arrays are compacted once the dropped front is half of them
+  std::vector<int64_t> m_pts, m_dts;
+  std::vector<uint32_t> m_sizes;
+  std::vector<uint8_t> m_keys;
+  size_t m_head;
+  uint64_t m_base;
+  std::vector<uint64_t> m_keyframes;
+  size_t m_keyframeHead;
+  std::deque<uint64_t> m_minPts, m_maxPts, m_minDts;
+  size_t m_bytes;
+
+  size_t slot(uint64_t sequence) const;
+  void compact();
+  void pushWindows(uint64_t sequence);
+  void rebuildWindows();
+  // puts the entries of [first, last) back into a window after their values changed, better is strict
+  template<typename Better>
+  void patchWindow(std::deque<uint64_t> &window, const std::vector<int64_t> &values, uint64_t first, uint64_t last,
+                   Better better);
+
+public:
+  PacketIndex();
+  explicit PacketIndex(const std::deque<AVPacket *> &packets);
+
+  void push(const AVPacket *pkt);
+  void popFront();
+  void clear();
+  void rebuild(const std::deque<AVPacket *> &packets);
+  // swaps the entries from position on for packets, one for one, like a gop the compactor re-encoded. only the
+  // range and the window entries around it are touched
+  void replace(size_t position, const std::vector<AVPacket *> &packets);
+
+  size_t size() const;
+  bool empty() const;
+  int64_t pts(size_t position) const;
+  int64_t dts(size_t position) const;
+  uint32_t packetSize(size_t position) const;
+  bool isKey(size_t position) const;
+
+  // AV_NOPTS_VALUE while there's nothing to take them from
+  int64_t minPts() const;
+  int64_t maxPts() const;
+  int64_t minDts() const;
+  size_t bytes() const;
+
+  size_t keyframeCount() const;
+  // position of the n-th buffered keyframe
+  size_t keyframe(size_t n) const;
+  // the last keyframe at or before pts, and the first one at or after it
+  std::optional<size_t> keyframeAtOrBefore(int64_t pts) const;
+  std::optional<size_t> keyframeAtOrAfter(int64_t pts) const;
+  // first keyframe after position, size() if there isn't one yet
+  size_t nextKeyframe(size_t position) const;
+};
+
+#endif
@@ -0,0 +1,350 @@
+#include "PacketJournal.hpp"
+#include "ReplayBuffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+static constexpr char kMagic[8] = { 'R', 'B', 'J', 'R', 'N', 'L', 0, 0 };
+
+PacketJournal::PacketJournal() : m_header(nullptr), m_entries(nullptr), m_data(nullptr), m_entryCount(0),
+                                 m_dataEnd(0) {
+}
+
+PacketJournal::~PacketJournal() {
+  this->close();
+}
+
+void PacketJournal::create(const std::filesystem::path &path, size_t dataCapacity, size_t indexCapacity) {
+  std::lock_guard lock(m_mutex);
+  m_file.create(path, kHeaderSize + indexCapacity * sizeof(Entry) + dataCapacity);
+  m_header = reinterpret_cast<Header *>(m_file.data());
+  m_entries = reinterpret_cast<Entry *>(m_file.data() + kHeaderSize);
+  m_data = m_file.data() + kHeaderSize + indexCapacity * sizeof(Entry);
+
+  std::memcpy(m_header->magic, kMagic, sizeof(kMagic));
+  m_header->version = kVersion;
+  m_header->clean = 0;
+  m_header->indexCapacity = indexCapacity;
+  m_header->dataCapacity = dataCapacity;
+  m_header->committedEntries = 0;
+  m_header->committedData = 0;
+  m_header->streamCount = 0;
+  m_entryCount = 0;
+  m_dataEnd = 0;
+  m_slots.clear();
+  m_checkpointTimer.start();
+}
+
+void PacketJournal::addStream(int idx, const AVCodecContext *ctx) {
+  std::lock_guard lock(m_mutex);
+  if (!m_file.isOpen() || m_header->streamCount >= kMaxStreams || m_slots.contains(idx)) {
+    return;
+  }
+
+  int slot = static_cast<int>(m_header->streamCount);
+  Stream &stream = m_header->streams[slot];
+  stream.index = idx;
+  stream.codecType = ctx->codec_type;
+  stream.codecId = ctx->codec_id;
+  stream.timeBaseNum = ctx->time_base.num;
+  stream.timeBaseDen = ctx->time_base.den;
+  stream.width = ctx->width;
+  stream.height = ctx->height;
+  stream.format = ctx->codec_type == AVMEDIA_TYPE_VIDEO ? ctx->pix_fmt : ctx->sample_fmt;
+  stream.sampleRate = ctx->sample_rate;
+  stream.channels = ctx->ch_layout.nb_channels;
+  stream.frameSize = ctx->frame_size;
+  stream.bitRate = ctx->bit_rate;
+  stream.extradataSize = std::min<uint32_t>(std::max(ctx->extradata_size, 0), kMaxExtradata);
+  if (stream.extradataSize > 0) {
+    std::memcpy(stream.extradata, ctx->extradata, stream.extradataSize);
+  }
+  m_header->streamCount++;
+  m_slots[idx] = slot;
+}
+
+void PacketJournal::append(int idx, const AVPacket *pkt) {
+  std::lock_guard lock(m_mutex);
+  if (!m_file.isOpen() || !m_slots.contains(idx) || static_cast<uint64_t>(pkt->size) > m_header->dataCapacity) {
+    return;
+  }
+
+  uint64_t capacity = m_header->dataCapacity;
+  size_t start = m_dataEnd % capacity;
+  size_t first = std::min<size_t>(pkt->size, capacity - start);
+  std::memcpy(m_data + start, pkt->data, first);
+  std::memcpy(m_data, pkt->data + first, pkt->size - first);
+
+  Entry &entry = m_entries[m_entryCount % m_header->indexCapacity];
+  entry.sequence = 0;
+  entry.dataOffset = m_dataEnd;
+  entry.pts = pkt->pts;
+  entry.dts = pkt->dts;
+  entry.duration = pkt->duration;
+  entry.size = static_cast<uint32_t>(pkt->size);
+  entry.stream = m_slots[idx];
+  entry.flags = pkt->flags;
+  entry.sequence = m_entryCount + 1;
+
+  m_entryCount++;
+  m_dataEnd += pkt->size;
+
+  if (m_checkpointTimer.stop() >= kCheckpointIntervalUs) {
+    this->checkpoint();
+  }
+}
+
+void PacketJournal::checkpoint() {
+  // only what was appended since the last checkpoint is dirty, the rest of the mapping went out back then
+  size_t indexBytes = m_header->indexCapacity * sizeof(Entry);
+  this->flushRing(kHeaderSize, indexBytes, m_header->committedEntries * sizeof(Entry), m_entryCount * sizeof(Entry));
+  this->flushRing(kHeaderSize + indexBytes, m_header->dataCapacity, m_header->committedData, m_dataEnd);
+  m_header->committedEntries = m_entryCount;
+  m_header->committedData = m_dataEnd;
+  m_file.flush(0, sizeof(Header));
+  m_checkpointTimer.start();
+}
+
+void PacketJournal::flushRing(size_t base, size_t capacity, uint64_t from, uint64_t to) {
+  if (to - from >= capacity) {
+    m_file.flush(base, capacity);
+    return;
+  }
+  size_t start = from % capacity;
+  size_t length = to - from;
+  size_t first = std::min<size_t>(length, capacity - start);
+  if (first > 0) {
+    m_file.flush(base + start, first);
+  }
+  if (length > first) {
+    m_file.flush(base, length - first);
+  }
+}
+
+void PacketJournal::close() {
+  std::lock_guard lock(m_mutex);
+  if (!m_file.isOpen()) {
+    return;
+  }
+  m_header->clean = 1;
+  this->checkpoint();
+  m_file.close();
+  m_header = nullptr;
+  m_entries = nullptr;
+  m_data = nullptr;
+  m_slots.clear();
+}
+
+bool PacketJournal::isOpen() const {
+  return m_file.isOpen();
+}
+
+const PacketJournal::Header *PacketJournal::validate(const MappedFile &file) {
+  if (file.size() < kHeaderSize) {
+    return nullptr;
+  }
+  auto *header = reinterpret_cast<const Header *>(file.data());
+  if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 || header->version != kVersion ||
+      header->streamCount > kMaxStreams || header->indexCapacity == 0 || header->dataCapacity == 0 ||
+      file.size() != kHeaderSize + header->indexCapacity * sizeof(Entry) + header->dataCapacity) {
+    return nullptr;
+  }
+  return header;
+}
+
+std::vector<PacketJournal::Entry> PacketJournal::readEntries(const MappedFile &file) {
+  std::vector<Entry> entries;
+  const Header *header = validate(file);
+  if (header == nullptr) {
+    return entries;
+  }
+  auto *index = reinterpret_cast<const Entry *>(file.data() + kHeaderSize);
+  uint64_t capacity = header->indexCapacity;
+
+  // everything up to the checkpoint made it to disk, and unless the whole system went down the entries written
+  // after it are still there too. each slot carries its own sequence number, so walking forward is safe
+  uint64_t count = header->committedEntries;
+  for (uint64_t i = 0; i < capacity && index[count % capacity].sequence == count + 1; i++) {
+    count++;
+  }
+  if (count == 0) {
+    return entries;
+  }
+
+  const Entry &last = index[(count - 1) % capacity];
+  uint64_t dataEnd = last.dataOffset + last.size;
+  for (uint64_t i = count > capacity ? count - capacity : 0; i < count; i++) {
+    const Entry &entry = index[i % capacity];
+    // the data ring wraps faster than the index when packets are large
+    if (entry.sequence != i + 1 || entry.dataOffset + header->dataCapacity < dataEnd ||
+        entry.stream < 0 || entry.stream >= static_cast<int32_t>(header->streamCount)) {
+      continue;
+    }
+    entries.push_back(entry);
+  }
+  return entries;
+}
+
+void PacketJournal::readData(const MappedFile &file, const Entry &entry, uint8_t *out) {
+  const Header *header = validate(file);
+  const uint8_t *data = file.data() + kHeaderSize + header->indexCapacity * sizeof(Entry);
+  size_t start = entry.dataOffset % header->dataCapacity;
+  size_t first = std::min<size_t>(entry.size, header->dataCapacity - start);
+  std::memcpy(out, data + start, first);
+  std::memcpy(out + first, data, entry.size - first);
+}
+
+std::optional<PacketJournal::RecoveryInfo> PacketJournal::probe(const std::filesystem::path &path) {
+  std::error_code error;
+  if (!std::filesystem::exists(path, error)) {
+    return std::nullopt;
+  }
+
+  MappedFile file;
+  try {
+    file.openReadOnly(path);
+  } catch (const std::string &) {
+    return std::nullopt;
+  }
+  const Header *header = validate(file);
+  if (header == nullptr || header->clean) {
+    return std::nullopt;
+  }
+
+  auto entries = readEntries(file);
+  if (entries.empty()) {
+    return std::nullopt;
+  }
+  int64_t firstUs = std::numeric_limits<int64_t>::max(), lastUs = std::numeric_limits<int64_t>::min();
+  for (const Entry &entry : entries) {
+    const Stream &stream = header->streams[entry.stream];
+    int64_t us = av_rescale_q(entry.pts, { stream.timeBaseNum, stream.timeBaseDen }, { 1, 1000000 });
+    firstUs = std::min(firstUs, us);
+    lastUs = std::max(lastUs, us);
+  }
+  return RecoveryInfo { lastUs - firstUs, entries.size() };
+}
+
+void PacketJournal::recover(const std::filesystem::path &path, const std::filesystem::path &output, int seconds) {
+  MappedFile file;
+  file.openReadOnly(path);
+  const Header *header = validate(file);
+  if (header == nullptr) {
+    throw fmt::format("{} isn't a journal this version can read", path.string());
+  }
+  auto entries = readEntries(file);
+  if (entries.empty()) {
+    throw fmt::format("nothing left to recover");
+  }
+
+  // same window as a normal clip: the last `seconds` of the shared capture clock
+  int64_t lastUs = 0;
+  std::vector<bool> hasPackets(header->streamCount, false);
+  for (const Entry &entry : entries) {
+    const Stream &stream = header->streams[entry.stream];
+    lastUs = std::max(lastUs, av_rescale_q(entry.pts, { stream.timeBaseNum, stream.timeBaseDen }, { 1, 1000000 }));
+    hasPackets[entry.stream] = true;
+  }
+  int64_t startUs = lastUs - static_cast<int64_t>(seconds) * 1000000;
+
+  const std::string outputPath = output.string();
+  AVFormatContext *formatCtx;
+  int ret = avformat_alloc_output_context2(&formatCtx, nullptr, nullptr, outputPath.c_str());
+  if (formatCtx == nullptr) {
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not allocate output context, error: {}", errStr);
+  }
+
+  std::vector<AVStream *> streams(header->streamCount, nullptr);
+  for (uint32_t i = 0; i < header->streamCount; i++) {
+    if (!hasPackets[i]) {
+      continue;
+    }
+    const Stream &stream = header->streams[i];
+    AVStream *outStream = avformat_new_stream(formatCtx, nullptr);
+    if (outStream == nullptr) {
+      avformat_free_context(formatCtx);
+      throw fmt::format("couldn't allocate output stream");
+    }
+    AVCodecParameters *params = outStream->codecpar;
+    params->codec_type = static_cast<AVMediaType>(stream.codecType);
+    params->codec_id = static_cast<AVCodecID>(stream.codecId);
+    params->width = stream.width;
+    params->height = stream.height;
+    params->format = stream.format;
+    params->sample_rate = stream.sampleRate;
+    params->frame_size = stream.frameSize;
+    params->bit_rate = stream.bitRate;
+    if (stream.channels > 0) {
+      av_channel_layout_default(&params->ch_layout, stream.channels);
+    }
+    if (stream.extradataSize > 0) {
+      params->extradata = static_cast<uint8_t *>(av_mallocz(stream.extradataSize + AV_INPUT_BUFFER_PADDING_SIZE));
+      std::memcpy(params->extradata, stream.extradata, stream.extradataSize);
+      params->extradata_size = static_cast<int>(stream.extradataSize);
+    }
+    outStream->time_base = { stream.timeBaseNum, stream.timeBaseDen };
+    streams[i] = outStream;
+  }
+
+  if ((ret = avio_open(&formatCtx->pb, outputPath.c_str(), AVIO_FLAG_WRITE)) < 0) {
+    avformat_free_context(formatCtx);
+
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not open file for writing, error: {}", errStr);
+  }
+
+  if ((ret = avformat_write_header(formatCtx, nullptr)) < 0) {
+    avio_closep(&formatCtx->pb);
+    avformat_free_context(formatCtx);
+
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not write header, error: {}", errStr);
+  }
+
+  std::vector<bool> seenKeyframe(header->streamCount, false);
+  AVPacket *pkt = av_packet_alloc();
+  for (const Entry &entry : entries) {
+    if (ret < 0) {
+      break;
+    }
+    const Stream &stream = header->streams[entry.stream];
+    AVRational timeBase = { stream.timeBaseNum, stream.timeBaseDen };
+    int64_t offset = std::max<int64_t>(av_rescale_q(startUs, { 1, 1000000 }, timeBase), 0);
+    if (entry.flags & AV_PKT_FLAG_KEY) {
+      seenKeyframe[entry.stream] = entry.pts >= offset || seenKeyframe[entry.stream];
+    }
+    if ((!seenKeyframe[entry.stream] && stream.codecType == AVMEDIA_TYPE_VIDEO) || entry.pts < offset) {
+      continue;
+    }
+
+    if (av_new_packet(pkt, static_cast<int>(entry.size)) < 0) {
+      break;
+    }
+    readData(file, entry, pkt->data);
+    pkt->pts = entry.pts;
+    pkt->dts = entry.dts;
+    pkt->duration = entry.duration;
+    pkt->flags = entry.flags;
+    ret = ReplayBuffer::writePacket(formatCtx, streams[entry.stream], pkt, timeBase, offset);
+    av_packet_unref(pkt);
+  }
+  av_packet_free(&pkt);
+
+  av_write_trailer(formatCtx);
+  avio_closep(&formatCtx->pb);
+  avformat_free_context(formatCtx);
+  if (ret < 0) {
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not write to file, error: {}", errStr);
+  }
+}
@@ -0,0 +1,104 @@
+#ifndef REPLAYBUFFER_PACKETJOURNAL_HPP
+#define REPLAYBUFFER_PACKETJOURNAL_HPP
+
+#include "MappedFile.hpp"
+#include "Timer.hpp"
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+// a copy of every encoded packet in a memory mapped file, so a crash doesn't take the buffer with it. the file
+// is a header with the stream parameters, a ring of fixed size index entries and a ring of packet data. the
+// header's checkpoint is moved forward and the mapping flushed about once a second, and recovery only has to
+// walk the index to find out what survived
+class PacketJournal {
+public:
+  static constexpr uint32_t kVersion = 2;
+  static constexpr int kMaxStreams = 8;
+  static constexpr int kMaxExtradata = 512;
+  static constexpr size_t kHeaderSize = 8192; // every stream slot fits, extradata and all
+  static constexpr int64_t kCheckpointIntervalUs = 1000000;
+
+  struct Stream {
+    int32_t index; // stream index in the replay buffer
+    int32_t codecType;
+    int32_t codecId;
+    int32_t timeBaseNum, timeBaseDen;
+    int32_t width, height;
+    int32_t format;
+    int32_t sampleRate;
+    int32_t channels;
+    int32_t frameSize;
+    int64_t bitRate;
+    uint32_t extradataSize;
+    uint8_t extradata[kMaxExtradata];
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t clean; // set when recording stopped normally, nothing to recover then
+    uint64_t indexCapacity;
+    uint64_t dataCapacity;
+    uint64_t committedEntries; // checkpoint: entries and bytes known to be written out
+    uint64_t committedData;
+    uint32_t streamCount;
+    Stream streams[kMaxStreams];
+  };
+  static_assert(sizeof(Header) <= kHeaderSize);
+
+  struct Entry {
+    uint64_t sequence; // entry number + 1, anything else means the slot wasn't finished
+    uint64_t dataOffset; // position in the data ring before wrapping
+    int64_t pts, dts, duration;
+    uint32_t size;
+    int32_t stream; // slot in Header::streams
+    int32_t flags;
+  };
+
+  struct RecoveryInfo {
+    int64_t durationUs;
+    size_t packets;
+  };
+
+  PacketJournal();
+  ~PacketJournal();
+
+  void create(const std::filesystem::path &path, size_t dataCapacity, size_t indexCapacity);
+  void addStream(int idx, const AVCodecContext *ctx);
+  void append(int idx, const AVPacket *pkt);
+  // flushes and marks the journal as cleanly closed
+  void close();
+  bool isOpen() const;
+
+  // what an unclean journal still holds, nothing if it was closed cleanly or is unreadable
+  static std::optional<RecoveryInfo> probe(const std::filesystem::path &path);
+  // writes the last `seconds` of the journal into a clip
+  static void recover(const std::filesystem::path &path, const std::filesystem::path &output, int seconds);
+
+private:
+  MappedFile m_file;
+  std::mutex m_mutex;
+  Header *m_header;
+  Entry *m_entries;
+  uint8_t *m_data;
+  uint64_t m_entryCount;
+  uint64_t m_dataEnd;
+  std::map<int, int> m_slots;
+  Timer m_checkpointTimer;
+
+  void checkpoint();
+  // flushes what was written to a ring at base in the file between two running byte counts
+  void flushRing(size_t base, size_t capacity, uint64_t from, uint64_t to);
+  static const Header *validate(const MappedFile &file);
+  static std::vector<Entry> readEntries(const MappedFile &file);
+  static void readData(const MappedFile &file, const Entry &entry, uint8_t *out);
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "PcmRing.hpp"
+
+#include <algorithm>
+
+PcmRing::PcmRing() : m_channels(0), m_capacity(0), m_writeIndex(0) {
+}
+
+void PcmRing::reset(int channels, int64_t capacityFrames) {
+  std::lock_guard lock(m_mutex);
+  m_channels = channels;
+  m_capacity = capacityFrames;
+  m_data.assign(static_cast<size_t>(capacityFrames * channels), 0);
+  m_writeIndex = 0;
+  m_anchors.clear();
+}
+
+void PcmRing::write(const int16_t *samples, int64_t frames, int64_t pts) {
+  std::lock_guard lock(m_mutex);
+  if (m_capacity == 0) {
+    return;
+  }
+
+  m_anchors.emplace_back(m_writeIndex, pts);
+
+  int64_t remaining = frames;
+  while (remaining > 0) {
+    int64_t pos = m_writeIndex % m_capacity;
+    int64_t count = std::min(remaining, m_capacity - pos);
+    std::copy_n(samples, count * m_channels, m_data.begin() + pos * m_channels);
+    samples += count * m_channels;
+    remaining -= count;
+    m_writeIndex += count;
+  }
+
+  // keep one anchor at or before the oldest frame still in the ring
+  int64_t first = std::max<int64_t>(0, m_writeIndex - m_capacity);
+  while (m_anchors.size() > 1 && m_anchors[1].first <= first) {
+    m_anchors.pop_front();
+  }
+}
+
+void PcmRing::read(int64_t start, int64_t frames, int16_t *out) const {
+  std::lock_guard lock(m_mutex);
+  int64_t first = std::max<int64_t>(0, m_writeIndex - m_capacity);
+  for (int64_t i = 0; i < frames;) {
+    int64_t frame = start + i;
+    if (frame < first || frame >= m_writeIndex) {
+      std::fill_n(out + i * m_channels, m_channels, int16_t(0));
+      i++;
+      continue;
+    }
+    int64_t pos = frame % m_capacity;
+    int64_t count = std::min({ frames - i, m_capacity - pos, m_writeIndex - frame });
+    std::copy_n(m_data.begin() + pos * m_channels, count * m_channels, out + i * m_channels);
+    i += count;
+  }
+}
+
+std::pair<int64_t, int64_t> PcmRing::getRange() const {
+  std::lock_guard lock(m_mutex);
+  return { std::max<int64_t>(0, m_writeIndex - m_capacity), m_writeIndex };
+}
+
+int64_t PcmRing::getPts(int64_t frame) const {
+  std::lock_guard lock(m_mutex);
+  if (m_anchors.empty()) {
+    return frame;
+  }
+  auto anchor = std::ranges::upper_bound(m_anchors, frame, {}, &std::pair<int64_t, int64_t>::first);
+  if (anchor != m_anchors.begin()) {
+    --anchor;
+  }
+  return anchor->second + (frame - anchor->first);
+}
+
+int PcmRing::getChannels() const {
+  return m_channels;
+}
+
+bool PcmRing::isEmpty() const {
+  std::lock_guard lock(m_mutex);
+  return m_writeIndex == 0;
+}
@@ -0,0 +1,33 @@
+#ifndef REPLAYBUFFER_PCMRING_HPP
+#define REPLAYBUFFER_PCMRING_HPP
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// preallocated circular store of interleaved s16 audio. frames are addressed by their absolute index since
+// the last reset, and every write leaves an anchor mapping its first frame to a capture clock pts
+class PcmRing {
+  std::vector<int16_t> m_data;
+  int m_channels;
+  int64_t m_capacity;
+  int64_t m_writeIndex;
+  std::deque<std::pair<int64_t, int64_t>> m_anchors;
+  mutable std::mutex m_mutex;
+
+public:
+  PcmRing();
+
+  void reset(int channels, int64_t capacityFrames);
+  void write(const int16_t *samples, int64_t frames, int64_t pts);
+  // copies frames [start, start + frames) out, anything already overwritten comes back as silence
+  void read(int64_t start, int64_t frames, int16_t *out) const;
+  std::pair<int64_t, int64_t> getRange() const;
+  int64_t getPts(int64_t frame) const;
+  int getChannels() const;
+  bool isEmpty() const;
+};
+
+#endif
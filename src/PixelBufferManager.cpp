@@ -1,32 +1,63 @@
 #include "PixelBufferManager.hpp"
+#include "Timeline.hpp"
 #include <Geode/cocos/CCDirector.h>
+#include <algorithm>
+#include <utility>
 
 PixelBufferManager::PixelBufferManager() {
   for (unsigned int &pbo : m_pbos) {
     pbo = 0;
   }
   m_pboIdx = 0;
+  m_frameWidth = m_frameHeight = 0;
+  m_originX = m_originY = 0;
   m_firstFrame = true;
   m_bufferSize = -1;
-
-  glGenBuffers(2, m_pbos);
+  m_lastFrameTime = -1;
+  m_readbackTime = -1;
+  m_readbackPending = false;
+  m_resized = false;
 }
 
 PixelBufferManager::~PixelBufferManager() {
-  glDeleteBuffers(2, m_pbos);
+  if (m_pbos[0] != 0) {
+    glDeleteBuffers(2, m_pbos);
+  }
 }
 
-void PixelBufferManager::captureFrame() {
+void PixelBufferManager::captureFrame(int64_t timestamp) {
+  Timeline::Scope scope("captureFrame");
+  if (m_pbos[0] == 0) {
+    glGenBuffers(2, m_pbos);
+    m_resized = true;
+  }
+  if (m_resized) {
+    for (const GLuint pbo : m_pbos) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+      glBufferData(GL_PIXEL_PACK_BUFFER, m_bufferSize, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    // whatever was in flight was read at the old size
+    m_firstFrame = true;
+    m_resized = false;
+  }
+
   glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbos[m_pboIdx]);
-  glReadPixels(0, 0, m_frameWidth, m_frameHeight, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  glReadPixels(m_originX, m_originY, m_frameWidth, m_frameHeight, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
   glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  m_pboTimes[m_pboIdx] = timestamp;
   m_pboIdx = m_pboIdx ^ 1;
 
   if (!m_firstFrame) {
+    Timeline::Scope mapScope("map and copy");
     glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbos[m_pboIdx]);
     auto *data = static_cast<uint8_t *>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
     if (data != nullptr) {
-      std::copy_n(data, m_bufferSize, m_lastFrameData.begin());
+      // the published frame went back and forth with this one, it may still be the old size
+      m_readbackData.resize(m_bufferSize);
+      std::copy_n(data, m_bufferSize, m_readbackData.begin());
+      m_readbackTime = m_pboTimes[m_pboIdx];
+      m_readbackPending = true;
     }
     glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
     glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
@@ -35,17 +66,40 @@ void PixelBufferManager::captureFrame() {
   }
 }
 
+bool PixelBufferManager::publishFrame() {
+  if (!m_readbackPending) {
+    return false;
+  }
+  std::swap(m_lastFrameData, m_readbackData);
+  m_lastFrameTime = m_readbackTime;
+  m_readbackPending = false;
+  return true;
+}
+
 void PixelBufferManager::changeSize(int width, int height) {
   m_frameWidth = width;
   m_frameHeight = height;
   m_bufferSize = static_cast<size_t>(width * height * 4);
   m_lastFrameData.resize(m_bufferSize);
-  for (const GLuint pbo : m_pbos) {
-    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
-    glBufferData(GL_PIXEL_PACK_BUFFER, m_bufferSize, nullptr, GL_STREAM_READ);
-  }
+  m_lastFrameTime = -1;
+  m_readbackPending = false;
+  m_resized = true;
+}
+
+void PixelBufferManager::setOrigin(int x, int y) {
+  m_originX = x;
+  m_originY = y;
+}
+
+void PixelBufferManager::setFrame(const uint8_t *data, int64_t timestamp) {
+  std::copy_n(data, m_bufferSize, m_lastFrameData.begin());
+  m_lastFrameTime = timestamp;
 }
 
 uint8_t *PixelBufferManager::getCurrentFrame() {
   return m_lastFrameData.data();
 }
+
+int64_t PixelBufferManager::getCurrentFrameTime() const {
+  return m_lastFrameTime;
+}
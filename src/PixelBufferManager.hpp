@@ -2,22 +2,43 @@
 #define REPLAYBUFFER_PIXELBUFFERMANAGER_HPP
 
 #include <Geode/cocos/platform/CCGL.h>
+#include <atomic>
 #include <vector>
 
 class PixelBufferManager {
   GLuint m_pbos[2]{}, m_pboIdx;
   int m_frameWidth, m_frameHeight;
+  int m_originX, m_originY;
   size_t m_bufferSize;
   std::vector<uint8_t> m_lastFrameData;
+  std::vector<uint8_t> m_readbackData; // main thread only, becomes the current frame in publishFrame
+  int64_t m_readbackTime;
+  bool m_readbackPending;
   bool m_firstFrame;
+  int64_t m_pboTimes[2]{};
+  std::atomic<int64_t> m_lastFrameTime;
+  bool m_resized;
 
 public:
   PixelBufferManager();
   ~PixelBufferManager();
 
-  void captureFrame();
+  // gl calls only happen in here, so the buffers are created and resized lazily on the main thread. the pbo is
+  // copied into a buffer of its own, the current frame doesn't change until publishFrame
+  void captureFrame(int64_t timestamp);
+  // makes the newest readback the current frame, false if there's none. it's a swap, so whoever reads the current
+  // frame on other threads can do this under their lock without holding it for the copy
+  bool publishFrame();
+  // the size of the region that's read back, which doesn't have to be the whole framebuffer. the pbos are
+  // reallocated on the next capture, but this must not run while one is going on
   void changeSize(int width, int height);
+  // bottom left corner of the region in framebuffer pixels, moving it doesn't need new buffers
+  void setOrigin(int x, int y);
+  // stands in for a readback with a frame from somewhere else, it has to be the size set with changeSize
+  void setFrame(const uint8_t *data, int64_t timestamp);
   uint8_t *getCurrentFrame();
+  // capture clock time of the frame returned by getCurrentFrame, -1 until one has been read back
+  int64_t getCurrentFrameTime() const;
 };
 
 #endif
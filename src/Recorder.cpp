@@ -1,16 +1,48 @@
 #include "Recorder.hpp"
 #include "AudioEncoder.hpp"
+#include "AudioMixEncoder.hpp"
 #include "VideoEncoder.hpp"
+#include "Timer.hpp"
+#include "ThreadPriority.hpp"
 #include <Geode/Geode.hpp>
+#include <ranges>
 using namespace geode::prelude;
 
-Recorder::Recorder() {
+Recorder::Recorder() : m_state(State::Idle), m_lastTransitionUs(0), m_lastStartWarm(false), m_tracing(false),
+                       m_traceCompressed(false), m_premuxing(false), m_offline(false), m_offlineFramerate(0),
+                       m_offlineFrame(0), m_offlineVideoUs(0), m_offlineWaitUs(0) {
   m_firstInit = true;
   m_replayBuffer = std::make_shared<ReplayBuffer>();
+  m_videoSource = std::make_shared<VideoSource>();
+  m_videoSource->setClock(m_replayBuffer->getClock());
+  m_audioMixer = std::make_shared<AudioMixer>();
+  m_audioPump = std::make_shared<AudioCapturePump>();
+  m_compactor = std::make_shared<GopCompactor>();
+  m_thumbnails = std::make_shared<ThumbnailCache>();
+  m_player = std::make_shared<ReplayPlayer>();
+  m_journal = std::make_shared<PacketJournal>();
+  m_autoClipper = std::make_shared<AutoClipper>();
+  m_trace = std::make_shared<CaptureTrace>();
+  m_fragmentRing = std::make_shared<FragmentRing>();
+  m_replayBuffer->setFragmentRing(m_fragmentRing);
+  m_autoClipper->setClock(m_replayBuffer->getClock());
+  m_autoClipper->setExport([this](int64_t startUs, int64_t endUs, const std::string &name) {
+    // its own thread rather than the pool, exports hand their own work to the pool and wait for it
+    return std::async(std::launch::async, [this, request = this->prepareClip(startUs, endUs, name)] {
+      placeCurrentThread(ThreadRole::Worker);
+      return this->writeClip(request);
+    });
+  });
 }
 
 Recorder::~Recorder() {
-  this->stop();
+  this->joinLifecycleThread();
+  if (m_state == State::Recording) {
+    for (const auto &running : m_autoClipper->getRunning()) {
+      running.wait();
+    }
+    this->stopSession();
+  }
 }
 
 std::shared_ptr<Recorder> Recorder::getInstance() {
@@ -18,87 +50,515 @@ std::shared_ptr<Recorder> Recorder::getInstance() {
   return instance;
 }
 
+std::filesystem::path Recorder::getJournalPath() {
+  return Mod::get()->getSaveDir() / "journal.bin";
+}
+
+std::filesystem::path Recorder::getCrashedJournalPath() {
+  return Mod::get()->getSaveDir() / "journal-crashed.bin";
+}
+
+std::filesystem::path Recorder::getTracePath() {
+  return Mod::get()->getSaveDir() / "capture.trace";
+}
+
 Result<> Recorder::start() {
-  if (Mod::get()->getSavedValue<bool>("is-recording"_spr)) {
-    return Err("already recording");
-  }
-  int width = Mod::get()->getSavedValue<int>("settings-width"_spr);
-  int height = Mod::get()->getSavedValue<int>("settings-height"_spr);
-  int framerate = Mod::get()->getSavedValue<int>("settings-framerate"_spr);
-  bool hwAccel = Mod::get()->getSavedValue<bool>("settings-hw-accel"_spr);
-  int bitrate = Mod::get()->getSavedValue<int>("settings-bitrate"_spr) * 1000;
-  int length = Mod::get()->getSavedValue<int>("settings-length"_spr);
-  int deviceIDs[] = {
-    -1,
-    Mod::get()->getSavedValue<int>("settings-audio-id-1"_spr),
-    Mod::get()->getSavedValue<int>("settings-audio-id-2"_spr)
-  };
+  State expected = State::Idle;
+  if (!m_state.compare_exchange_strong(expected, State::Starting)) {
+    return Err(expected == State::Recording ? "already recording" : "recorder is busy");
+  }
+  SessionSettings settings = readSettings();
+  // doesn't touch the encoders, so it's not part of the session settings and never makes a start cold
+  m_autoClipper->clear();
+  m_autoClipper->setSettings(readAutoClipSettings());
+  m_tracing = Mod::get()->getSavedValue<bool>("settings-trace"_spr);
+  m_traceCompressed = Mod::get()->getSavedValue<bool>("settings-trace-compress"_spr, true);
+  m_premuxing = Mod::get()->getSavedValue<bool>("settings-premux"_spr);
+  this->joinLifecycleThread();
+  m_lifecycleThread = std::thread([this, settings = std::move(settings), exports = m_autoClipper->getRunning()] {
+    // on linux the encoders' own worker threads inherit this thread's affinity when they're opened here
+    placeCurrentThread(ThreadRole::Encode);
+    // exports of the last session still read from the encoders startSession is about to reset
+    for (const auto &running : exports) {
+      running.wait();
+    }
+    Timer timer;
+    timer.start();
+    try {
+      this->startSession(settings);
+    } catch (const std::string &e) {
+      this->stopSession();
+      {
+        std::lock_guard lock(m_errorMutex);
+        m_error = e;
+      }
+      this->finishStart(State::Idle);
+      return;
+    }
+    m_lastTransitionUs = timer.stop();
+    this->finishStart(State::Recording);
+  });
+  return Ok();
+}
 
-  try {
-    if (m_firstInit) {
-      m_replayBuffer->addStream<VideoEncoder>(0);
-      m_replayBuffer->addStream<AudioEncoder>(1);
-      m_replayBuffer->addStream<AudioEncoder>(2);
-    } else {
-      for (const auto &[_idx, encoder] : m_replayBuffer->getEncoders()) {
-        encoder->joinThread();
+void Recorder::stop() {
+  State expected = State::Recording;
+  if (!m_state.compare_exchange_strong(expected, State::Stopping)) {
+    return;
+  }
+  // cuts the post-roll of whatever is still pending short rather than losing it
+  m_autoClipper->flush();
+  this->joinLifecycleThread();
+  m_lifecycleThread = std::thread([this, exports = m_autoClipper->getRunning()] {
+    // the exports snapshot the live encoders, stopSession must not tear those down under them
+    for (const auto &running : exports) {
+      running.wait();
+    }
+    Timer timer;
+    timer.start();
+    this->stopSession();
+    m_lastTransitionUs = timer.stop();
+    m_state = State::Idle;
+  });
+}
+
+Recorder::State Recorder::getState() const {
+  return m_state;
+}
+
+bool Recorder::isRecording() const {
+  return m_state == State::Recording;
+}
+
+std::optional<std::string> Recorder::takeError() {
+  std::lock_guard lock(m_errorMutex);
+  return std::exchange(m_error, std::nullopt);
+}
+
+void Recorder::joinLifecycleThread() {
+  if (m_lifecycleThread.joinable()) {
+    m_lifecycleThread.join();
+  }
+}
+
+void Recorder::setWindowSize(int width, int height) {
+  std::lock_guard lock(m_sizeMutex);
+  if (m_state == State::Starting) {
+    m_pendingSize = { width, height };
+    return;
+  }
+  m_videoSource->setSize(width, height);
+}
+
+void Recorder::finishStart(State state) {
+  std::lock_guard lock(m_sizeMutex);
+  // nothing captures until the state changes, so the readback can still be resized from here
+  if (m_pendingSize) {
+    m_videoSource->setSize(m_pendingSize->first, m_pendingSize->second);
+    m_pendingSize.reset();
+  }
+  m_state = state;
+}
+
+void Recorder::update() {
+  // exports still finish after recording stopped
+  m_autoClipper->update();
+  if (!this->isRecording()) {
+    return;
+  }
+  if (m_offline) {
+    this->stepOffline();
+  } else {
+    m_videoSource->update();
+  }
+  m_replayBuffer->update();
+}
+
+float Recorder::getOfflineStep() const {
+  if (!this->isRecording() || !m_offline) {
+    return 0.0f;
+  }
+  return 1.0f / static_cast<float>(m_offlineFramerate);
+}
+
+Recorder::OfflineStats Recorder::getOfflineStats() const {
+  return { m_offlineFrame, m_offlineVideoUs, m_offlineFrame > 0 ? m_offlineTimer.stop() : 0, m_offlineWaitUs };
+}
+
+void Recorder::stepOffline() {
+  if (m_offlineFrame == 0) {
+    m_offlineTimer.start();
+  }
+  // frame n is stamped n frame durations in, on the same grid the encoders put their pts on
+  int64_t time = av_rescale_q(m_offlineFrame++, { 1, m_offlineFramerate }, { 1, 1000000 });
+  m_videoSource->capture(time);
+
+  // the readback lags a capture behind. the clock is held on the frame that just came out of it, so every encoder
+  // takes that one for exactly one pts and never sees a time it has no frame for yet
+  int64_t frameTime = m_videoSource->getFrameTime();
+  if (frameTime < 0) {
+    return;
+  }
+  m_replayBuffer->getClock()->setManualTime(frameTime);
+  Timer timer;
+  timer.start();
+  // this is the back-pressure: an encoder that can't keep up slows the game down instead of dropping frames. only
+  // conversion is waited on, the frames it queued are encoded while the game renders the next one
+  for (const auto &encoder : m_replayBuffer->getEncoders() | std::views::values) {
+    if (!encoder->isVideo()) {
+      continue;
+    }
+    // an encoder that died or hangs won't take the next frame either, so the render ends here rather than
+    // holding every frame after it for the whole timeout
+    if (!std::static_pointer_cast<VideoEncoder>(encoder)->waitCaughtUp(frameTime, kOfflineTimeout)) {
+      {
+        std::lock_guard lock(m_errorMutex);
+        m_error = fmt::format("a video encoder stopped taking frames {:.1f} s into the offline render, recording stopped",
+                              frameTime / 1000000.0);
+      }
+      this->stop();
+      return;
+    }
+  }
+  m_offlineWaitUs += timer.stop();
+  m_offlineVideoUs = frameTime;
+}
+
+Recorder::SessionSettings Recorder::readSettings() {
+  SessionSettings settings;
+  auto frameSize = CCDirector::sharedDirector()->getOpenGLView()->getFrameSize();
+  settings.srcWidth = static_cast<int>(frameSize.width);
+  settings.srcHeight = static_cast<int>(frameSize.height);
+  settings.width = Mod::get()->getSavedValue<int>("settings-width"_spr);
+  settings.height = Mod::get()->getSavedValue<int>("settings-height"_spr);
+  settings.cropPreset = std::clamp(Mod::get()->getSavedValue<int>("settings-crop"_spr), 0,
+                                   static_cast<int>(VideoSource::kCropPresets.size()) - 1);
+  settings.cropFollow = Mod::get()->getSavedValue<bool>("settings-crop-follow"_spr);
+  if (settings.cropPreset > 0 && settings.srcWidth > 0 && settings.srcHeight > 0) {
+    // the crop is encoded at the scale the whole window would have been, so it costs its share of the area
+    auto [cropWidth, cropHeight] = VideoSource::getCropSize(settings.cropPreset, settings.srcWidth, settings.srcHeight);
+    settings.width = std::max((settings.width * cropWidth / settings.srcWidth) & ~1, 2);
+    settings.height = std::max((settings.height * cropHeight / settings.srcHeight) & ~1, 2);
+  }
+  settings.framerate = Mod::get()->getSavedValue<int>("settings-framerate"_spr);
+  settings.hwAccel = Mod::get()->getSavedValue<bool>("settings-hw-accel"_spr);
+  settings.bitrate = Mod::get()->getSavedValue<int>("settings-bitrate"_spr) * 1000;
+  settings.softwareCodec = Mod::get()->getSavedValue<int>("settings-codec"_spr);
+  settings.rateControl = std::clamp(Mod::get()->getSavedValue<int>("settings-rate-control"_spr, 1), 0,
+                                    static_cast<int>(VideoEncoder::kRateControlNames.size()) - 1);
+  settings.quality = std::clamp(Mod::get()->getSavedValue<int>("settings-quality"_spr), 0, 63);
+  settings.vbvSeconds = std::clamp(Mod::get()->getSavedValue<double>("settings-vbv-seconds"_spr, 1.0), 0.1, 10.0);
+  settings.proxy = Mod::get()->getSavedValue<bool>("settings-proxy"_spr);
+  // the proxy keeps the main stream's aspect ratio, even sized for yuv420p
+  settings.proxyHeight = std::clamp(Mod::get()->getSavedValue<int>("settings-proxy-height"_spr, 480), 16,
+                                    std::max(settings.height, 16)) & ~1;
+  settings.proxyWidth = settings.height > 0 ? (settings.width * settings.proxyHeight / settings.height) & ~1 : 0;
+  settings.proxyBitrate = Mod::get()->getSavedValue<int>("settings-proxy-bitrate"_spr, 2000) * 1000;
+  settings.keyframeInterval = std::max(Mod::get()->getSavedValue<double>("settings-keyframe-interval"_spr, 1.0), 0.1);
+  settings.sceneChange = Mod::get()->getSavedValue<bool>("settings-scene-change"_spr, true);
+  settings.length = Mod::get()->getSavedValue<int>("settings-length"_spr);
+  // an offline render runs at whatever speed the encoders allow, there's no sound playing in step with it to capture
+  settings.offline = Mod::get()->getSavedValue<bool>("settings-offline"_spr);
+  settings.audioTrackAmount = settings.offline ? 0 : std::max(Mod::get()->getSavedValue<int>("settings-audio-amt"_spr), 0);
+  for (int i = 1; i <= settings.audioTrackAmount; i++) {
+    settings.deviceIDs.push_back(Mod::get()->getSavedValue<int>("settings-audio-id-"_spr + std::to_string(i)));
+    settings.deviceGains.push_back(Mod::get()->getSavedValue<int>("settings-audio-gain-"_spr + std::to_string(i), 100) / 100.0f);
+  }
+  settings.mixAudio = !settings.offline && Mod::get()->getSavedValue<bool>("settings-audio-mix"_spr);
+  settings.mixOnly = settings.mixAudio && Mod::get()->getSavedValue<bool>("settings-audio-mix-only"_spr);
+  settings.compactAge = std::max(Mod::get()->getSavedValue<int>("settings-compact-age"_spr), 0);
+  settings.compactBitrate = Mod::get()->getSavedValue<int>("settings-compact-bitrate"_spr, 2500) * 1000;
+  settings.deferAudio = !settings.offline && !settings.mixOnly && Mod::get()->getSavedValue<bool>("settings-audio-deferred"_spr);
+  settings.journal = Mod::get()->getSavedValue<bool>("settings-journal"_spr);
+  return settings;
+}
+
+AutoClipper::Settings Recorder::readAutoClipSettings() {
+  AutoClipper::Settings settings;
+  settings.enabled[static_cast<size_t>(AutoClipper::Trigger::LevelComplete)] =
+    Mod::get()->getSavedValue<bool>("settings-auto-clip-complete"_spr);
+  settings.enabled[static_cast<size_t>(AutoClipper::Trigger::Death)] =
+    Mod::get()->getSavedValue<bool>("settings-auto-clip-death"_spr);
+  settings.preRollUs = std::max(Mod::get()->getSavedValue<double>("settings-auto-clip-preroll"_spr, 10.0), 0.0) * 1000000;
+  settings.postRollUs = std::max(Mod::get()->getSavedValue<double>("settings-auto-clip-postroll"_spr, 3.0), 0.0) * 1000000;
+  return settings;
+}
+
+TraceReplay::Options Recorder::readTraceReplayOptions(TraceReplay::Pace pace) {
+  SessionSettings settings = readSettings();
+  TraceReplay::Options options;
+  options.pace = pace;
+  options.width = settings.width;
+  options.height = settings.height;
+  options.framerate = settings.framerate;
+  options.bitrate = settings.bitrate;
+  options.rateControl = { static_cast<VideoEncoder::RateControl>(settings.rateControl), settings.quality,
+                          settings.vbvSeconds };
+  options.softwareCodec = settings.softwareCodec;
+  options.hwAccel = settings.hwAccel;
+  options.keyframeInterval = settings.keyframeInterval;
+  options.sceneChange = settings.sceneChange;
+  options.length = settings.length;
+  return options;
+}
+
+void Recorder::startSession(const SessionSettings &settings) {
+  // same settings as last time: keep the codec sessions, hardware devices and fmod sounds that are already open
+  bool warm = !m_firstInit && settings == m_warmSettings;
+  m_lastStartWarm = warm;
+
+  m_audioPump->clear();
+  m_fragmentRing->stop();
+  m_compactor->stop();
+  m_thumbnails->stop();
+  if (m_firstInit) {
+    m_replayBuffer->addStream<VideoEncoder>(kVideoStream);
+  } else {
+    for (const auto &[_idx, encoder] : m_replayBuffer->getEncoders()) {
+      encoder->joinThread();
+      if (!warm) {
         encoder->destroy();
       }
-      m_replayBuffer->clear();
     }
+    m_replayBuffer->clear();
+  }
+  m_firstInit = false;
 
-    m_replayBuffer->setDuration(length);
+  // one stream per capture device, the track count can change between sessions
+  for (int i = 0; i < settings.audioTrackAmount; i++) {
+    if (!m_replayBuffer->hasStream(kAudioStreamBase + i)) {
+      m_replayBuffer->addStream<AudioEncoder>(kAudioStreamBase + i);
+    }
+  }
+  for (int idx = kAudioStreamBase + settings.audioTrackAmount; m_replayBuffer->hasStream(idx); idx++) {
+    m_replayBuffer->removeStream(idx);
+  }
 
-    for (const auto &[idx, encoder] : m_replayBuffer->getEncoders()) {
-      if (encoder->isVideo()) {
-        auto frameSize = CCDirector::sharedDirector()->getOpenGLView()->getFrameSize();
-        auto videoEncoder = std::dynamic_pointer_cast<VideoEncoder>(encoder);
-        videoEncoder->setSrcResolution(frameSize.width, frameSize.height);
-        videoEncoder->setDstResolution(width, height);
-        videoEncoder->setDstFramerate(framerate);
-        videoEncoder->setDstBitrate(bitrate);
-        videoEncoder->setUsingGPU(hwAccel);
+  if (settings.proxy && !m_replayBuffer->hasStream(kProxyStream)) {
+    m_replayBuffer->addStream<VideoEncoder>(kProxyStream);
+  } else if (!settings.proxy) {
+    m_replayBuffer->removeStream(kProxyStream);
+  }
+
+  if (settings.mixAudio && !m_replayBuffer->hasStream(kMixStream)) {
+    m_replayBuffer->addStream<AudioMixEncoder>(kMixStream);
+  } else if (!settings.mixAudio) {
+    m_replayBuffer->removeStream(kMixStream);
+  }
+
+  m_replayBuffer->setDuration(settings.length);
+  m_audioMixer->reset();
+  // one readback and colour conversion for every video stream, each encoder only scales to its own size
+  m_videoSource->setSize(settings.srcWidth, settings.srcHeight);
+  m_videoSource->setCropPreset(settings.cropPreset);
+  m_videoSource->setFollowAnchor(settings.cropFollow);
+  m_videoSource->setFramerate(settings.framerate);
+  m_videoSource->reset();
+
+  // sources have to be registered with the mixer before the mix encoder starts pulling from it
+  for (const auto &[idx, encoder] : m_replayBuffer->getEncoders()) {
+    if (encoder->isVideo()) {
+      auto videoEncoder = std::dynamic_pointer_cast<VideoEncoder>(encoder);
+      videoEncoder->setSource(m_videoSource);
+      if (warm) {
+        continue; // the setters reopen the codec
+      }
+      bool proxy = idx == kProxyStream;
+      videoEncoder->setKeyframePolicy({ settings.keyframeInterval, settings.sceneChange });
+      videoEncoder->setRateControlPolicy({ static_cast<VideoEncoder::RateControl>(settings.rateControl),
+                                           settings.quality, settings.vbvSeconds });
+      videoEncoder->setSoftwareCodec(settings.softwareCodec);
+      videoEncoder->setDstResolution(proxy ? settings.proxyWidth : settings.width,
+                                     proxy ? settings.proxyHeight : settings.height);
+      videoEncoder->setDstFramerate(settings.framerate);
+      videoEncoder->setDstBitrate(proxy ? settings.proxyBitrate : settings.bitrate);
+      videoEncoder->setUsingGPU(settings.hwAccel);
+    } else if (idx == kMixStream) {
+      auto mixEncoder = std::dynamic_pointer_cast<AudioMixEncoder>(encoder);
+      mixEncoder->setMixer(m_audioMixer);
+    } else {
+      int device = idx - kAudioStreamBase;
+      auto audioEncoder = std::dynamic_pointer_cast<AudioEncoder>(encoder);
+      audioEncoder->setDeviceID(settings.deviceIDs[device]);
+      if (settings.mixAudio) {
+        audioEncoder->setMixer(m_audioMixer, m_audioMixer->addSource(settings.deviceGains[device]));
       } else {
-        auto audioEncoder = std::dynamic_pointer_cast<AudioEncoder>(encoder);
-        audioEncoder->setDeviceID(deviceIDs[idx]);
+        audioEncoder->setMixer(nullptr, -1);
       }
+      // deferred tracks keep raw pcm and only pay for aac when a clip is actually saved
+      audioEncoder->setDeferred(settings.deferAudio);
+      audioEncoder->setEncodingEnabled(!settings.mixOnly && !settings.deferAudio);
+      m_audioPump->addEncoder(audioEncoder);
+    }
+  }
 
+  // a failed start leaves the encoders half open, so the next one must not count as warm
+  m_warmSettings = {};
+  for (const auto &encoder : m_replayBuffer->getEncoders() | std::views::values) {
+    if (warm) {
+      encoder->reset();
+    } else {
       encoder->init();
-      encoder->start();
     }
+  }
+  m_warmSettings = settings;
 
-    m_firstInit = false;
-  } catch (const std::string &e) {
-    return Err(e);
+  m_journal->close();
+  if (settings.journal) {
+    // sized for the buffer length plus some slack, aac is well under 24 kB/s and ~50 packets/s per track
+    int tracks = settings.audioTrackAmount + 1;
+    size_t seconds = settings.length + 10;
+    int videoBitrate = settings.bitrate + (settings.proxy ? settings.proxyBitrate : 0);
+    int videoStreams = settings.proxy ? 2 : 1;
+    m_journal->create(getJournalPath(), (videoBitrate / 8 + 24000 * tracks) * seconds,
+                      (settings.framerate * videoStreams + 50 * tracks) * seconds);
+  }
+  for (const auto &[idx, encoder] : m_replayBuffer->getEncoders()) {
+    if (settings.journal) {
+      m_journal->addStream(idx, encoder->getCodecContext());
+      encoder->setJournal(m_journal, idx);
+    } else {
+      encoder->setJournal(nullptr, -1);
+    }
   }
 
-  Mod::get()->setSavedValue<bool>("is-recording"_spr, true);
-  return Ok();
-}
+  // the trace takes the raw input of every encoder, what the readback and the fmod rings hand over
+  m_trace->close();
+  if (m_tracing) {
+    m_trace->create(getTracePath(), m_traceCompressed);
+  }
+  auto trace = m_tracing ? m_trace : nullptr;
+  m_videoSource->setTrace(trace);
+  for (const auto &[idx, encoder] : m_replayBuffer->getEncoders()) {
+    if (auto audioEncoder = std::dynamic_pointer_cast<AudioEncoder>(encoder)) {
+      audioEncoder->setTrace(trace, idx);
+    }
+  }
 
-void Recorder::stop() {
-  if (!Mod::get()->getSavedValue<bool>("is-recording"_spr)) {
-    return;
+  m_offline = settings.offline;
+  m_offlineFramerate = std::max(settings.framerate, 1);
+  m_offlineFrame = m_offlineVideoUs = m_offlineWaitUs = 0;
+  m_replayBuffer->resetClock();
+  // held at 0 until the first frame is read back, the encoders start their pts there
+  m_replayBuffer->getClock()->setManualTime(settings.offline ? 0 : -1);
+  for (const auto &encoder : m_replayBuffer->getEncoders() | std::views::values) {
+    encoder->start();
   }
-  Mod::get()->setSavedValue<bool>("is-recording"_spr, false);
+  m_audioPump->start();
+  auto videoEncoder = std::dynamic_pointer_cast<VideoEncoder>(m_replayBuffer->getStreamEncoder(kVideoStream));
+  if (settings.compactAge > 0) {
+    m_compactor->start(videoEncoder, static_cast<int64_t>(settings.compactAge) * 1000000, settings.compactBitrate);
+  }
+  m_thumbnails->start(videoEncoder);
+
+  // deferred tracks only have packets once a clip asks for them, there's nothing to mux ahead
+  if (m_premuxing && !settings.deferAudio) {
+    std::vector<std::pair<int, std::shared_ptr<BaseEncoder>>> streams = { { kVideoStream, videoEncoder } };
+    for (const auto &[idx, encoder] : m_replayBuffer->getEncoders()) {
+      if (idx == kMixStream || (idx >= kAudioStreamBase && !settings.mixOnly)) {
+        streams.emplace_back(idx, encoder);
+      }
+    }
+    m_fragmentRing->start(streams, static_cast<int64_t>(settings.length) * 1000000);
+  }
+}
+
+void Recorder::stopSession() {
+  m_audioPump->stop();
+  m_fragmentRing->stop();
+  m_compactor->stop();
+  m_thumbnails->stop();
   m_replayBuffer->stop();
+  for (const auto &encoder : m_replayBuffer->getEncoders() | std::views::values) {
+    encoder->joinThread();
+  }
+  m_replayBuffer->getClock()->setManualTime(-1);
+  m_journal->close();
+  m_trace->close();
 }
 
-geode::Result<std::string> Recorder::clip() {
+geode::Result<std::string> Recorder::clip(int64_t rangeStartUs, int64_t rangeEndUs) {
+  if (!this->isRecording()) {
+    return Err("not recording?");
+  }
+  try {
+    return Ok(this->writeClip(this->prepareClip(rangeStartUs, rangeEndUs)));
+  } catch (const std::string &e) {
+    return Err(e);
+  }
+}
+
+Recorder::ClipRequest Recorder::prepareClip(int64_t rangeStartUs, int64_t rangeEndUs, const std::string &name) {
   std::filesystem::path output_dir = Mod::get()->getSavedValue<std::string>("settings-output-dir"_spr);
   char buffer[80];
   std::time_t now = std::time(nullptr);
   std::tm* local_time = std::localtime(&now);
-  std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H-%M-%S.mp4", local_time);
+  std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H-%M-%S", local_time);
 
-  if (Mod::get()->getSavedValue<bool>("is-recording"_spr)) {
-    auto path = output_dir / buffer;
-    try {
-      m_replayBuffer->saveToFile(path);
-    } catch (const std::string &e) {
-      return Err(e);
+  ClipRequest request;
+  request.path = output_dir / (name.empty() ? fmt::format("{}.mp4", buffer) : fmt::format("{} {}.mp4", buffer, name));
+  ClipOptions &options = request.options;
+  options.accurateStart = Mod::get()->getSavedValue<bool>("settings-accurate-start"_spr);
+  options.rangeStartUs = rangeStartUs;
+  options.rangeEndUs = rangeEndUs;
+  auto clipStreams = static_cast<ClipStreams>(Mod::get()->getSavedValue<int>("settings-clip-streams"_spr));
+  if (m_replayBuffer->hasStream(kProxyStream) && clipStreams != ClipStreams::Both) {
+    for (const auto &[idx, encoder] : m_replayBuffer->getEncoders()) {
+      if (!encoder->isVideo() || idx == (clipStreams == ClipStreams::Proxy ? kProxyStream : kVideoStream)) {
+        options.streams.push_back(idx);
+      }
+    }
+  }
+  request.preset = Mod::get()->getSavedValue<int>("settings-export-preset"_spr);
+  if (request.preset > 0 && request.preset < static_cast<int>(ClipExporter::kPresets.size())) {
+    options.exportWidth = ClipExporter::kPresets[request.preset].width;
+    options.exportHeight = ClipExporter::kPresets[request.preset].height;
+    options.targetBytes = ClipExporter::kPresets[request.preset].targetBytes;
+  }
+  return request;
+}
+
+std::string Recorder::writeClip(const ClipRequest &request) {
+  ClipExporter::Stats stats = m_replayBuffer->saveToFile(request.path, request.options);
+  if (request.preset > 0) {
+    log::info("exported {} gops in {} pass(es): {} ms wall, {} ms cpu", stats.gops, stats.passes,
+              stats.wallUs / 1000, stats.cpuUs / 1000);
+  }
+  return request.path.string();
+}
+
+geode::Result<> Recorder::openReplay() {
+  if (!this->isRecording()) {
+    return Err("not recording?");
+  }
+
+  // the mixed track if there is one, otherwise the first device that keeps packets
+  std::shared_ptr<BaseEncoder> audio;
+  for (const auto &[idx, encoder] : m_replayBuffer->getEncoders()) {
+    if (!encoder->isVideo() && encoder->isPacketAvailable()) {
+      audio = encoder;
+      break;
+    }
+  }
+
+  auto video = m_replayBuffer->getStreamEncoder(kVideoStream);
+  try {
+    m_player->open(video->snapshotPackets(), video->getCodecContext(),
+                   audio ? audio->snapshotPackets() : std::deque<AVPacket *>(),
+                   audio ? audio->getCodecContext() : nullptr);
+  } catch (const std::string &e) {
+    return Err(e);
+  }
+  return Ok();
+}
+
+void Recorder::mark() {
+  if (!this->isRecording()) {
+    return;
+  }
+  for (const auto &encoder : m_replayBuffer->getEncoders() | std::views::values) {
+    if (encoder->isVideo()) {
+      std::dynamic_pointer_cast<VideoEncoder>(encoder)->requestKeyframe();
     }
-    return Ok(path.string());
   }
-  return Err("not recording?");
 }
@@ -2,19 +2,160 @@
 #define REPLAYBUFFER_RECORDER_HPP
 
 #include "ReplayBuffer.hpp"
+#include "AudioMixer.hpp"
+#include "AudioCapturePump.hpp"
+#include "GopCompactor.hpp"
+#include "ThumbnailCache.hpp"
+#include "ReplayPlayer.hpp"
+#include "PacketJournal.hpp"
+#include "VideoSource.hpp"
+#include "AutoClipper.hpp"
+#include "CaptureTrace.hpp"
+#include "FragmentRing.hpp"
+#include "TraceReplay.hpp"
+#include "Timer.hpp"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <thread>
 
 struct Recorder {
+  static constexpr int kVideoStream = 0;
+  // a smaller copy of the video from the same capture, for sharing or quick previews
+  static constexpr int kProxyStream = 1;
+  static constexpr int kMixStream = 2;
+  static constexpr int kAudioStreamBase = 3;
+  // how long an offline render holds the game for one encoder to take a frame before it gives up on the render
+  static constexpr auto kOfflineTimeout = std::chrono::seconds(5);
+
+  // which video streams a clip takes, saved as settings-clip-streams
+  enum class ClipStreams { Master, Proxy, Both };
+
+  // how far an offline render got, main thread only
+  struct OfflineStats {
+    int64_t frames;
+    int64_t videoUs; // capture clock time of the newest frame the encoders took
+    int64_t wallUs;
+    int64_t waitUs;  // spent holding the game until the encoders caught up
+  };
+
+  // starting and stopping happen on a lifecycle thread, the main thread only ever flips the state and reads it
+  enum class State { Idle, Starting, Recording, Stopping };
+
+  // where a clip goes and how it's cut, decided on the main thread so it can be written from any other
+  struct ClipRequest {
+    std::filesystem::path path;
+    ClipOptions options;
+    int preset;
+  };
+
+  // everything a session is set up from, read on the main thread before the lifecycle thread takes over.
+  // when it's unchanged from the last session the encoders are reset instead of being torn down and reopened
+  struct SessionSettings {
+    int width, height, framerate; // width and height are already scaled down to the crop
+    int cropPreset;
+    bool cropFollow;
+    bool hwAccel;
+    int softwareCodec;
+    int bitrate;
+    int rateControl, quality;
+    double vbvSeconds;
+    bool proxy;
+    int proxyWidth, proxyHeight, proxyBitrate;
+    double keyframeInterval;
+    bool sceneChange;
+    int length;
+    int srcWidth, srcHeight;
+    int audioTrackAmount;
+    std::vector<int> deviceIDs;
+    std::vector<float> deviceGains;
+    bool mixAudio, mixOnly, deferAudio;
+    int compactAge, compactBitrate;
+    bool journal;
+    bool offline;
+
+    bool operator==(const SessionSettings &) const = default;
+  };
+
   bool m_firstInit;
+  std::atomic<State> m_state;
+  std::thread m_lifecycleThread;
+  std::mutex m_errorMutex;
+  std::optional<std::string> m_error;
+  // a window resize that came in while the lifecycle thread was starting, startSession would have overwritten it
+  // with the size start read. taken together with leaving Starting so none slips in between
+  std::mutex m_sizeMutex;
+  std::optional<std::pair<int, int>> m_pendingSize;
+  SessionSettings m_warmSettings;
+  std::atomic<int64_t> m_lastTransitionUs;
+  std::atomic<bool> m_lastStartWarm;
   std::shared_ptr<ReplayBuffer> m_replayBuffer;
+  std::shared_ptr<VideoSource> m_videoSource;
+  std::shared_ptr<AudioMixer> m_audioMixer;
+  std::shared_ptr<AudioCapturePump> m_audioPump;
+  std::shared_ptr<GopCompactor> m_compactor;
+  std::shared_ptr<ThumbnailCache> m_thumbnails;
+  std::shared_ptr<ReplayPlayer> m_player;
+  std::shared_ptr<PacketJournal> m_journal;
+  std::shared_ptr<AutoClipper> m_autoClipper;
+  std::shared_ptr<CaptureTrace> m_trace;
+  std::shared_ptr<FragmentRing> m_fragmentRing;
+  // read in start like the auto clip settings, a trace or the premux never makes a start cold
+  bool m_tracing, m_traceCompressed, m_premuxing;
+  // the game steps a fixed 1 / framerate per update and every frame is encoded, set up by startSession and only
+  // touched by the main thread while recording
+  bool m_offline;
+  int m_offlineFramerate;
+  int64_t m_offlineFrame;
+  int64_t m_offlineVideoUs, m_offlineWaitUs;
+  Timer m_offlineTimer;
 
   Recorder();
   ~Recorder();
 
   static std::shared_ptr<Recorder> getInstance();
+  // where the running journal lives, and where an unclean one is moved to on the next launch
+  static std::filesystem::path getJournalPath();
+  static std::filesystem::path getCrashedJournalPath();
+  // the newest capture trace, every traced session overwrites it
+  static std::filesystem::path getTracePath();
 
+  // both return right away. a start that fails on the lifecycle thread reports through takeError, so does an
+  // offline render that stopped itself
   geode::Result<> start();
   void stop();
-  geode::Result<std::string> clip();
+  State getState() const;
+  bool isRecording() const;
+  std::optional<std::string> takeError();
+  // main thread: the window's new size, held back until the start is done while one is going on
+  void setWindowSize(int width, int height);
+
+  static SessionSettings readSettings();
+  void startSession(const SessionSettings &settings);
+  void stopSession();
+  void joinLifecycleThread();
+  // lifecycle thread: applies a size that came in while starting and moves on to state
+  void finishStart(State state);
+  // main thread, once per frame: reads the frame back and lets the encoders poll
+  void update();
+  // main thread: the dt the scheduler should step with during an offline render, 0 when the real one goes
+  float getOfflineStep() const;
+  OfflineStats getOfflineStats() const;
+  // the range is in capture clock microseconds, -1 clips the whole buffer
+  geode::Result<std::string> clip(int64_t rangeStartUs = -1, int64_t rangeEndUs = -1);
+  // the two halves of clip, name ends up in the file name. writeClip throws a std::string
+  ClipRequest prepareClip(int64_t rangeStartUs, int64_t rangeEndUs, const std::string &name = {});
+  std::string writeClip(const ClipRequest &request);
+  static AutoClipper::Settings readAutoClipSettings();
+  // the encoder settings a recording would start with, for replaying a trace through them
+  static TraceReplay::Options readTraceReplayOptions(TraceReplay::Pace pace);
+  // loads what's buffered right now into m_player, recording carries on
+  geode::Result<> openReplay();
+  // puts an idr into every video stream right now, so a clip can later start exactly here
+  void mark();
+  // captures the frame the game just stepped to and holds the main thread until the video encoders took it
+  void stepOffline();
 };
 
 
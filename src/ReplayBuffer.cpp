@@ -1,13 +1,29 @@
 #include "ReplayBuffer.hpp"
+#include "GopTranscoder.hpp"
+#include "Timeline.hpp"
+#include "VideoEncoder.hpp"
+#include <algorithm>
+#include <limits>
+#include <optional>
 #include <ranges>
+#include <span>
 
 ReplayBuffer::ReplayBuffer() {
+  m_clock = std::make_shared<CaptureClock>();
 }
 
 ReplayBuffer::~ReplayBuffer() {
   this->stop();
 }
 
+void ReplayBuffer::removeStream(int idx) {
+  m_encoders.erase(idx);
+}
+
+bool ReplayBuffer::hasStream(int idx) const {
+  return m_encoders.contains(idx);
+}
+
 std::shared_ptr<BaseEncoder> ReplayBuffer::getStreamEncoder(int idx) {
   return m_encoders[idx];
 }
@@ -36,35 +52,184 @@ void ReplayBuffer::clear() {
   }
 }
 
-void ReplayBuffer::saveToFile(const std::filesystem::path &filename) {
+ClipExporter::Stats ReplayBuffer::saveToFile(const std::filesystem::path &filename, const ClipOptions &options) {
   const std::string path = filename.string();
 
+  // nothing to re-encode and the same tracks the ring has muxed already, so the clip is just a write
+  if (m_fragmentRing && m_fragmentRing->isRunning() && options.exportWidth == 0 && options.targetBytes == 0 &&
+      !options.accurateStart) {
+    Timeline::Scope scope("saveToFile fragments");
+    std::vector<int> wanted;
+    for (auto &[idx, encoder] : m_encoders) {
+      if (encoder->isPacketAvailable() &&
+          (options.streams.empty() || std::ranges::find(options.streams, idx) != options.streams.end())) {
+        wanted.push_back(idx);
+      }
+    }
+    if (wanted == m_fragmentRing->getStreams() &&
+        m_fragmentRing->write(filename, options.rangeStartUs, options.rangeEndUs)) {
+      return {};
+    }
+  }
+
+  ClipExporter::Stats exportStats;
+  // each phase is marked until the next one starts
+  std::optional<Timeline::Scope> phase;
+  phase.emplace("saveToFile snapshot");
+
+  // take our own references up front so the encoders can keep pushing and trimming while we mux. video comes
+  // with its index, so finding the gops the clip starts and ends in is a binary search
+  std::map<int, std::deque<AVPacket *>> snapshots;
+  std::map<int, PacketIndex> indices;
+  for (auto &[idx, encoder] : m_encoders) {
+    if (!encoder->isPacketAvailable()) {
+      continue; // tracks that only feed the mixer never produce packets
+    }
+    if (!options.streams.empty() && std::ranges::find(options.streams, idx) == options.streams.end()) {
+      continue;
+    }
+    auto snapshot = encoder->isVideo() ? encoder->snapshotPackets(indices[idx]) : encoder->snapshotPackets();
+    if (!snapshot.empty()) {
+      snapshots[idx] = std::move(snapshot);
+    }
+  }
+  auto freeSnapshots = [&snapshots] {
+    for (auto &snapshot : snapshots | std::views::values) {
+      for (AVPacket *&pkt : snapshot) {
+        av_packet_free(&pkt);
+      }
+    }
+    snapshots.clear();
+  };
+
+  // every stream is stamped on the same capture clock, so the clip window is just the last maxDuration seconds of it
+  int64_t lastUs = 0;
+  int64_t maxDurationUs = 0;
+  for (auto &[idx, encoder] : m_encoders) {
+    if (snapshots.contains(idx)) {
+      AVRational timeBase = encoder->getCodecContext()->time_base;
+      lastUs = std::max(lastUs, av_rescale_q(snapshots[idx].back()->pts, timeBase, { 1, 1000000 }));
+      maxDurationUs = std::max(maxDurationUs, static_cast<int64_t>(encoder->getMaxDuration()) * 1000000);
+    }
+  }
+  int64_t usOffsetBase = lastUs - maxDurationUs;
+  int64_t usEnd = std::numeric_limits<int64_t>::max();
+  if (options.rangeStartUs >= 0 && options.rangeEndUs > options.rangeStartUs) {
+    usOffsetBase = std::max(usOffsetBase, options.rangeStartUs);
+    usEnd = options.rangeEndUs;
+  }
+  auto getTimestampOffset = [usOffsetBase](const std::shared_ptr<BaseEncoder> &encoder) {
+    return std::max(av_rescale_q(usOffsetBase, { 1, 1000000 }, encoder->getCodecContext()->time_base), 0ll);
+  };
+  auto getEndPts = [usEnd](const std::shared_ptr<BaseEncoder> &encoder) {
+    if (usEnd == std::numeric_limits<int64_t>::max()) {
+      return usEnd;
+    }
+    return av_rescale_q(usEnd, { 1, 1000000 }, encoder->getCodecContext()->time_base);
+  };
+
+  // exports re-encode the video up front, before there's a file to clean up if it fails. with several video
+  // streams only the first one is exported, the others are copied as they are
+  std::optional<ClipExporter> exporter;
+  int exportedStream = -1;
+  std::vector<AVPacket *> exported;
+  if (options.exportWidth > 0 || options.targetBytes > 0) {
+    phase.emplace("saveToFile export");
+    auto video = std::ranges::find_if(m_encoders, [&snapshots](const auto &entry) {
+      return entry.second->isVideo() && snapshots.contains(entry.first);
+    });
+    if (video != m_encoders.end()) {
+      const auto &buffer = snapshots[video->first];
+      int64_t timestampOffset = getTimestampOffset(video->second);
+      int64_t endPts = getEndPts(video->second);
+
+      // whatever the other tracks take comes out of the budget, plus a little for the container
+      int64_t videoBytes = 0;
+      if (options.targetBytes > 0) {
+        videoBytes = options.targetBytes - options.targetBytes / 100;
+        for (auto &[idx, encoder] : m_encoders) {
+          if (idx == video->first || !snapshots.contains(idx)) {
+            continue;
+          }
+          int64_t offset = getTimestampOffset(encoder);
+          int64_t end = getEndPts(encoder);
+          for (const AVPacket *pkt : snapshots[idx]) {
+            if (pkt && pkt->pts >= offset && pkt->pts < end) {
+              videoBytes -= pkt->size;
+            }
+          }
+        }
+        if (videoBytes <= 0) {
+          freeSnapshots();
+          throw fmt::format("the other tracks alone don't fit in {} bytes", options.targetBytes);
+        }
+      }
+
+      const PacketIndex &index = indices[video->first];
+      size_t gopBegin = index.keyframeAtOrBefore(timestampOffset).value_or(0);
+      // gops past the end of the range aren't needed at all
+      size_t gopEnd = buffer.size();
+      if (endPts != std::numeric_limits<int64_t>::max()) {
+        gopEnd = index.keyframeAtOrAfter(std::max(endPts, timestampOffset + 1)).value_or(buffer.size());
+      }
+
+      try {
+        exporter.emplace(std::dynamic_pointer_cast<VideoEncoder>(video->second), options.exportWidth,
+                         options.exportHeight);
+        std::vector<AVPacket *> packets(buffer.begin() + gopBegin, buffer.begin() + gopEnd);
+        exported = exporter->transcode(packets, timestampOffset, videoBytes, exportStats);
+        exportedStream = video->first;
+      } catch (const std::string &) {
+        freeSnapshots();
+        throw;
+      }
+    }
+  }
+  auto freeExported = [&exported] {
+    for (AVPacket *&pkt : exported) {
+      av_packet_free(&pkt);
+    }
+    exported.clear();
+  };
+
+  phase.emplace("saveToFile header");
   AVFormatContext *formatCtx;
   int ret = avformat_alloc_output_context2(&formatCtx, nullptr, nullptr, path.c_str());
   if (formatCtx == nullptr) {
+    freeSnapshots();
+    freeExported();
     char errStr[64];
     av_make_error_string(errStr, 64, ret);
     throw fmt::format("could not allocate output context, error: {}", errStr);
   }
 
-  std::map<int, int> streamMapping;
   std::map<int, AVStream *> streams;
   for (auto &[idx, encoder] : m_encoders) {
+    if (!snapshots.contains(idx)) {
+      continue;
+    }
     AVStream *outStream = avformat_new_stream(formatCtx, nullptr);
     if (outStream == nullptr) {
       avformat_free_context(formatCtx);
+      freeSnapshots();
+      freeExported();
       throw fmt::format("couldn't allocate output stream");
     }
 
-    avcodec_parameters_from_context(outStream->codecpar, encoder->getCodecContext());
+    if (idx == exportedStream) {
+      exporter->getOutputParameters(outStream->codecpar);
+    } else {
+      avcodec_parameters_from_context(outStream->codecpar, encoder->getCodecContext());
+    }
     outStream->time_base = encoder->getCodecContext()->time_base;
 
-    streamMapping[idx] = outStream->index;
     streams[idx] = outStream;
   }
 
   if ((ret = avio_open(&formatCtx->pb, path.c_str(), AVIO_FLAG_WRITE)) < 0) {
     avformat_free_context(formatCtx);
+    freeSnapshots();
+    freeExported();
 
     char errStr[64];
     av_make_error_string(errStr, 64, ret);
@@ -74,86 +239,139 @@ void ReplayBuffer::saveToFile(const std::filesystem::path &filename) {
   if ((ret = avformat_write_header(formatCtx, nullptr)) < 0) {
     avio_closep(&formatCtx->pb);
     avformat_free_context(formatCtx);
+    freeSnapshots();
+    freeExported();
 
     char errStr[64];
     av_make_error_string(errStr, 64, ret);
     throw fmt::format("could not write header, error: {}", errStr);
   }
 
-  // hack: assuming encoder at stream 0 is *always* a video encoder
-  int64_t lastPTS = m_encoders[0]->getPacketBuffer().back()->pts;
-  int64_t maxDurationPTS = av_rescale_q(m_encoders[0]->getMaxDuration(), { 1, 1 }, m_encoders[0]->getCodecContext()->time_base);
-  int64_t usOffsetBase = av_rescale_q(lastPTS - maxDurationPTS, m_encoders[0]->getCodecContext()->time_base, { 1, 1000000 });
-
+  phase.emplace("saveToFile packets");
   for (auto &[idx, encoder] : m_encoders) {
-    //encoder->lockBuffer();
-    auto buffer = encoder->getPacketBuffer();
-    int64_t timestampOffset = av_rescale_q(usOffsetBase, { 1, 1000000 }, encoder->getCodecContext()->time_base);
-    timestampOffset = std::max(timestampOffset, 0ll);
+    if (!streams.contains(idx)) {
+      continue;
+    }
+    const auto &buffer = snapshots[idx];
+    AVRational timeBase = encoder->getCodecContext()->time_base;
+    int64_t timestampOffset = getTimestampOffset(encoder);
+    int64_t endPts = getEndPts(encoder);
 
-    bool seenKeyframe = false;
-    for (const auto &orig_pkt : buffer) {
-      if (!orig_pkt) {
-        continue; // hack 2: if it doesn't exist we just ignore it
-      }
-      if (orig_pkt->flags & AV_PKT_FLAG_KEY) {
-        seenKeyframe = true;
-      }
-      if ((!seenKeyframe && encoder->isVideo()) || orig_pkt->pts < timestampOffset) {
-        continue;
+    if (idx == exportedStream) {
+      for (const AVPacket *pkt : exported) {
+        if (ret >= 0 && pkt->pts < endPts) {
+          ret = writePacket(formatCtx, streams[idx], pkt, timeBase, timestampOffset);
+        }
       }
+      continue;
+    }
 
-      AVPacket *pkt = av_packet_clone(orig_pkt);
-      int oldStreamIdx = idx;
-      int newStreamIdx = streamMapping[oldStreamIdx];
-      int64_t offset = timestampOffset;
+    size_t copyFrom = 0;
+    if (encoder->isVideo() && options.accurateStart) {
+      // find the gop the clip starts in, then re-encode only the frames between the start and the next keyframe
+      const PacketIndex &index = indices[idx];
+      std::optional<size_t> gopBegin = index.keyframeAtOrBefore(timestampOffset);
+      if (gopBegin && index.pts(*gopBegin) != timestampOffset) {
+        size_t gopEnd = index.nextKeyframe(*gopBegin);
 
-      if (pkt->pts != AV_NOPTS_VALUE) {
-        pkt->pts = pkt->pts - offset;
-      }
-      if (pkt->dts != AV_NOPTS_VALUE) {
-        pkt->dts = pkt->dts - offset;
-      }
+        std::vector<AVPacket *> head;
+        try {
+          auto videoEncoder = std::dynamic_pointer_cast<VideoEncoder>(encoder);
+          GopTranscoder transcoder(videoEncoder->getCodecContext(), [&videoEncoder] {
+            return videoEncoder->createCompatibleContext();
+          });
+          // the snapshot is a deque, the transcoder wants the gop contiguous
+          std::vector<AVPacket *> gop(buffer.begin() + *gopBegin, buffer.begin() + gopEnd);
+          head = transcoder.transcode(gop, timestampOffset);
+        } catch (const std::string &) {
+          // can't re-encode here, fall back to starting at the next keyframe
+        }
 
-      if (pkt->dts != AV_NOPTS_VALUE && pkt->pts != AV_NOPTS_VALUE) {
-        if (pkt->dts > pkt->pts) {
-          pkt->dts = pkt->pts;
+        if (!head.empty()) {
+          for (AVPacket *pkt : head) {
+            if (ret >= 0 && pkt->pts < endPts) {
+              ret = writePacket(formatCtx, streams[idx], pkt, timeBase, timestampOffset);
+            }
+            av_packet_free(&pkt);
+          }
+          copyFrom = gopEnd;
         }
       }
+    }
 
-      if (pkt->dts == AV_NOPTS_VALUE && pkt->pts != AV_NOPTS_VALUE) {
-        pkt->dts = pkt->pts;
+    bool seenKeyframe = false;
+    for (size_t i = copyFrom; i < buffer.size() && ret >= 0; i++) {
+      const AVPacket *orig_pkt = buffer[i];
+      if (!orig_pkt) {
+        continue; // hack 2: if it doesn't exist we just ignore it
       }
-
-      AVStream *outStream = streams[oldStreamIdx];
-      av_packet_rescale_ts(pkt, encoder->getCodecContext()->time_base, outStream->time_base);
-
-      if (pkt->dts != AV_NOPTS_VALUE && pkt->pts != AV_NOPTS_VALUE) {
-        if (pkt->dts > pkt->pts) {
-          pkt->dts = pkt->pts;
-        }
+      if (orig_pkt->flags & AV_PKT_FLAG_KEY) {
+        seenKeyframe = true;
       }
-
-      pkt->stream_index = newStreamIdx;
-
-      if ((ret = av_interleaved_write_frame(formatCtx, pkt)) < 0) {
-        av_packet_free(&pkt);
-        break;
+      if ((!seenKeyframe && encoder->isVideo()) || orig_pkt->pts < timestampOffset || orig_pkt->pts >= endPts) {
+        continue;
       }
 
-      av_packet_free(&pkt);
+      ret = writePacket(formatCtx, streams[idx], orig_pkt, timeBase, timestampOffset);
     }
-    //encoder->unlockBuffer();
   }
 
+  phase.emplace("saveToFile trailer");
   av_write_trailer(formatCtx);
   avio_closep(&formatCtx->pb);
   avformat_free_context(formatCtx);
+  freeSnapshots();
+  freeExported();
   if (ret < 0) {
     char errStr[64];
     av_make_error_string(errStr, 64, ret);
     throw fmt::format("could not write to file, error: {}", errStr);
   }
+  return exportStats;
+}
+
+int ReplayBuffer::writePacket(AVFormatContext *formatCtx, AVStream *outStream, const AVPacket *orig_pkt,
+                              AVRational srcTimeBase, int64_t offset) {
+  AVPacket *pkt = av_packet_clone(orig_pkt);
+
+  if (pkt->pts != AV_NOPTS_VALUE) {
+    pkt->pts = pkt->pts - offset;
+  }
+  if (pkt->dts != AV_NOPTS_VALUE) {
+    pkt->dts = pkt->dts - offset;
+  }
+
+  if (pkt->dts != AV_NOPTS_VALUE && pkt->pts != AV_NOPTS_VALUE) {
+    if (pkt->dts > pkt->pts) {
+      pkt->dts = pkt->pts;
+    }
+  }
+
+  if (pkt->dts == AV_NOPTS_VALUE && pkt->pts != AV_NOPTS_VALUE) {
+    pkt->dts = pkt->pts;
+  }
+
+  av_packet_rescale_ts(pkt, srcTimeBase, outStream->time_base);
+
+  if (pkt->dts != AV_NOPTS_VALUE && pkt->pts != AV_NOPTS_VALUE) {
+    if (pkt->dts > pkt->pts) {
+      pkt->dts = pkt->pts;
+    }
+  }
+
+  pkt->stream_index = outStream->index;
+
+  int ret = av_interleaved_write_frame(formatCtx, pkt);
+  av_packet_free(&pkt);
+  return ret;
+}
+
+void ReplayBuffer::resetClock() {
+  m_clock->reset();
+}
+
+std::shared_ptr<CaptureClock> ReplayBuffer::getClock() const {
+  return m_clock;
 }
 
 void ReplayBuffer::setDuration(int64_t newDuration) {
@@ -165,3 +383,7 @@ void ReplayBuffer::setDuration(int64_t newDuration) {
 const std::map<int, std::shared_ptr<BaseEncoder>> &ReplayBuffer::getEncoders() {
   return m_encoders;
 }
+
+void ReplayBuffer::setFragmentRing(std::shared_ptr<FragmentRing> ring) {
+  m_fragmentRing = std::move(ring);
+}
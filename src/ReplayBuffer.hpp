@@ -6,6 +6,8 @@
 #include <mutex>
 #include <vector>
 #include "BaseEncoder.hpp"
+#include "ClipExporter.hpp"
+#include "FragmentRing.hpp"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -13,30 +15,58 @@ extern "C" {
 #include <libavutil/opt.h>
 }
 
+struct ClipOptions {
+  // re-encode the partial gop in front of the first keyframe instead of starting the clip at it
+  bool accurateStart = false;
+  // re-encode the video to this size and/or to fit the whole file in targetBytes, 0 leaves it as recorded
+  int exportWidth = 0;
+  int exportHeight = 0;
+  int64_t targetBytes = 0;
+  // part of the buffer to clip in capture clock microseconds, -1 takes the last maxDuration seconds
+  int64_t rangeStartUs = -1;
+  int64_t rangeEndUs = -1;
+  // stream indices to put in the clip, empty takes every stream
+  std::vector<int> streams;
+};
+
 class ReplayBuffer {
   std::map<int, std::shared_ptr<BaseEncoder>> m_encoders;
+  std::shared_ptr<CaptureClock> m_clock;
+  std::shared_ptr<FragmentRing> m_fragmentRing;
 
 public:
+  // shifts a packet back by offset and writes it to outStream, shared with journal recovery
+  static int writePacket(AVFormatContext *formatCtx, AVStream *outStream, const AVPacket *orig_pkt,
+                         AVRational srcTimeBase, int64_t offset);
+
   ReplayBuffer();
   ~ReplayBuffer();
 
   template<typename Encoder>
   void addStream(int idx);
+  void removeStream(int idx);
+  bool hasStream(int idx) const;
   std::shared_ptr<BaseEncoder> getStreamEncoder(int idx);
 
   void start();
   void stop();
   void update();
   void clear();
-  void saveToFile(const std::filesystem::path &filename);
+  // how the export went, all zero when nothing was re-encoded
+  ClipExporter::Stats saveToFile(const std::filesystem::path &filename, const ClipOptions &options = {});
   void setDuration(int64_t newDuration);
+  void resetClock();
+  std::shared_ptr<CaptureClock> getClock() const;
   const std::map<int, std::shared_ptr<BaseEncoder>> &getEncoders();
+  // clips that copy the streams the ring muxes as they are get written straight out of it
+  void setFragmentRing(std::shared_ptr<FragmentRing> ring);
 };
 
 template<typename Encoder>
 void ReplayBuffer::addStream(int idx) {
   static_assert(std::is_base_of<BaseEncoder, Encoder>::value, "must be an encoder");
   m_encoders[idx] = std::make_shared<Encoder>();
+  m_encoders[idx]->setClock(m_clock);
 }
 
 #endif
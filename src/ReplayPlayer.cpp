@@ -0,0 +1,459 @@
+#include "ReplayPlayer.hpp"
+#include "ThreadPriority.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+ReplayPlayer::ReplayPlayer() : m_decFrame(nullptr), m_swsCtx(nullptr), m_swrCtx(nullptr), m_width(0), m_height(0),
+                               m_running(false), m_seekTarget(AV_NOPTS_VALUE), m_dropBeforeUs(AV_NOPTS_VALUE),
+                               m_audioFifo(nullptr), m_sound(nullptr), m_channel(nullptr), m_texture(0),
+                               m_shownPts(AV_NOPTS_VALUE), m_playFromUs(0), m_playing(false), m_firstUs(0),
+                               m_lastUs(0) {
+}
+
+ReplayPlayer::~ReplayPlayer() {
+  this->close();
+}
+
+void ReplayPlayer::openTrack(Track &track, std::deque<AVPacket *> &&packets, const AVCodecContext *source) {
+  const AVCodec *decoder = avcodec_find_decoder(source->codec_id);
+  if (decoder == nullptr) {
+    throw fmt::format("no decoder available for {}", avcodec_get_name(source->codec_id));
+  }
+
+  track.decCtx = avcodec_alloc_context3(decoder);
+  AVCodecParameters *params = avcodec_parameters_alloc();
+  avcodec_parameters_from_context(params, source);
+  avcodec_parameters_to_context(track.decCtx, params);
+  avcodec_parameters_free(&params);
+  track.decCtx->pkt_timebase = source->time_base;
+  track.timeBase = source->time_base;
+
+  int ret = avcodec_open2(track.decCtx, decoder, nullptr);
+  if (ret < 0) {
+    avcodec_free_context(&track.decCtx);
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not open decoder, error: {}", errStr);
+  }
+
+  track.packets = std::move(packets);
+  track.position = 0;
+  track.flushed = false;
+}
+
+void ReplayPlayer::closeTrack(Track &track) {
+  for (AVPacket *&pkt : track.packets) {
+    av_packet_free(&pkt);
+  }
+  track.packets.clear();
+  if (track.decCtx != nullptr) {
+    avcodec_free_context(&track.decCtx);
+  }
+}
+
+void ReplayPlayer::open(std::deque<AVPacket *> video, const AVCodecContext *videoCtx, std::deque<AVPacket *> audio,
+                        const AVCodecContext *audioCtx) {
+  this->close();
+  std::erase(video, nullptr);
+  std::erase(audio, nullptr);
+  if (video.empty()) {
+    for (AVPacket *&pkt : audio) {
+      av_packet_free(&pkt);
+    }
+    throw fmt::format("nothing has been recorded yet");
+  }
+
+  try {
+    openTrack(m_video, std::move(video), videoCtx);
+    if (audioCtx != nullptr && !audio.empty()) {
+      openTrack(m_audio, std::move(audio), audioCtx);
+    }
+  } catch (const std::string &) {
+    for (AVPacket *&pkt : video) {
+      av_packet_free(&pkt);
+    }
+    for (AVPacket *&pkt : audio) {
+      av_packet_free(&pkt);
+    }
+    this->close();
+    throw;
+  }
+
+  m_keyframes.clear();
+  int64_t firstPts = m_video.packets.front()->pts, lastPts = firstPts;
+  for (size_t i = 0; i < m_video.packets.size(); i++) {
+    if (m_video.packets[i]->flags & AV_PKT_FLAG_KEY) {
+      m_keyframes.push_back(i);
+    }
+    firstPts = std::min(firstPts, m_video.packets[i]->pts);
+    lastPts = std::max(lastPts, m_video.packets[i]->pts);
+  }
+  m_firstUs = av_rescale_q(firstPts, m_video.timeBase, { 1, 1000000 });
+  m_lastUs = av_rescale_q(lastPts, m_video.timeBase, { 1, 1000000 });
+
+  m_width = std::min(m_video.decCtx->width, kMaxWidth) & ~1;
+  m_height = static_cast<int>(static_cast<int64_t>(m_video.decCtx->height) * m_width / m_video.decCtx->width) & ~1;
+  m_decFrame = av_frame_alloc();
+
+  if (m_audio.decCtx != nullptr) {
+    try {
+      this->initAudioOutput();
+    } catch (const std::string &) {
+      this->close();
+      throw;
+    }
+  }
+
+  m_playing = false;
+  m_playFromUs = m_firstUs;
+  m_shownPts = AV_NOPTS_VALUE;
+  m_seekTarget = m_firstUs;
+  m_running = true;
+  m_thread = std::thread(&ReplayPlayer::threadProc, this);
+}
+
+void ReplayPlayer::initAudioOutput() {
+  AVChannelLayout stereo = AV_CHANNEL_LAYOUT_STEREO;
+  int ret = swr_alloc_set_opts2(&m_swrCtx, &stereo, AV_SAMPLE_FMT_S16, kSampleRate, &m_audio.decCtx->ch_layout,
+                                m_audio.decCtx->sample_fmt, m_audio.decCtx->sample_rate, 0, nullptr);
+  if (ret < 0 || swr_init(m_swrCtx) < 0) {
+    throw fmt::format("could not init resampler for playback");
+  }
+  m_audioFifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_S16, 2, kSampleRate);
+
+  FMOD_CREATESOUNDEXINFO createInfo = {};
+  createInfo.cbsize = sizeof(FMOD_CREATESOUNDEXINFO);
+  createInfo.format = FMOD_SOUND_FORMAT_PCM16;
+  createInfo.defaultfrequency = kSampleRate;
+  createInfo.numchannels = 2;
+  createInfo.decodebuffersize = 1024;
+  createInfo.length = kSampleRate * 2 * sizeof(int16_t);
+  createInfo.pcmreadcallback = &ReplayPlayer::readAudio;
+  createInfo.userdata = this;
+
+  auto *system = FMODAudioEngine::get()->m_system;
+  FMOD_RESULT result = system->createSound(nullptr, FMOD_2D | FMOD_OPENUSER | FMOD_LOOP_NORMAL | FMOD_CREATESTREAM,
+                                           &createInfo, &m_sound);
+  if (result != FMOD_OK) {
+    m_sound = nullptr;
+    throw fmt::format("could not create playback stream, fmod error {}", static_cast<int>(result));
+  }
+  system->playSound(m_sound, nullptr, false, &m_channel);
+}
+
+void ReplayPlayer::close() {
+  {
+    std::lock_guard lock(m_mutex);
+    m_running = false;
+  }
+  m_cv.notify_all();
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+
+  if (m_channel != nullptr) {
+    m_channel->stop();
+    m_channel = nullptr;
+  }
+  if (m_sound != nullptr) {
+    m_sound->release();
+    m_sound = nullptr;
+  }
+  if (m_audioFifo != nullptr) {
+    av_audio_fifo_free(m_audioFifo);
+    m_audioFifo = nullptr;
+  }
+  if (m_swrCtx != nullptr) {
+    swr_free(&m_swrCtx);
+  }
+  if (m_swsCtx != nullptr) {
+    sws_free_context(&m_swsCtx);
+  }
+  if (m_decFrame != nullptr) {
+    av_frame_free(&m_decFrame);
+  }
+  closeTrack(m_video);
+  closeTrack(m_audio);
+  m_keyframes.clear();
+  m_frames.clear();
+  m_freeBuffers.clear();
+  m_playing = false;
+
+  if (m_texture != 0) {
+    glDeleteTextures(1, &m_texture);
+    m_texture = 0;
+  }
+}
+
+bool ReplayPlayer::isOpen() const {
+  return m_video.decCtx != nullptr;
+}
+
+void ReplayPlayer::play() {
+  if (this->isOpen() && !m_playing) {
+    if (m_playFromUs >= m_lastUs) {
+      this->seek(m_firstUs);
+    }
+    m_timer.start();
+    m_playing = true;
+  }
+}
+
+void ReplayPlayer::pause() {
+  if (m_playing) {
+    m_playFromUs = this->getPosition();
+    m_playing = false;
+  }
+}
+
+bool ReplayPlayer::isPlaying() const {
+  return m_playing;
+}
+
+void ReplayPlayer::seek(int64_t us) {
+  us = std::clamp(us, m_firstUs, m_lastUs);
+  m_playFromUs = us;
+  m_timer.start();
+  m_shownPts = AV_NOPTS_VALUE;
+  {
+    std::lock_guard lock(m_mutex);
+    m_seekTarget = us;
+  }
+  m_cv.notify_all();
+}
+
+int64_t ReplayPlayer::getPosition() const {
+  if (!m_playing) {
+    return m_playFromUs;
+  }
+  return std::min(m_playFromUs + m_timer.stop(), m_lastUs);
+}
+
+std::pair<int64_t, int64_t> ReplayPlayer::getRange() const {
+  return { m_firstUs, m_lastUs };
+}
+
+GLuint ReplayPlayer::getTexture() const {
+  return m_texture;
+}
+
+int ReplayPlayer::getWidth() const {
+  return m_width;
+}
+
+int ReplayPlayer::getHeight() const {
+  return m_height;
+}
+
+void ReplayPlayer::update() {
+  if (!this->isOpen()) {
+    return;
+  }
+
+  int64_t position = this->getPosition();
+  if (m_playing && position >= m_lastUs) {
+    this->pause();
+  }
+
+  std::lock_guard lock(m_mutex);
+  // drop everything that's already been overtaken by the frame after it
+  while (m_frames.size() > 1 && m_frames[1].ptsUs <= position) {
+    m_freeBuffers.push_back(std::move(m_frames.front().pixels));
+    m_frames.pop_front();
+  }
+  if (!m_frames.empty() && m_frames.front().ptsUs != m_shownPts &&
+      (m_frames.front().ptsUs <= position || m_shownPts == AV_NOPTS_VALUE)) {
+    if (m_texture == 0) {
+      glGenTextures(1, &m_texture);
+      glBindTexture(GL_TEXTURE_2D, m_texture);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                   m_frames.front().pixels.data());
+    } else {
+      glBindTexture(GL_TEXTURE_2D, m_texture);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE,
+                      m_frames.front().pixels.data());
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_shownPts = m_frames.front().ptsUs;
+  }
+  m_cv.notify_all();
+}
+
+void ReplayPlayer::threadProc() {
+  placeCurrentThread(ThreadRole::Worker);
+  while (m_running) {
+    int64_t seekTarget;
+    {
+      std::lock_guard lock(m_mutex);
+      seekTarget = m_seekTarget;
+      m_seekTarget = AV_NOPTS_VALUE;
+    }
+    if (seekTarget != AV_NOPTS_VALUE) {
+      this->seekTo(seekTarget);
+    }
+
+    bool busy = this->decodeVideoStep();
+    busy |= this->decodeAudioStep();
+    if (!busy) {
+      std::unique_lock lock(m_mutex);
+      m_cv.wait_for(lock, kIdleWait, [this] { return !m_running || m_seekTarget != AV_NOPTS_VALUE; });
+    }
+  }
+}
+
+void ReplayPlayer::seekTo(int64_t us) {
+  {
+    std::lock_guard lock(m_mutex);
+    for (auto &frame : m_frames) {
+      m_freeBuffers.push_back(std::move(frame.pixels));
+    }
+    m_frames.clear();
+    m_dropBeforeUs = us;
+  }
+
+  // the keyframe at or in front of the target, found through the keyframe index
+  int64_t targetPts = av_rescale_q(us, { 1, 1000000 }, m_video.timeBase);
+  auto key = std::ranges::upper_bound(m_keyframes, targetPts, {}, [this](size_t idx) {
+    return m_video.packets[idx]->pts;
+  });
+  m_video.position = key == m_keyframes.begin() ? m_keyframes.front() : *std::prev(key);
+  m_video.flushed = false;
+  avcodec_flush_buffers(m_video.decCtx);
+
+  if (m_audio.decCtx != nullptr) {
+    int64_t audioPts = av_rescale_q(us, { 1, 1000000 }, m_audio.timeBase);
+    auto pkt = std::ranges::lower_bound(m_audio.packets, audioPts, {}, &AVPacket::pts);
+    m_audio.position = std::max<size_t>(pkt - m_audio.packets.begin(), 1) - 1;
+    m_audio.flushed = false;
+    avcodec_flush_buffers(m_audio.decCtx);
+    swr_init(m_swrCtx);
+    std::lock_guard lock(m_audioMutex);
+    av_audio_fifo_reset(m_audioFifo);
+  }
+}
+
+bool ReplayPlayer::decodeVideoStep() {
+  {
+    std::lock_guard lock(m_mutex);
+    if (m_frames.size() >= kCacheFrames) {
+      return false;
+    }
+  }
+  if (m_video.flushed) {
+    return false;
+  }
+
+  if (m_video.position < m_video.packets.size()) {
+    avcodec_send_packet(m_video.decCtx, m_video.packets[m_video.position++]);
+  } else {
+    avcodec_send_packet(m_video.decCtx, nullptr);
+    m_video.flushed = true;
+  }
+
+  while (avcodec_receive_frame(m_video.decCtx, m_decFrame) >= 0) {
+    int64_t ptsUs = av_rescale_q(m_decFrame->best_effort_timestamp, m_video.timeBase, { 1, 1000000 });
+    if (ptsUs >= m_dropBeforeUs) {
+      this->pushVideoFrame(m_decFrame, ptsUs);
+    }
+    av_frame_unref(m_decFrame);
+  }
+  return true;
+}
+
+void ReplayPlayer::pushVideoFrame(AVFrame *frame, int64_t ptsUs) {
+  std::vector<uint8_t> pixels;
+  {
+    std::lock_guard lock(m_mutex);
+    if (!m_freeBuffers.empty()) {
+      pixels = std::move(m_freeBuffers.back());
+      m_freeBuffers.pop_back();
+    }
+  }
+  pixels.resize(static_cast<size_t>(m_width) * m_height * 4);
+
+  m_swsCtx = sws_getCachedContext(
+    m_swsCtx,
+    frame->width,
+    frame->height,
+    static_cast<AVPixelFormat>(frame->format),
+    m_width,
+    m_height,
+    AV_PIX_FMT_RGBA,
+    SWS_BILINEAR,
+    nullptr,
+    nullptr,
+    nullptr
+    );
+  uint8_t *dst[] = { pixels.data() };
+  int dstStride[] = { m_width * 4 };
+  sws_scale(m_swsCtx, frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+
+  std::lock_guard lock(m_mutex);
+  m_frames.push_back({ ptsUs, std::move(pixels) });
+}
+
+bool ReplayPlayer::decodeAudioStep() {
+  if (m_audio.decCtx == nullptr || m_audio.flushed) {
+    return false;
+  }
+  {
+    std::lock_guard lock(m_audioMutex);
+    if (av_audio_fifo_size(m_audioFifo) >= kAudioAheadSamples) {
+      return false;
+    }
+  }
+
+  if (m_audio.position < m_audio.packets.size()) {
+    avcodec_send_packet(m_audio.decCtx, m_audio.packets[m_audio.position++]);
+  } else {
+    avcodec_send_packet(m_audio.decCtx, nullptr);
+    m_audio.flushed = true;
+  }
+
+  while (avcodec_receive_frame(m_audio.decCtx, m_decFrame) >= 0) {
+    int64_t ptsUs = av_rescale_q(m_decFrame->pts, m_audio.timeBase, { 1, 1000000 });
+    if (ptsUs >= m_dropBeforeUs) {
+      this->pushAudioFrame(m_decFrame);
+    }
+    av_frame_unref(m_decFrame);
+  }
+  return true;
+}
+
+void ReplayPlayer::pushAudioFrame(AVFrame *frame) {
+  int maxOut = swr_get_out_samples(m_swrCtx, frame->nb_samples);
+  m_audioScratch.resize(static_cast<size_t>(maxOut) * 2);
+  uint8_t *out[] = { reinterpret_cast<uint8_t *>(m_audioScratch.data()) };
+  int converted = swr_convert(m_swrCtx, out, maxOut, frame->extended_data, frame->nb_samples);
+  if (converted <= 0) {
+    return;
+  }
+
+  std::lock_guard lock(m_audioMutex);
+  av_audio_fifo_write(m_audioFifo, reinterpret_cast<void **>(out), converted);
+}
+
+FMOD_RESULT F_CALL ReplayPlayer::readAudio(FMOD_SOUND *sound, void *data, unsigned int length) {
+  void *userData = nullptr;
+  reinterpret_cast<FMOD::Sound *>(sound)->getUserData(&userData);
+  auto *player = static_cast<ReplayPlayer *>(userData);
+  if (player != nullptr) {
+    player->fillAudio(static_cast<int16_t *>(data), length / (2 * sizeof(int16_t)));
+  } else {
+    std::memset(data, 0, length);
+  }
+  return FMOD_OK;
+}
+
+void ReplayPlayer::fillAudio(int16_t *out, unsigned int frames) {
+  int read = 0;
+  if (m_playing) {
+    std::lock_guard lock(m_audioMutex);
+    void *planes[] = { out };
+    read = std::max(av_audio_fifo_read(m_audioFifo, planes, static_cast<int>(frames)), 0);
+  }
+  std::memset(out + read * 2, 0, (frames - read) * 2 * sizeof(int16_t));
+}
@@ -0,0 +1,112 @@
+#ifndef REPLAYBUFFER_REPLAYPLAYER_HPP
+#define REPLAYBUFFER_REPLAYPLAYER_HPP
+
+#include "Timer.hpp"
+#include <Geode/binding/FMODAudioEngine.hpp>
+#include <Geode/cocos/platform/CCGL.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/audio_fifo.h>
+#include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
+}
+
+// plays back a snapshot of the packet buffers without going through a file. a worker thread decodes a few
+// frames ahead into a small cache and keeps a short audio queue filled, the main thread picks the frame that's
+// due and uploads it into a texture, and fmod pulls the audio through a user stream. seeking jumps to the
+// keyframe in front of the target and decodes forward from there
+class ReplayPlayer {
+  struct Track {
+    AVCodecContext *decCtx = nullptr;
+    AVRational timeBase {};
+    std::deque<AVPacket *> packets;
+    size_t position = 0;
+    bool flushed = false;
+  };
+
+  struct Frame {
+    int64_t ptsUs;
+    std::vector<uint8_t> pixels;
+  };
+
+  Track m_video, m_audio;
+  std::vector<size_t> m_keyframes;
+  AVFrame *m_decFrame;
+  SwsContext *m_swsCtx;
+  SwrContext *m_swrCtx;
+  int m_width, m_height;
+
+  std::thread m_thread;
+  std::atomic<bool> m_running;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<Frame> m_frames;
+  std::vector<std::vector<uint8_t>> m_freeBuffers;
+  int64_t m_seekTarget;
+  int64_t m_dropBeforeUs; // frames and samples decoded on the way to a seek target are thrown away
+
+  std::mutex m_audioMutex;
+  AVAudioFifo *m_audioFifo;
+  std::vector<int16_t> m_audioScratch;
+  FMOD::Sound *m_sound;
+  FMOD::Channel *m_channel;
+
+  // main thread only
+  GLuint m_texture;
+  int64_t m_shownPts;
+  Timer m_timer;
+  int64_t m_playFromUs;
+  std::atomic<bool> m_playing;
+  int64_t m_firstUs, m_lastUs;
+
+  void threadProc();
+  void seekTo(int64_t us);
+  bool decodeVideoStep();
+  bool decodeAudioStep();
+  void pushVideoFrame(AVFrame *frame, int64_t ptsUs);
+  void pushAudioFrame(AVFrame *frame);
+  void fillAudio(int16_t *out, unsigned int frames);
+  void initAudioOutput();
+  static void openTrack(Track &track, std::deque<AVPacket *> &&packets, const AVCodecContext *source);
+  static void closeTrack(Track &track);
+  static FMOD_RESULT F_CALL readAudio(FMOD_SOUND *sound, void *data, unsigned int length);
+
+public:
+  static constexpr int kCacheFrames = 8;
+  static constexpr int kMaxWidth = 640;
+  static constexpr int kSampleRate = 48000;
+  static constexpr int kAudioAheadSamples = kSampleRate / 2;
+  static constexpr auto kIdleWait = std::chrono::milliseconds(5);
+
+  ReplayPlayer();
+  ~ReplayPlayer();
+
+  // takes ownership of the packets. audio can be empty, the codec contexts are only read during the call
+  void open(std::deque<AVPacket *> video, const AVCodecContext *videoCtx, std::deque<AVPacket *> audio,
+            const AVCodecContext *audioCtx);
+  void close();
+  bool isOpen() const;
+
+  void play();
+  void pause();
+  bool isPlaying() const;
+  void seek(int64_t us);
+
+  // main thread: advances the clock and uploads the frame that's due
+  void update();
+  GLuint getTexture() const;
+  int getWidth() const;
+  int getHeight() const;
+  int64_t getPosition() const;
+  std::pair<int64_t, int64_t> getRange() const;
+};
+
+#endif
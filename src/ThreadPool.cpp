@@ -0,0 +1,53 @@
+#include "ThreadPool.hpp"
+#include "ThreadPriority.hpp"
+#include "Timeline.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned threadCount) : m_stopping(false) {
+  for (unsigned i = 0; i < threadCount; i++) {
+    m_threads.emplace_back(&ThreadPool::threadProc, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(m_mutex);
+    m_stopping = true;
+  }
+  m_cv.notify_all();
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+}
+
+std::shared_ptr<ThreadPool> ThreadPool::getInstance() {
+  // leave a core for the game
+  static std::shared_ptr<ThreadPool> instance = std::make_shared<ThreadPool>(
+    std::max(std::thread::hardware_concurrency(), 2u) - 1
+    );
+  return instance;
+}
+
+unsigned ThreadPool::getThreadCount() const {
+  return static_cast<unsigned>(m_threads.size());
+}
+
+void ThreadPool::threadProc() {
+  Timeline::setThreadName("pool worker");
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock lock(m_mutex);
+      m_cv.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+      if (m_tasks.empty()) {
+        return;
+      }
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    // per task, so turning placement on or off reaches the pool without restarting it
+    placeCurrentThread(ThreadRole::Worker);
+    task();
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef REPLAYBUFFER_THREADPOOL_HPP
+#define REPLAYBUFFER_THREADPOOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// fixed set of worker threads for the clip-time jobs that can be split up (chunked encodes, gop transcodes)
+class ThreadPool {
+  std::vector<std::thread> m_threads;
+  std::deque<std::function<void()>> m_tasks;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_stopping;
+
+  void threadProc();
+
+public:
+  explicit ThreadPool(unsigned threadCount);
+  ~ThreadPool();
+
+  static std::shared_ptr<ThreadPool> getInstance();
+
+  template<typename F>
+  std::future<std::invoke_result_t<F>> submit(F &&task);
+  unsigned getThreadCount() const;
+};
+
+template<typename F>
+std::future<std::invoke_result_t<F>> ThreadPool::submit(F &&task) {
+  using Result = std::invoke_result_t<F>;
+  auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+  std::future<Result> future = packaged->get_future();
+  {
+    std::lock_guard lock(m_mutex);
+    m_tasks.emplace_back([packaged] { (*packaged)(); });
+  }
+  m_cv.notify_one();
+  return future;
+}
+
+#endif
@@ -0,0 +1,191 @@
+#include "ThreadPriority.hpp"
+#include "CpuTopology.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#if defined(GEODE_IS_WINDOWS64)
+#include <Windows.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#else
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+
+static std::atomic<bool> g_placementEnabled = true;
+
+const ThreadPlacement &ThreadPlacement::get() {
+  static ThreadPlacement placement = [] {
+    const auto &topology = CpuTopology::get();
+    ThreadPlacement p;
+    p.gameProcessor = -1;
+
+    std::vector<const CpuTopology::Core *> fast, slow;
+    for (const auto &core : topology.cores) {
+      (core.efficiencyClass == topology.maxEfficiencyClass ? fast : slow).push_back(&core);
+    }
+    if (fast.size() < 2) {
+      return p;
+    }
+
+    // the game is most likely on the first fast core, the os favours it
+    const auto *game = fast.front();
+    p.gameProcessor = game->logical.front();
+    for (const auto *core : fast) {
+      if (core != game && (topology.l3Count == 1 || core->l3 != game->l3)) {
+        p.encode.insert(p.encode.end(), core->logical.begin(), core->logical.end());
+      }
+    }
+    if (p.encode.empty()) {
+      // a single l3 domain besides the game's isn't enough, settle for anything but the game's core
+      for (const auto *core : fast) {
+        if (core != game) {
+          p.encode.insert(p.encode.end(), core->logical.begin(), core->logical.end());
+        }
+      }
+    }
+    for (const auto *core : slow) {
+      p.background.insert(p.background.end(), core->logical.begin(), core->logical.end());
+    }
+    if (p.background.empty()) {
+      p.background = p.encode;
+    }
+    return p;
+  }();
+  return placement;
+}
+
+static const std::vector<int> *getProcessors(ThreadRole role) {
+  const auto &placement = ThreadPlacement::get();
+  return role == ThreadRole::Background ? &placement.background : &placement.encode;
+}
+
+#if defined(GEODE_IS_WINDOWS64)
+
+void placeCurrentThread(ThreadRole role, bool placed) {
+  HANDLE thread = GetCurrentThread();
+  const auto *processors = getProcessors(role);
+  DWORD_PTR mask = 0;
+  if (placed) {
+    for (int processor : *processors) {
+      mask |= static_cast<DWORD_PTR>(1) << processor;
+    }
+  }
+  if (mask == 0) {
+    DWORD_PTR systemMask;
+    GetProcessAffinityMask(GetCurrentProcess(), &mask, &systemMask);
+  }
+  SetThreadAffinityMask(thread, mask);
+
+  switch (role) {
+  case ThreadRole::Capture:
+    SetThreadPriority(thread, THREAD_PRIORITY_ABOVE_NORMAL);
+    break;
+  case ThreadRole::Encode:
+    SetThreadPriority(thread, THREAD_PRIORITY_NORMAL);
+    break;
+  case ThreadRole::Worker:
+    SetThreadPriority(thread, THREAD_PRIORITY_BELOW_NORMAL);
+    break;
+  case ThreadRole::Background:
+    SetThreadPriority(thread, THREAD_PRIORITY_LOWEST);
+    break;
+  }
+}
+
+void placeGameThread(bool placed) {
+  // only a hint, the game itself is never restricted
+  int processor = ThreadPlacement::get().gameProcessor;
+  if (placed && processor >= 0) {
+    SetThreadIdealProcessor(GetCurrentThread(), static_cast<DWORD>(processor));
+  } else {
+    SetThreadIdealProcessor(GetCurrentThread(), MAXIMUM_PROCESSORS);
+  }
+}
+
+#elif defined(__APPLE__)
+
+void placeCurrentThread(ThreadRole role, bool placed) {
+  // no affinity on darwin, the qos class decides between performance and efficiency cores
+  switch (role) {
+  case ThreadRole::Capture:
+    pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0);
+    break;
+  case ThreadRole::Encode:
+    pthread_set_qos_class_self_np(QOS_CLASS_USER_INITIATED, 0);
+    break;
+  case ThreadRole::Worker:
+    pthread_set_qos_class_self_np(placed ? QOS_CLASS_UTILITY : QOS_CLASS_USER_INITIATED, 0);
+    break;
+  case ThreadRole::Background:
+    pthread_set_qos_class_self_np(QOS_CLASS_BACKGROUND, 0);
+    break;
+  }
+}
+
+void placeGameThread(bool placed) {
+}
+
+#else
+
+void placeCurrentThread(ThreadRole role, bool placed) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  const auto *processors = getProcessors(role);
+  if (placed && !processors->empty()) {
+    for (int processor : *processors) {
+      CPU_SET(processor, &set);
+    }
+  } else {
+    for (int i = 0; i < static_cast<int>(std::thread::hardware_concurrency()); i++) {
+      CPU_SET(i, &set);
+    }
+  }
+  sched_setaffinity(0, sizeof(set), &set);
+
+  // on linux and android the calling thread has its own nice value, raising it needs privileges so capture
+  // stays at the default
+  switch (role) {
+  case ThreadRole::Capture:
+  case ThreadRole::Encode:
+    setpriority(PRIO_PROCESS, 0, 0);
+    break;
+  case ThreadRole::Worker:
+    setpriority(PRIO_PROCESS, 0, 5);
+    break;
+  case ThreadRole::Background:
+    setpriority(PRIO_PROCESS, 0, 10);
+    break;
+  }
+}
+
+void placeGameThread(bool placed) {
+}
+
+#endif
+
+void placeCurrentThread(ThreadRole role) {
+  placeCurrentThread(role, g_placementEnabled);
+}
+
+void placeGameThread() {
+  placeGameThread(g_placementEnabled);
+}
+
+void setThreadPlacementEnabled(bool enabled) {
+  g_placementEnabled = enabled;
+}
+
+bool isThreadPlacementEnabled() {
+  return g_placementEnabled;
+}
+
+int getEncodeThreadCount() {
+  const auto &encode = ThreadPlacement::get().encode;
+  if (!g_placementEnabled || encode.empty()) {
+    return 0; // the encoder picks
+  }
+  return static_cast<int>(encode.size());
+}
@@ -0,0 +1,37 @@
+#ifndef REPLAYBUFFER_THREADPRIORITY_HPP
+#define REPLAYBUFFER_THREADPRIORITY_HPP
+
+#include <vector>
+
+enum class ThreadRole {
+  Capture,    // the audio pump, short bursts that must never be late
+  Encode,     // live encoders and the recorder's lifecycle thread
+  Worker,     // thread pool jobs at clip time
+  Background, // thumbnails and compaction, only when nothing else wants the cpu
+};
+
+// which logical processors each role runs on. one fast core (with its smt sibling) is left to the game, the
+// encoders get the other fast cores, preferably behind a different l3 than the game's, and background work
+// goes to efficiency cores where there are any. empty means no pinning, like on a two core machine
+struct ThreadPlacement {
+  int gameProcessor;
+  std::vector<int> encode;
+  std::vector<int> background;
+
+  static const ThreadPlacement &get();
+};
+
+// pins the calling thread to its role's processors and sets its os priority. with placement turned off it
+// only gets the role's priority and may run anywhere
+void placeCurrentThread(ThreadRole role);
+// main thread: hints the scheduler to keep the game on the processor the other roles stay off
+void placeGameThread();
+// the same with placement given rather than the setting, for measuring one against the other
+void placeCurrentThread(ThreadRole role, bool placed);
+void placeGameThread(bool placed);
+void setThreadPlacementEnabled(bool enabled);
+bool isThreadPlacementEnabled();
+// what the software encoders' own thread pools are sized to
+int getEncodeThreadCount();
+
+#endif
@@ -0,0 +1,204 @@
+#include "ThumbnailCache.hpp"
+#include "ThreadPriority.hpp"
+#include "Timer.hpp"
+
+#include <algorithm>
+#include <ranges>
+
+ThumbnailCache::ThumbnailCache() : m_decCtx(nullptr), m_swsCtx(nullptr), m_frame(nullptr), m_running(false),
+                                   m_lastPts(AV_NOPTS_VALUE), m_firstUs(0), m_lastUs(0), m_decodeTimeUs(0),
+                                   m_decodedCount(0), m_texturesStale(false) {
+}
+
+ThumbnailCache::~ThumbnailCache() {
+  // no textures are freed here, the gl context may already be gone at exit
+  this->joinThread();
+  this->destroyDecoder();
+}
+
+void ThumbnailCache::start(std::shared_ptr<VideoEncoder> encoder) {
+  this->stop();
+  m_encoder = std::move(encoder);
+  this->initDecoder();
+  m_lastPts = AV_NOPTS_VALUE;
+  m_firstUs = 0;
+  m_lastUs = 0;
+  m_decodeTimeUs = 0;
+  m_decodedCount = 0;
+  m_running = true;
+  m_thread = std::thread(&ThumbnailCache::threadProc, this);
+}
+
+void ThumbnailCache::stop() {
+  this->joinThread();
+  this->destroyDecoder();
+  m_encoder.reset();
+  {
+    std::lock_guard lock(m_pendingMutex);
+    m_pending.clear();
+  }
+  m_texturesStale = true;
+}
+
+void ThumbnailCache::joinThread() {
+  {
+    std::lock_guard lock(m_wakeMutex);
+    m_running = false;
+  }
+  m_wakeCv.notify_all();
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+}
+
+void ThumbnailCache::initDecoder() {
+  const AVCodecContext *source = m_encoder->getCodecContext();
+  const AVCodec *decoder = avcodec_find_decoder(source->codec_id);
+  if (decoder == nullptr) {
+    throw fmt::format("no decoder available for {}", avcodec_get_name(source->codec_id));
+  }
+
+  m_decCtx = avcodec_alloc_context3(decoder);
+  AVCodecParameters *params = avcodec_parameters_alloc();
+  avcodec_parameters_from_context(params, source);
+  avcodec_parameters_to_context(m_decCtx, params);
+  avcodec_parameters_free(&params);
+  // a thumbnail doesn't need the deblocking and a single thread keeps it out of the encoders' way
+  m_decCtx->thread_count = 1;
+  m_decCtx->skip_loop_filter = AVDISCARD_ALL;
+
+  int ret = avcodec_open2(m_decCtx, decoder, nullptr);
+  if (ret < 0) {
+    avcodec_free_context(&m_decCtx);
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not open decoder, error: {}", errStr);
+  }
+
+  m_frame = av_frame_alloc();
+}
+
+void ThumbnailCache::destroyDecoder() {
+  if (m_frame != nullptr) {
+    av_frame_free(&m_frame);
+  }
+  if (m_swsCtx != nullptr) {
+    sws_free_context(&m_swsCtx);
+  }
+  if (m_decCtx != nullptr) {
+    avcodec_free_context(&m_decCtx);
+  }
+}
+
+void ThumbnailCache::threadProc() {
+  placeCurrentThread(ThreadRole::Background);
+  AVRational timeBase = m_encoder->getCodecContext()->time_base;
+  while (m_running) {
+    auto [first, last] = m_encoder->getPtsRange();
+    if (first != AV_NOPTS_VALUE) {
+      m_firstUs = av_rescale_q(first, timeBase, { 1, 1000000 });
+      m_lastUs = av_rescale_q(last, timeBase, { 1, 1000000 });
+    }
+
+    for (AVPacket *keyframe : m_encoder->cloneKeyframes(m_lastPts)) {
+      if (m_running) {
+        this->decodeThumbnail(keyframe);
+      }
+      m_lastPts = std::max(m_lastPts, keyframe->pts);
+      av_packet_free(&keyframe);
+    }
+
+    std::unique_lock lock(m_wakeMutex);
+    m_wakeCv.wait_for(lock, kRefreshInterval, [this] { return !m_running; });
+  }
+}
+
+void ThumbnailCache::decodeThumbnail(const AVPacket *keyframe) {
+  Timer timer;
+  timer.start();
+
+  avcodec_flush_buffers(m_decCtx);
+  if (avcodec_send_packet(m_decCtx, keyframe) < 0) {
+    return;
+  }
+  avcodec_send_packet(m_decCtx, nullptr);
+  if (avcodec_receive_frame(m_decCtx, m_frame) < 0) {
+    return;
+  }
+
+  m_swsCtx = sws_getCachedContext(
+    m_swsCtx,
+    m_frame->width,
+    m_frame->height,
+    static_cast<AVPixelFormat>(m_frame->format),
+    kWidth,
+    kHeight,
+    AV_PIX_FMT_RGBA,
+    SWS_AREA,
+    nullptr,
+    nullptr,
+    nullptr
+    );
+
+  Pending thumbnail;
+  thumbnail.ptsUs = av_rescale_q(keyframe->pts, m_encoder->getCodecContext()->time_base, { 1, 1000000 });
+  thumbnail.pixels.resize(kWidth * kHeight * 4);
+  uint8_t *dst[] = { thumbnail.pixels.data() };
+  int dstStride[] = { kWidth * 4 };
+  sws_scale(m_swsCtx, m_frame->data, m_frame->linesize, 0, m_frame->height, dst, dstStride);
+  av_frame_unref(m_frame);
+
+  {
+    std::lock_guard lock(m_pendingMutex);
+    m_pending.push_back(std::move(thumbnail));
+  }
+  m_decodeTimeUs += timer.stop();
+  m_decodedCount++;
+}
+
+void ThumbnailCache::updateTextures() {
+  if (m_texturesStale.exchange(false)) {
+    for (auto &texture : m_textures | std::views::values) {
+      glDeleteTextures(1, &texture);
+    }
+    m_textures.clear();
+  }
+
+  std::deque<Pending> pending;
+  {
+    std::lock_guard lock(m_pendingMutex);
+    pending.swap(m_pending);
+  }
+
+  for (const auto &thumbnail : pending) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, kWidth, kHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, thumbnail.pixels.data());
+    m_textures.emplace_back(thumbnail.ptsUs, texture);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  // gops that were trimmed off the front of the buffer
+  while (!m_textures.empty() && m_textures.front().first < m_firstUs) {
+    glDeleteTextures(1, &m_textures.front().second);
+    m_textures.pop_front();
+  }
+}
+
+const std::deque<std::pair<int64_t, GLuint>> &ThumbnailCache::getTextures() const {
+  return m_textures;
+}
+
+std::pair<int64_t, int64_t> ThumbnailCache::getRangeUs() const {
+  return { m_firstUs, m_lastUs };
+}
+
+double ThumbnailCache::getAverageDecodeTime() const {
+  if (m_decodedCount == 0) {
+    return 0.0;
+  }
+  return static_cast<double>(m_decodeTimeUs) / static_cast<double>(m_decodedCount);
+}
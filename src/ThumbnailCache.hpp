@@ -0,0 +1,67 @@
+#ifndef REPLAYBUFFER_THUMBNAILCACHE_HPP
+#define REPLAYBUFFER_THUMBNAILCACHE_HPP
+
+#include "VideoEncoder.hpp"
+#include <Geode/cocos/platform/CCGL.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// keeps one small picture per gop of the video buffer for the clip timeline. only keyframes get decoded, on a
+// low priority thread, and only the ones that arrived since the last pass, so the cost stays at one intra
+// frame decode per gop. textures are created and dropped on the main thread in updateTextures, stop only
+// marks them stale so it can be called from the recorder's lifecycle thread
+class ThumbnailCache {
+  struct Pending {
+    int64_t ptsUs;
+    std::vector<uint8_t> pixels;
+  };
+
+  std::shared_ptr<VideoEncoder> m_encoder;
+  AVCodecContext *m_decCtx;
+  SwsContext *m_swsCtx;
+  AVFrame *m_frame;
+  std::thread m_thread;
+  std::atomic<bool> m_running;
+  std::mutex m_wakeMutex;
+  std::condition_variable m_wakeCv;
+  int64_t m_lastPts;
+  std::mutex m_pendingMutex;
+  std::deque<Pending> m_pending;
+  std::atomic<int64_t> m_firstUs, m_lastUs;
+  std::atomic<int64_t> m_decodeTimeUs, m_decodedCount;
+  std::deque<std::pair<int64_t, GLuint>> m_textures;
+  std::atomic<bool> m_texturesStale;
+
+  void threadProc();
+  void decodeThumbnail(const AVPacket *keyframe);
+  void initDecoder();
+  void destroyDecoder();
+  void joinThread();
+
+public:
+  static constexpr int kWidth = 96;
+  static constexpr int kHeight = 54;
+  static constexpr auto kRefreshInterval = std::chrono::milliseconds(500);
+
+  ThumbnailCache();
+  ~ThumbnailCache();
+
+  void start(std::shared_ptr<VideoEncoder> encoder);
+  void stop();
+
+  // main thread only
+  void updateTextures();
+  const std::deque<std::pair<int64_t, GLuint>> &getTextures() const;
+
+  // capture clock time covered by the video buffer
+  std::pair<int64_t, int64_t> getRangeUs() const;
+  double getAverageDecodeTime() const;
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "Timeline.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fmt/format.h>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+std::atomic<bool> Timeline::s_enabled = false;
+
+namespace {
+  struct Event {
+    std::atomic<const char *> name;
+    std::atomic<int64_t> beginUs;
+    std::atomic<int64_t> endUs;
+  };
+
+  // one writer, its own thread. a reader takes the head before and after copying and throws away whatever the
+  // writer may have lapped in between
+  struct ThreadRing {
+    int id;
+    std::atomic<const char *> name;
+    std::atomic<uint64_t> head{ 0 };
+    std::atomic<uint64_t> tail{ 0 }; // clear() moves this up instead of touching the events
+    std::atomic<bool> exited{ false };
+    std::array<Event, Timeline::kCapacity> events;
+  };
+
+  std::mutex g_ringsMutex;
+  std::vector<std::shared_ptr<ThreadRing>> g_rings;
+  int g_nextThreadId = 1;
+
+  struct ThreadSlot {
+    std::shared_ptr<ThreadRing> ring;
+    const char *name = nullptr;
+
+    ~ThreadSlot() {
+      // kept until a dump has written out what the thread did, or the next clear
+      if (ring) {
+        ring->exited = true;
+      }
+    }
+  };
+
+  thread_local ThreadSlot t_slot;
+
+  // with the head at this, the slot the writer may be filling right now is the oldest one's
+  uint64_t oldestIntact(uint64_t head) {
+    return head >= Timeline::kCapacity ? head - Timeline::kCapacity + 1 : 0;
+  }
+
+  ThreadRing &getThreadRing() {
+    if (!t_slot.ring) {
+      // only the first marker on a thread takes the lock
+      auto ring = std::make_shared<ThreadRing>();
+      ring->name = t_slot.name;
+      std::lock_guard lock(g_ringsMutex);
+      ring->id = g_nextThreadId++;
+      g_rings.push_back(ring);
+      t_slot.ring = std::move(ring);
+    }
+    return *t_slot.ring;
+  }
+}
+
+Timeline::Scope::Scope(const char *name) : m_name(nullptr), m_beginUs(0) {
+  if (Timeline::isEnabled()) {
+    m_name = name;
+    m_beginUs = Timeline::now();
+  }
+}
+
+Timeline::Scope::~Scope() {
+  if (m_name != nullptr) {
+    Timeline::record(m_name, m_beginUs, Timeline::now());
+  }
+}
+
+void Timeline::setEnabled(bool enabled) {
+  // every time it's switched on is a new timeline
+  if (enabled && !s_enabled) {
+    Timeline::clear();
+  }
+  s_enabled = enabled;
+}
+
+void Timeline::setThreadName(const char *name) {
+  t_slot.name = name;
+  if (t_slot.ring) {
+    t_slot.ring->name = name;
+  }
+}
+
+int64_t Timeline::now() {
+  static const auto epoch = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Timeline::record(const char *name, int64_t beginUs, int64_t endUs) {
+  ThreadRing &ring = getThreadRing();
+  uint64_t head = ring.head.load(std::memory_order_relaxed);
+  Event &event = ring.events[head % kCapacity];
+  event.name.store(name, std::memory_order_relaxed);
+  event.beginUs.store(beginUs, std::memory_order_relaxed);
+  event.endUs.store(endUs, std::memory_order_relaxed);
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+size_t Timeline::dump(const std::filesystem::path &path) {
+  std::vector<std::shared_ptr<ThreadRing>> rings;
+  {
+    std::lock_guard lock(g_ringsMutex);
+    rings = g_rings;
+  }
+
+  std::ofstream file(path, std::ios::trunc);
+  if (!file) {
+    throw fmt::format("could not open {} for writing", path.string());
+  }
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  size_t written = 0;
+  auto separator = [&written] { return written++ == 0 ? "\n" : ",\n"; };
+  // a ring that had exited before it was read has nothing left to add once it's in the file
+  std::vector<std::shared_ptr<ThreadRing>> finished;
+  for (const auto &ring : rings) {
+    if (ring->exited.load()) {
+      finished.push_back(ring);
+    }
+    const char *name = ring->name.load();
+    file << separator() << fmt::format(R"({{"name":"thread_name","ph":"M","pid":1,"tid":{},"args":{{"name":"{}"}}}})",
+                                       ring->id, name != nullptr ? name : fmt::format("thread {}", ring->id));
+
+    std::vector<std::tuple<const char *, int64_t, int64_t>> events;
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t first = std::max(ring->tail.load(), oldestIntact(head));
+    for (uint64_t i = first; i < head; i++) {
+      const Event &event = ring->events[i % kCapacity];
+      events.emplace_back(event.name.load(std::memory_order_relaxed), event.beginUs.load(std::memory_order_relaxed),
+                          event.endUs.load(std::memory_order_relaxed));
+    }
+    // the writer may have come round again while they were copied, those slots hold newer markers now
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t lapped = oldestIntact(ring->head.load(std::memory_order_relaxed));
+    for (size_t i = lapped > first ? static_cast<size_t>(lapped - first) : 0; i < events.size(); i++) {
+      const auto &[eventName, beginUs, endUs] = events[i];
+      file << separator() << fmt::format(R"({{"name":"{}","ph":"X","pid":1,"tid":{},"ts":{},"dur":{}}})",
+                                         eventName, ring->id, beginUs, endUs - beginUs);
+    }
+  }
+  file << "\n]}\n";
+  file.close();
+  if (!file) {
+    throw fmt::format("could not write to {}", path.string());
+  }
+
+  std::lock_guard lock(g_ringsMutex);
+  std::erase_if(g_rings, [&finished](const std::shared_ptr<ThreadRing> &ring) {
+    return std::ranges::find(finished, ring) != finished.end();
+  });
+  return written - rings.size();
+}
+
+void Timeline::clear() {
+  std::lock_guard lock(g_ringsMutex);
+  std::erase_if(g_rings, [](const std::shared_ptr<ThreadRing> &ring) { return ring->exited.load(); });
+  for (const auto &ring : g_rings) {
+    ring->tail = ring->head.load();
+  }
+}
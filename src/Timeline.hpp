@@ -0,0 +1,46 @@
+#ifndef REPLAYBUFFER_TIMELINE_HPP
+#define REPLAYBUFFER_TIMELINE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+
+// scoped markers around the work the recorder's threads do, dumped as a chrome trace event file that
+// chrome://tracing and perfetto open as a timeline. every thread writes into a ring of its own that nobody else
+// writes to, so recording takes no locks, and while it's off a marker is one relaxed load. a thread's ring holds
+// its newest kCapacity markers, older ones are overwritten
+class Timeline {
+public:
+  static constexpr size_t kCapacity = 16384;
+
+  // marks from construction to destruction. the name has to outlive the dump, a string literal
+  class Scope {
+    const char *m_name;
+    int64_t m_beginUs;
+
+  public:
+    explicit Scope(const char *name);
+    ~Scope();
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+  };
+
+  static void setEnabled(bool enabled);
+  static bool isEnabled() {
+    return s_enabled.load(std::memory_order_relaxed);
+  }
+  // what the calling thread is called in the dump, a string literal. unnamed threads are numbered
+  static void setThreadName(const char *name);
+  // writes every thread's ring out, recording can carry on meanwhile. throws a std::string
+  static size_t dump(const std::filesystem::path &path);
+  // forgets every marker recorded so far
+  static void clear();
+
+private:
+  static std::atomic<bool> s_enabled;
+
+  static int64_t now();
+  static void record(const char *name, int64_t beginUs, int64_t endUs);
+};
+
+#endif
@@ -23,13 +23,12 @@ Timer::Timer() {
 }
 
 void Timer::start() {
-  this->begin = std::chrono::high_resolution_clock::now();
+  this->begin = std::chrono::steady_clock::now();
 }
 
 int64_t Timer::stop() const {
-  auto end = std::chrono::high_resolution_clock::now();
-  std::chrono::duration<int64_t, std::micro> duration_ms = end - this->begin;
-  return duration_ms.count();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(end - this->begin).count();
 }
 
 #endif
\ No newline at end of file
@@ -1,6 +1,9 @@
 #ifndef REPLAYBUFFER_TIMER_HPP
 #define REPLAYBUFFER_TIMER_HPP
 
+#include <chrono>
+#include <cstdint>
+
 #if defined(GEODE_IS_WINDOWS64)
 
 #include <Windows.h>
@@ -17,7 +20,7 @@ struct Timer {
 #else
 
 struct Timer {
-  std::chrono::high_resolution_clock begin;
+  std::chrono::steady_clock::time_point begin;
 
   Timer();
   void start();
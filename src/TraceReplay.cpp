@@ -0,0 +1,139 @@
+#include "TraceReplay.hpp"
+#include "AudioEncoder.hpp"
+#include "CaptureTrace.hpp"
+#include "ReplayBuffer.hpp"
+#include "Timer.hpp"
+#include "VideoEncoder.hpp"
+#include "VideoSource.hpp"
+
+#include <algorithm>
+#include <fmt/format.h>
+#include <ranges>
+#include <thread>
+
+TraceReplay::Result TraceReplay::run(const std::filesystem::path &path, const Options &options) {
+  CaptureTrace::Summary summary = CaptureTrace::scan(path);
+  if (summary.videoFrames == 0) {
+    throw std::string("the trace has no frames in it");
+  }
+
+  // video is stream 0 and the audio streams keep the indices they were recorded under, which are never 0
+  ReplayBuffer buffer;
+  auto clock = buffer.getClock();
+  auto source = std::make_shared<VideoSource>();
+  source->setClock(clock);
+  source->setSize(summary.width, summary.height);
+  source->setCropPreset(0);
+  source->reset();
+
+  buffer.addStream<VideoEncoder>(0);
+  auto videoEncoder = std::dynamic_pointer_cast<VideoEncoder>(buffer.getStreamEncoder(0));
+  videoEncoder->setSource(source);
+  videoEncoder->setKeyframePolicy({ options.keyframeInterval, options.sceneChange });
+  videoEncoder->setRateControlPolicy(options.rateControl);
+  videoEncoder->setSoftwareCodec(options.softwareCodec);
+  videoEncoder->setDstResolution(options.width > 0 ? options.width : summary.width,
+                                 options.height > 0 ? options.height : summary.height);
+  videoEncoder->setDstFramerate(options.framerate);
+  videoEncoder->setDstBitrate(options.bitrate);
+  videoEncoder->setUsingGPU(options.hwAccel);
+
+  std::vector<std::shared_ptr<AudioEncoder>> audioEncoders;
+  for (const auto &[idx, stream] : summary.audioStreams) {
+    buffer.addStream<AudioEncoder>(idx);
+    auto audioEncoder = std::dynamic_pointer_cast<AudioEncoder>(buffer.getStreamEncoder(idx));
+    audioEncoder->setReplayFormat(stream.channels, stream.sampleRate);
+    audioEncoder->setMixer(nullptr, -1);
+    audioEncoder->setDeferred(false);
+    audioEncoder->setEncodingEnabled(true);
+    audioEncoders.push_back(audioEncoder);
+  }
+
+  buffer.setDuration(options.length);
+  for (const auto &encoder : buffer.getEncoders() | std::views::values) {
+    encoder->init();
+  }
+
+  // the trace's own timeline, starting over at 0 like a session does
+  bool lockstep = options.pace == Pace::Lockstep;
+  buffer.resetClock();
+  clock->setManualTime(lockstep ? 0 : -1);
+  // a running encoder has to be stopped and joined before it's destroyed, on the way out of a throw as well
+  auto stopEncoders = [&buffer, &clock] {
+    buffer.stop();
+    for (const auto &encoder : buffer.getEncoders() | std::views::values) {
+      encoder->joinThread();
+    }
+    clock->setManualTime(-1);
+  };
+
+  Result result{};
+  int width = summary.width, height = summary.height;
+  int64_t clockTime = 0;
+  Timer wallTimer;
+  CaptureTrace::Reader reader;
+  CaptureTrace::Record record;
+  bool stalled = false;
+  try {
+    for (const auto &encoder : buffer.getEncoders() | std::views::values) {
+      encoder->start();
+    }
+    wallTimer.start();
+    reader.open(path);
+    while (!stalled && reader.next(record)) {
+      int64_t time = std::max(record.timeUs - summary.startUs, static_cast<int64_t>(0));
+      if (!lockstep) {
+        while (clock->now() < time) {
+          std::this_thread::sleep_for(std::chrono::microseconds(std::min(time - clock->now(), static_cast<int64_t>(1000))));
+        }
+      }
+
+      if (record.type == CaptureTrace::RecordType::Audio) {
+        auto encoder = std::dynamic_pointer_cast<AudioEncoder>(buffer.getStreamEncoder(record.stream));
+        int frames = static_cast<int>(record.size / (sizeof(int16_t) * record.channels));
+        encoder->feed(reinterpret_cast<const int16_t *>(record.data), frames, time);
+        result.audioChunks++;
+      } else {
+        if (record.width != width || record.height != height) {
+          // the crop changed while it was recorded, the encoder letterboxes it like it did then
+          width = record.width;
+          height = record.height;
+          source->setSize(width, height);
+        }
+        source->push(record.data, time);
+        result.videoFrames++;
+      }
+
+      if (lockstep && time > clockTime) {
+        // the frame goes in before the clock moves, so the encoder never sees the new time with the old frame
+        clockTime = time;
+        clock->setManualTime(clockTime);
+        stalled = !videoEncoder->waitCaughtUp(clockTime, kCaughtUpTimeout);
+      }
+    }
+  } catch (...) {
+    stopEncoders();
+    throw;
+  }
+  result.wallUs = wallTimer.stop();
+  result.traceUs = summary.endUs - summary.startUs;
+
+  stopEncoders();
+  if (stalled) {
+    throw fmt::format("the video encoder stopped taking frames {:.1f} s into the trace", clockTime / 1000000.0);
+  }
+
+  result.conversionUs = source->getAverageConversionTime();
+  for (const auto &audioEncoder : audioEncoders) {
+    result.audioEncodeCost += audioEncoder->getEncodeCost();
+  }
+  for (const auto &encoder : buffer.getEncoders() | std::views::values) {
+    auto packets = encoder->snapshotPackets();
+    result.packets += packets.size();
+    for (AVPacket *pkt : packets) {
+      result.bytes += pkt->size;
+      av_packet_free(&pkt);
+    }
+  }
+  return result;
+}
@@ -0,0 +1,49 @@
+#ifndef REPLAYBUFFER_TRACEREPLAY_HPP
+#define REPLAYBUFFER_TRACEREPLAY_HPP
+
+#include "VideoEncoder.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// pushes a capture trace back through a VideoSource, VideoEncoder and AudioEncoders of its own, without the game
+// or fmod in the loop. in lockstep the capture clock only moves when the trace does and every record waits for
+// the video encoder to catch up, so the same trace always makes the same frames and the run goes as fast as the
+// encoders can. real time plays the records at the pace they were captured at against a running clock, which is
+// what recording costs. nothing is mixed or deferred, every audio stream is encoded on its own
+class TraceReplay {
+public:
+  enum class Pace { Lockstep, RealTime };
+  // how long lockstep waits for the encoder to take a frame before it gives the run up
+  static constexpr auto kCaughtUpTimeout = std::chrono::seconds(5);
+
+  struct Options {
+    Pace pace = Pace::Lockstep;
+    int width = 0, height = 0; // 0 encodes at the trace's size
+    int framerate = 60;
+    int bitrate = 0;
+    VideoEncoder::RateControlPolicy rateControl;
+    int softwareCodec = 0;
+    bool hwAccel = false;
+    double keyframeInterval = 1.0;
+    bool sceneChange = true;
+    int length = 30; // seconds buffered, the trims cost something too
+  };
+
+  struct Result {
+    size_t videoFrames;  // readbacks in the trace
+    size_t audioChunks;
+    int64_t traceUs;     // how long the trace covers
+    int64_t wallUs;      // how long pushing it through took
+    double conversionUs; // per readback
+    double audioEncodeCost; // microseconds per second of audio, summed over the streams
+    size_t packets;
+    size_t bytes;
+  };
+
+  // blocking, run it off the main thread. throws a std::string
+  static Result run(const std::filesystem::path &path, const Options &options);
+};
+
+#endif
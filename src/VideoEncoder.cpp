@@ -1,21 +1,44 @@
 #include "VideoEncoder.hpp"
+#include "ThreadPriority.hpp"
+#include "Timeline.hpp"
+#include "Timer.hpp"
 
-VideoEncoder::VideoEncoder() : m_hwDeviceCtx(nullptr), m_swsCtx(nullptr), m_srcWidth(0), m_srcHeight(0), m_dstWidth(0),
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+VideoEncoder::VideoEncoder() : m_hwDeviceCtx(nullptr), m_swsCtx(nullptr), m_dstWidth(0),
                                m_dstHeight(0),
                                m_dstFramerate(0),
                                m_isUsingGPU(false),
-                               m_lastFrameTime(0),
-                               m_timeBaseUs(0),
-                               m_dstBitrate(0) {
-  m_pixelBufferManager = std::make_unique<PixelBufferManager>();
+                               m_softwareCodec(0),
+                               m_dstBitrate(0),
+                               m_keyframeRequested(false),
+                               m_keyframeStatsTime(0),
+                               m_caughtUpTime(-1),
+                               m_freeFrames(kPipelineFrames),
+                               m_convertedFrames(kPipelineFrames),
+                               m_encodedPackets(kPacketQueueDepth),
+                               m_convertUs(0),
+                               m_encodeUs(0),
+                               m_sinkUs(0),
+                               m_convertedFrameCount(0),
+                               m_encodedFrameCount(0),
+                               m_sunkPacketCount(0),
+                               m_duplicatedFrameCount(0) {
+  m_sourceFrame = av_frame_alloc();
 }
 
 VideoEncoder::~VideoEncoder() {
   this->VideoEncoder::destroy();
+  av_frame_free(&m_sourceFrame);
 }
 
 void VideoEncoder::init() {
-  this->initSwsContext();
   this->initCodecContext();
 }
 
@@ -31,23 +54,61 @@ void VideoEncoder::destroy() {
   }
 }
 
+void VideoEncoder::reset() {
+  // flushing keeps the codec session and the hardware device open, which is most of what init costs
+  if (m_codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH) {
+    avcodec_flush_buffers(m_codecCtx);
+  } else {
+    this->destroyCodecContext();
+    this->initCodecContext();
+  }
+}
+
 void VideoEncoder::start() {
+  m_keyframeRequested = false;
+  {
+    std::lock_guard lock(m_markerMutex);
+    m_markers.clear();
+    m_keyframeStats = {};
+    m_keyframeStatsTime = 0;
+  }
+  m_caughtUpTime = -1;
+  m_freeFrames.reset(m_pipelineFrames.size());
+  for (PipelineFrame &pipelineFrame : m_pipelineFrames) {
+    m_freeFrames.push(&pipelineFrame);
+  }
+  m_convertedFrames.reset(kPipelineFrames);
+  m_encodedPackets.reset(kPacketQueueDepth);
+  m_convertUs = m_encodeUs = m_sinkUs = 0;
+  m_convertedFrameCount = m_encodedFrameCount = m_sunkPacketCount = m_duplicatedFrameCount = 0;
   BaseEncoder::start();
-  m_lastFrameTime = m_startTime;
+  m_encodeThread = std::thread([this] {
+    placeCurrentThread(ThreadRole::Encode);
+    this->encodeProc();
+  });
+  m_sinkThread = std::thread([this] {
+    placeCurrentThread(ThreadRole::Encode);
+    this->sinkProc();
+  });
 }
 
 void VideoEncoder::stop() {
   BaseEncoder::stop();
 }
 
-void VideoEncoder::update() {
-  if (m_running) {
-    int64_t currentTime = m_timer.stop();
-    if (currentTime - m_lastFrameTime >= m_timeBaseUs) {
-      m_lastFrameTime = currentTime;
-      m_pixelBufferManager->captureFrame();
-    }
+void VideoEncoder::joinThread() {
+  // conversion stops first and closes its queue, each stage after it drains what it was handed and closes its own
+  BaseEncoder::joinThread();
+  if (m_encodeThread.joinable()) {
+    m_encodeThread.join();
   }
+  if (m_sinkThread.joinable()) {
+    m_sinkThread.join();
+  }
+}
+
+void VideoEncoder::update() {
+  // the shared source does the readback, see Recorder::update
 }
 
 bool VideoEncoder::isVideo() {
@@ -78,59 +139,213 @@ const AVCodec *VideoEncoder::detectCodec() {
   }
 
   m_isUsingGPU = false;
-  return avcodec_find_encoder_by_name("libx264");
+  const AVCodec *codec = avcodec_find_encoder_by_name(kSoftwareCodecs[m_softwareCodec].encoder);
+  if (codec == nullptr) {
+    // not every build comes with every encoder
+    m_softwareCodec = 0;
+    codec = avcodec_find_encoder_by_name(kSoftwareCodecs[0].encoder);
+  }
+  return codec;
 }
 
 void VideoEncoder::threadProc() {
-  int64_t pts = 0;
+  Timeline::setThreadName("video convert");
+  // frames sit on the capture clock's grid, so pts n is always n frame durations after the session started
+  AVRational usTimeBase = { 1, 1000000 };
+  int64_t pts = av_rescale_q_rnd(m_clock->now(), usTimeBase, m_codecCtx->time_base, AV_ROUND_UP);
+  // a flushed encoder carries on with its gop, so the buffer has to be started on a keyframe explicitly
+  bool firstFrame = true;
+  while (m_running) {
+    int64_t currentTime = m_clock->now();
+    if (m_source->getFrameTime() < 0) {
+      // nothing read back yet, don't fill the start of the buffer with blank frames
+      pts = av_rescale_q_rnd(currentTime, usTimeBase, m_codecCtx->time_base, AV_ROUND_UP);
+      this->setCaughtUpTime(currentTime);
+      std::this_thread::yield();
+      continue;
+    }
+    if (currentTime < av_rescale_q(pts, m_codecCtx->time_base, usTimeBase)) {
+      this->setCaughtUpTime(currentTime);
+      std::this_thread::yield();
+      continue;
+    }
 
-  uint8_t *swsInBuffer[] = { m_pixelBufferManager->getCurrentFrame() };
-  int stride[] = { m_srcWidth * 4 };
-  swsInBuffer[0] += static_cast<size_t>(m_srcHeight - 1) * stride[0];
-  stride[0] *= -1;
+    // waits here while every frame of the pool is queued or in the codec
+    PipelineFrame *target;
+    if (!m_freeFrames.pop(target)) {
+      break; // the encode stage failed
+    }
+    Timer timer;
+    timer.start();
+    if (!this->scaleSourceFrame(*target)) {
+      m_freeFrames.push(target);
+      std::this_thread::yield();
+      continue;
+    }
 
-  int64_t lastFrameTime = m_timer.stop();
-  while (m_running) {
-    int64_t currentTime = m_timer.stop();
-    while (currentTime - lastFrameTime >= m_timeBaseUs) {
-      lastFrameTime += m_timeBaseUs;
-
-      av_frame_make_writable(m_frame);
-      sws_scale(m_swsCtx, swsInBuffer, stride, 0, m_srcHeight, m_frame->data, m_frame->linesize);
-      m_frame->pts = pts++;
-
-      int ret = avcodec_send_frame(m_codecCtx, m_frame);
-      if (ret < 0) {
-        m_running = false;
-        break;
+    FrameJob job{ target, pts, 0, false };
+    while (currentTime >= av_rescale_q(pts, m_codecCtx->time_base, usTimeBase)) {
+      pts++;
+      job.count++;
+    }
+    bool requested = m_keyframeRequested.exchange(false);
+    job.keyframe = firstFrame || requested;
+    firstFrame = false;
+    if (requested) {
+      std::lock_guard lock(m_markerMutex);
+      m_markers.push_back(av_rescale_q(job.pts, m_codecCtx->time_base, usTimeBase));
+    }
+    m_convertUs += timer.stop();
+    m_convertedFrameCount++;
+    m_duplicatedFrameCount += job.count - 1;
+
+    if (!m_convertedFrames.push(job)) {
+      break;
+    }
+    this->setCaughtUpTime(currentTime);
+    std::this_thread::yield();
+  }
+  m_convertedFrames.close();
+  // stopped or failed, nobody should wait for this one any more
+  this->setCaughtUpTime(std::numeric_limits<int64_t>::max());
+}
+
+void VideoEncoder::encodeProc() {
+  Timeline::setThreadName("video encode");
+  FrameJob job;
+  while (m_convertedFrames.pop(job)) {
+    Timer timer;
+    timer.start();
+    AVFrame *frame = job.frame->frame;
+    bool failed = false;
+    for (int i = 0; i < job.count && !failed; i++) {
+      frame->pts = job.pts + i;
+      frame->pict_type = i == 0 && job.keyframe ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+
+      int ret;
+      {
+        Timeline::Scope scope("video send_frame");
+        ret = avcodec_send_frame(m_codecCtx, frame);
       }
+      failed = ret < 0;
 
       while (ret >= 0) {
-        ret = avcodec_receive_packet(m_codecCtx, m_packet);
+        {
+          Timeline::Scope scope("video receive_packet");
+          ret = avcodec_receive_packet(m_codecCtx, m_packet);
+        }
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
           break;
         }
 
-        this->pushPacket(m_packet);
+        // waits here while the sink is behind
+        AVPacket *pkt = av_packet_alloc();
+        av_packet_move_ref(pkt, m_packet);
+        if (!m_encodedPackets.push(pkt)) {
+          av_packet_free(&pkt);
+        }
       }
     }
-    std::this_thread::yield();
+    // the codec has its own reference by now, letting go lets the source convert into the same buffer again
+    if (job.frame->borrowed) {
+      av_frame_unref(frame);
+    }
+    m_freeFrames.push(job.frame);
+    m_encodeUs += timer.stop();
+    m_encodedFrameCount++;
+
+    if (failed) {
+      // the conversion stage may be waiting on either queue
+      m_running = false;
+      m_freeFrames.close();
+      m_convertedFrames.close();
+      break;
+    }
+  }
+  m_encodedPackets.close();
+}
+
+void VideoEncoder::sinkProc() {
+  Timeline::setThreadName("video sink");
+  AVPacket *pkt;
+  while (m_encodedPackets.pop(pkt)) {
+    Timer timer;
+    timer.start();
+    this->pushPacket(pkt);
+    av_packet_free(&pkt);
+    m_sinkUs += timer.stop();
+    m_sunkPacketCount++;
   }
 }
 
-void VideoEncoder::initSwsContext() {
-  this->m_swsCtx = sws_getContext(
-    m_srcWidth,
-    m_srcHeight,
-    AV_PIX_FMT_RGBA,
-    m_dstWidth,
-    m_dstHeight,
-    AV_PIX_FMT_YUV420P,
-    SWS_FAST_BILINEAR,
-    nullptr,
-    nullptr,
-    nullptr
-    );
+bool VideoEncoder::scaleSourceFrame(PipelineFrame &target) {
+  if (!m_source->acquire(m_sourceFrame)) {
+    return false;
+  }
+  int srcWidth = m_sourceFrame->width;
+  int srcHeight = m_sourceFrame->height;
+  if (srcWidth == m_dstWidth && srcHeight == m_dstHeight) {
+    // nothing to scale, the source's frame goes to the codec as it is
+    av_frame_unref(target.frame);
+    av_frame_move_ref(target.frame, m_sourceFrame);
+    target.borrowed = true;
+    return true;
+  }
+
+  // a crop that changed while recording can have another aspect ratio than the stream, letterbox it instead of
+  // stretching it
+  int fitWidth = m_dstWidth;
+  int fitHeight = m_dstHeight;
+  if (static_cast<int64_t>(srcWidth) * m_dstHeight > static_cast<int64_t>(srcHeight) * m_dstWidth) {
+    fitHeight = static_cast<int>(static_cast<int64_t>(m_dstWidth) * srcHeight / srcWidth) & ~1;
+  } else {
+    fitWidth = static_cast<int>(static_cast<int64_t>(m_dstHeight) * srcWidth / srcHeight) & ~1;
+  }
+  if (m_dstWidth - fitWidth <= 2 && m_dstHeight - fitHeight <= 2) {
+    fitWidth = m_dstWidth;
+    fitHeight = m_dstHeight;
+  }
+
+  m_swsCtx = sws_getCachedContext(m_swsCtx, srcWidth, srcHeight, AV_PIX_FMT_YUV420P, fitWidth, fitHeight,
+                                  AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+  if (m_swsCtx == nullptr) {
+    av_frame_unref(m_sourceFrame);
+    return false;
+  }
+  AVFrame *frame = target.frame;
+  if (target.borrowed || frame->buf[0] == nullptr) {
+    // it last went out as the source's frame, it needs a buffer of its own again
+    av_frame_unref(frame);
+    frame->width = m_dstWidth;
+    frame->height = m_dstHeight;
+    frame->format = AV_PIX_FMT_YUV420P;
+    target.borrowed = false;
+    target.fitWidth = target.fitHeight = 0;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+      av_frame_unref(m_sourceFrame);
+      return false;
+    }
+  } else {
+    av_frame_make_writable(frame);
+  }
+  if (fitWidth != target.fitWidth || fitHeight != target.fitHeight) {
+    // the bars are only painted when they move, make_writable carries them over into a new buffer
+    ptrdiff_t linesize[4] = { frame->linesize[0], frame->linesize[1], frame->linesize[2], 0 };
+    av_image_fill_black(frame->data, linesize, AV_PIX_FMT_YUV420P, AVCOL_RANGE_MPEG, m_dstWidth, m_dstHeight);
+    target.fitWidth = fitWidth;
+    target.fitHeight = fitHeight;
+  }
+  int offsetX = ((m_dstWidth - fitWidth) / 2) & ~1;
+  int offsetY = ((m_dstHeight - fitHeight) / 2) & ~1;
+  uint8_t *dst[] = {
+    frame->data[0] + static_cast<ptrdiff_t>(offsetY) * frame->linesize[0] + offsetX,
+    frame->data[1] + static_cast<ptrdiff_t>(offsetY / 2) * frame->linesize[1] + offsetX / 2,
+    frame->data[2] + static_cast<ptrdiff_t>(offsetY / 2) * frame->linesize[2] + offsetX / 2,
+  };
+  Timeline::Scope scope("sws_scale to stream size");
+  sws_scale(m_swsCtx, m_sourceFrame->data, m_sourceFrame->linesize, 0, srcHeight, dst, frame->linesize);
+  av_frame_unref(m_sourceFrame);
+  return true;
 }
 
 void VideoEncoder::initCodecContext() {
@@ -147,47 +362,189 @@ void VideoEncoder::initCodecContext() {
   m_codecCtx->pix_fmt = AV_PIX_FMT_YUV420P;
   m_codecCtx->time_base = {1, m_dstFramerate};
   m_codecCtx->framerate = {m_dstFramerate, 1};
-  m_codecCtx->gop_size = 60 ;
+  m_codecCtx->gop_size = std::max(1, static_cast<int>(std::lround(m_keyframePolicy.intervalSeconds * m_dstFramerate)));
   m_codecCtx->max_b_frames = 1;
+  this->applyCodecOptions(m_codecCtx);
+  this->applyRateControl(m_codecCtx);
+  int ret = avcodec_open2(m_codecCtx, m_codec, nullptr);
+  if (ret < 0) {
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not open codec, error: {}", errStr);
+  }
+
+  m_pipelineFrames.assign(kPipelineFrames, { nullptr, 0, 0, false });
+  for (PipelineFrame &pipelineFrame : m_pipelineFrames) {
+    pipelineFrame.frame = av_frame_alloc();
+    pipelineFrame.frame->width = m_codecCtx->width;
+    pipelineFrame.frame->height = m_codecCtx->height;
+    pipelineFrame.frame->format = m_codecCtx->pix_fmt;
+    ret = av_frame_get_buffer(pipelineFrame.frame, 0);
+    if (ret < 0) {
+      char errStr[64];
+      av_make_error_string(errStr, 64, ret);
+      throw fmt::format("could not alloc frame, error: {}", errStr);
+    }
+  }
+
+  m_packet = av_packet_alloc();
+  if (m_packet == nullptr) {
+    throw "could not allocate packet memory";
+  }
+}
+
+void VideoEncoder::applyCodecOptions(AVCodecContext *ctx) const {
   if (!m_isUsingGPU) {
-    av_opt_set(m_codecCtx->priv_data, "tune", "zerolatency", 0);
-    av_opt_set(m_codecCtx->priv_data, "preset", "veryfast", 0);
+    applySoftwareCodec(ctx, kSoftwareCodecs[m_softwareCodec], m_keyframePolicy.sceneChange);
   } else {
     if (m_encoderName.ends_with("nvenc")) {
-      av_opt_set(m_codecCtx->priv_data, "preset", "p3", 0);
-      av_opt_set(m_codecCtx->priv_data, "tune", "ull", 0);
+      av_opt_set(ctx->priv_data, "preset", "p3", 0);
+      av_opt_set(ctx->priv_data, "tune", "ull", 0);
+      av_opt_set_int(ctx->priv_data, "no-scenecut", !m_keyframePolicy.sceneChange, 0);
+      av_opt_set_int(ctx->priv_data, "forced-idr", 1, 0);
     } else if (m_encoderName.ends_with("amf")) {
-      av_opt_set(m_codecCtx->priv_data, "quality", "speed", 0);
+      av_opt_set(ctx->priv_data, "quality", "speed", 0);
     } else if (m_encoderName.ends_with("qsv")) {
-      av_opt_set(m_codecCtx->priv_data, "preset", "veryfast", 0);
+      av_opt_set(ctx->priv_data, "preset", "veryfast", 0);
+      av_opt_set_int(ctx->priv_data, "forced_idr", 1, 0);
       // there could be something i'm missing here
     }
     // now here is where having a mac would help (i don't need to support vaapi or vdpau)
   }
-  int ret = avcodec_open2(m_codecCtx, m_codec, nullptr);
-  if (ret < 0) {
-    char errStr[64];
-    av_make_error_string(errStr, 64, ret);
-    throw fmt::format("could not open codec, error: {}", errStr);
+}
+
+void VideoEncoder::applySoftwareCodec(AVCodecContext *ctx, const SoftwareCodec &codec, bool sceneChange) {
+  ctx->thread_count = codec.threads > 0 ? codec.threads : getEncodeThreadCount();
+  av_opt_set(ctx->priv_data, "preset", codec.preset, 0);
+  if (codec.tune != nullptr) {
+    av_opt_set(ctx->priv_data, "tune", codec.tune, 0);
   }
+  // forced i frames have to be idrs for a marker to be a clip start
+  av_opt_set_int(ctx->priv_data, "forced-idr", 1, 0);
 
-  m_frame = av_frame_alloc();
-  m_frame->width = m_codecCtx->width;
-  m_frame->height = m_codecCtx->height;
-  m_frame->format = m_codecCtx->pix_fmt;
-  ret = av_frame_get_buffer(m_frame, 0);
-  if (ret < 0) {
-    char errStr[64];
-    av_make_error_string(errStr, 64, ret);
-    throw fmt::format("could not alloc frame, error: {}", errStr);
+  std::string params = codec.params;
+  std::string sceneChangeParams = codec.sceneChangeParams[sceneChange ? 1 : 0];
+  if (!params.empty() && !sceneChangeParams.empty()) {
+    params += ':';
+  }
+  params += sceneChangeParams;
+  if (!params.empty()) {
+    av_opt_set(ctx->priv_data, codec.paramsOption, params.c_str(), 0);
   }
+}
 
-  m_packet = av_packet_alloc();
-  if (m_packet == nullptr) {
-    throw "could not allocate packet memory";
+void VideoEncoder::applyRateControl(AVCodecContext *ctx) const {
+  // hardware encoding is always h.264, so its quality is on the same scale as x264's crf
+  int quality = m_rateControl.quality > 0 ? m_rateControl.quality
+                                          : kSoftwareCodecs[m_isUsingGPU ? 0 : m_softwareCodec].equalQualityCrf;
+  int64_t bitrate = m_dstBitrate;
+  auto mode = m_rateControl.mode;
+  ctx->bit_rate = bitrate;
+  ctx->rc_max_rate = mode == RateControl::ConstantQuality ? 0 : bitrate;
+  ctx->rc_buffer_size = mode == RateControl::ConstantQuality
+                          ? 0 : static_cast<int>(std::min(bitrate * m_rateControl.vbvSeconds, 2147483647.0));
+  if (mode == RateControl::Cbr) {
+    ctx->rc_min_rate = bitrate;
+  }
+
+  if (!m_isUsingGPU) {
+    // x264, x265 and svt-av1 all cap their crf with a max rate and a vbv buffer
+    if (mode == RateControl::Cbr) {
+      av_opt_set(ctx->priv_data, "nal-hrd", "cbr", 0); // x264 only, the others go by the rates alone
+    } else if (av_opt_set_int(ctx->priv_data, "crf", quality, 0) >= 0) {
+      ctx->bit_rate = 0;
+    }
+  } else if (m_encoderName.ends_with("nvenc")) {
+    if (mode == RateControl::Cbr) {
+      av_opt_set(ctx->priv_data, "rc", "cbr", 0);
+    } else {
+      av_opt_set(ctx->priv_data, "rc", "vbr", 0);
+      av_opt_set_int(ctx->priv_data, "cq", quality, 0);
+      ctx->bit_rate = 0;
+    }
+  } else if (m_encoderName.ends_with("qsv")) {
+    // qsv picks icq for a quality alone, qvbr for a quality under a max rate above the average and cbr when
+    // the two rates are equal
+    if (mode != RateControl::Cbr) {
+      ctx->global_quality = quality;
+      ctx->bit_rate = mode == RateControl::CappedVbr ? bitrate / 2 : 0;
+    }
+  } else if (m_encoderName.ends_with("amf")) {
+    if (mode == RateControl::ConstantQuality) {
+      av_opt_set(ctx->priv_data, "rc", "cqp", 0);
+      av_opt_set_int(ctx->priv_data, "qp_i", quality, 0);
+      av_opt_set_int(ctx->priv_data, "qp_p", quality, 0);
+      ctx->bit_rate = 0;
+    } else if (mode == RateControl::CappedVbr) {
+      // amf has no quality target under a cap, a peak constrained vbr averaging half the cap is the closest
+      av_opt_set(ctx->priv_data, "rc", "vbr_peak", 0);
+      ctx->bit_rate = bitrate / 2;
+    } else {
+      av_opt_set(ctx->priv_data, "rc", "cbr", 0);
+    }
+  } else if (m_encoderName.ends_with("videotoolbox")) {
+    // no constant quality without apple silicon, so both vbr modes are an average under the cap there
+    if (mode == RateControl::Cbr) {
+      av_opt_set_int(ctx->priv_data, "constant_bit_rate", 1, 0);
+    } else {
+      ctx->bit_rate = bitrate / 2;
+    }
+  }
+}
+
+AVCodecContext *VideoEncoder::createCompatibleContext(const CompatibleOptions &options) const {
+  if (options.softwareCodec >= 0) {
+    return createSoftwareContext(this->getCompatibleSource(), options);
   }
+  // same codec and tuning as the live encoder, but without b-frames so spliced output never reorders
+  AVCodecContext *ctx = avcodec_alloc_context3(m_codec);
+  applyCompatibleSource(ctx, this->getCompatibleSource(), options);
+  this->applyCodecOptions(ctx);
+  return openCompatibleContext(ctx, m_codec, options);
+}
 
-  m_timeBaseUs = 1000000 * m_codecCtx->time_base.num / m_codecCtx->time_base.den;
+VideoEncoder::CompatibleSource VideoEncoder::getCompatibleSource() const {
+  return { m_dstBitrate, m_dstWidth, m_dstHeight, m_codecCtx->time_base, m_codecCtx->framerate, m_codecCtx->gop_size,
+           m_keyframePolicy.sceneChange };
+}
+
+AVCodecContext *VideoEncoder::createSoftwareContext(const CompatibleSource &source, const CompatibleOptions &options) {
+  const SoftwareCodec &software = kSoftwareCodecs[options.softwareCodec];
+  const AVCodec *codec = avcodec_find_encoder_by_name(software.encoder);
+  if (codec == nullptr) {
+    throw fmt::format("{} is not available in this build", software.encoder);
+  }
+  AVCodecContext *ctx = avcodec_alloc_context3(codec);
+  applyCompatibleSource(ctx, source, options);
+  applySoftwareCodec(ctx, software, source.sceneChange);
+  return openCompatibleContext(ctx, codec, options);
+}
+
+void VideoEncoder::applyCompatibleSource(AVCodecContext *ctx, const CompatibleSource &source,
+                                         const CompatibleOptions &options) {
+  ctx->bit_rate = options.bitrate > 0 ? options.bitrate : source.bitrate;
+  ctx->width = options.width > 0 ? options.width : source.width;
+  ctx->height = options.height > 0 ? options.height : source.height;
+  ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  ctx->time_base = source.timeBase;
+  ctx->framerate = source.framerate;
+  ctx->gop_size = source.gopSize;
+  ctx->max_b_frames = 0;
+}
+
+AVCodecContext *VideoEncoder::openCompatibleContext(AVCodecContext *ctx, const AVCodec *codec,
+                                                    const CompatibleOptions &options) {
+  if (options.crf > 0 && av_opt_set_int(ctx->priv_data, "crf", options.crf, 0) >= 0) {
+    ctx->bit_rate = 0;
+  }
+  int ret = avcodec_open2(ctx, codec, nullptr);
+  if (ret < 0) {
+    avcodec_free_context(&ctx);
+    char errStr[64];
+    av_make_error_string(errStr, 64, ret);
+    throw fmt::format("could not open codec, error: {}", errStr);
+  }
+  return ctx;
 }
 
 void VideoEncoder::destroyCodecContext() {
@@ -195,9 +552,10 @@ void VideoEncoder::destroyCodecContext() {
     av_packet_free(&m_packet);
   }
 
-  if (m_frame != nullptr) {
-    av_frame_free(&m_frame);
+  for (PipelineFrame &pipelineFrame : m_pipelineFrames) {
+    av_frame_free(&pipelineFrame.frame);
   }
+  m_pipelineFrames.clear();
 
   if (m_codecCtx != nullptr) {
     avcodec_free_context(&m_codecCtx);
@@ -216,21 +574,8 @@ void VideoEncoder::reinitCodecContext() {
   this->initCodecContext();
 }
 
-void VideoEncoder::setSrcResolution(int width, int height) {
-  if (m_srcWidth == width && m_srcHeight == height) {
-    return;
-  }
-  m_srcWidth = width;
-  m_srcHeight = height;
-  this->m_pixelBufferManager->changeSize(width, height);
-  if (!m_swsCtx) {
-    return;
-  }
-  if (m_running) {
-    this->stop();
-    this->joinThread();
-  }
-  this->initSwsContext();
+void VideoEncoder::setSource(std::shared_ptr<VideoSource> source) {
+  m_source = std::move(source);
 }
 
 void VideoEncoder::setDstResolution(int width, int height) {
@@ -253,3 +598,128 @@ void VideoEncoder::setDstBitrate(int bitrate) {
   m_dstBitrate = bitrate;
   this->reinitCodecContext();
 }
+
+void VideoEncoder::setKeyframePolicy(const KeyframePolicy &policy) {
+  m_keyframePolicy = policy;
+}
+
+void VideoEncoder::setRateControlPolicy(const RateControlPolicy &policy) {
+  m_rateControl = policy;
+}
+
+void VideoEncoder::setSoftwareCodec(int codec) {
+  m_softwareCodec = std::clamp(codec, 0, static_cast<int>(kSoftwareCodecs.size()) - 1);
+}
+
+const std::string &VideoEncoder::getEncoderName() const {
+  return m_encoderName;
+}
+
+void VideoEncoder::requestKeyframe() {
+  m_keyframeRequested = true;
+}
+
+int64_t VideoEncoder::getCaughtUpTime() const {
+  return m_caughtUpTime;
+}
+
+void VideoEncoder::setCaughtUpTime(int64_t time) {
+  // the idle branches store the same time over and over, only a change is worth waking anyone for
+  if (m_caughtUpTime.exchange(time) == time) {
+    return;
+  }
+  {
+    std::lock_guard lock(m_caughtUpMutex);
+  }
+  m_caughtUpCv.notify_all();
+}
+
+bool VideoEncoder::waitCaughtUp(int64_t time, std::chrono::milliseconds timeout) {
+  std::unique_lock lock(m_caughtUpMutex);
+  m_caughtUpCv.wait_for(lock, timeout, [this, time] { return m_caughtUpTime >= time || !m_running; });
+  // conversion sets it to the max on its way out, that's no frame taken
+  return m_running && m_caughtUpTime >= time;
+}
+
+std::vector<int64_t> VideoEncoder::getMarkers() {
+  auto [first, _last] = this->getPtsRange();
+  std::lock_guard lock(m_markerMutex);
+  if (first != AV_NOPTS_VALUE) {
+    int64_t firstUs = av_rescale_q(first, m_codecCtx->time_base, { 1, 1000000 });
+    while (!m_markers.empty() && m_markers.front() < firstUs) {
+      m_markers.pop_front();
+    }
+  }
+  return { m_markers.begin(), m_markers.end() };
+}
+
+VideoEncoder::PipelineStats VideoEncoder::getPipelineStats() const {
+  PipelineStats stats;
+  stats.convertUs = static_cast<double>(m_convertUs) / static_cast<double>(std::max<int64_t>(m_convertedFrameCount, 1));
+  stats.encodeUs = static_cast<double>(m_encodeUs) / static_cast<double>(std::max<int64_t>(m_encodedFrameCount, 1));
+  stats.sinkUs = static_cast<double>(m_sinkUs) / static_cast<double>(std::max<int64_t>(m_sunkPacketCount, 1));
+  stats.convertStalls = m_freeFrames.getEmptyWaits();
+  stats.encodeStarved = m_convertedFrames.getEmptyWaits();
+  stats.sinkStalls = m_encodedPackets.getFullWaits();
+  stats.duplicatedFrames = m_duplicatedFrameCount;
+  return stats;
+}
+
+VideoEncoder::KeyframeStats VideoEncoder::getKeyframeStats() {
+  int64_t now = m_clock->now();
+  {
+    // start resets the cache from the lifecycle thread
+    std::lock_guard lock(m_markerMutex);
+    if (m_keyframeStatsTime != 0 && now - m_keyframeStatsTime < kStatsIntervalUs) {
+      return m_keyframeStats;
+    }
+    m_keyframeStatsTime = now;
+  }
+
+  KeyframeStats stats = this->computeKeyframeStats();
+  std::lock_guard lock(m_markerMutex);
+  return m_keyframeStats = stats;
+}
+
+VideoEncoder::KeyframeStats VideoEncoder::computeKeyframeStats() {
+  KeyframeStats stats;
+  std::lock_guard lock(m_packetBufferMutex);
+  if (m_packetIndex.size() < 2) {
+    return stats;
+  }
+  // only walks the keyframes, the byte total is kept up to date as packets come and go
+  AVRational usTimeBase = { 1, 1000000 };
+  int64_t gopTotal = 0;
+  for (size_t i = 1; i < m_packetIndex.keyframeCount(); i++) {
+    int64_t gopPts = m_packetIndex.pts(m_packetIndex.keyframe(i)) - m_packetIndex.pts(m_packetIndex.keyframe(i - 1));
+    int64_t gopUs = av_rescale_q(gopPts, m_codecCtx->time_base, usTimeBase);
+    stats.longestGopUs = std::max(stats.longestGopUs, gopUs);
+    gopTotal += gopUs;
+    stats.gops++;
+  }
+  if (stats.gops > 0) {
+    stats.averageGopUs = gopTotal / static_cast<int64_t>(stats.gops);
+  }
+  int64_t spanUs = av_rescale_q(m_packetIndex.pts(m_packetIndex.size() - 1) - m_packetIndex.pts(0), m_codecCtx->time_base, usTimeBase);
+  if (spanUs > 0) {
+    stats.bytesPerSecond = static_cast<double>(m_packetIndex.bytes()) * 1000000.0 / static_cast<double>(spanUs);
+  }
+
+  // with a quality target the rate follows the game, so the last few seconds say more about what the buffer is
+  // heading for than its whole length does
+  int64_t newestPts = m_packetIndex.maxPts();
+  int64_t windowStart = newestPts - av_rescale_q(kRecentWindowUs, usTimeBase, m_codecCtx->time_base);
+  size_t recentBytes = 0;
+  int64_t oldestRecentPts = newestPts;
+  for (size_t i = m_packetIndex.size(); i-- > 0 && m_packetIndex.pts(i) >= windowStart;) {
+    recentBytes += m_packetIndex.packetSize(i);
+    oldestRecentPts = std::min(oldestRecentPts, m_packetIndex.pts(i));
+  }
+  int64_t recentUs = av_rescale_q(newestPts - oldestRecentPts, m_codecCtx->time_base, usTimeBase);
+  if (recentUs > 0) {
+    stats.recentBytesPerSecond = static_cast<double>(recentBytes) * 1000000.0 / static_cast<double>(recentUs);
+    // trimBuffer keeps a second more than the buffer length
+    stats.projectedBytes = static_cast<size_t>(stats.recentBytesPerSecond * (m_maxDuration + 1));
+  }
+  return stats;
+}
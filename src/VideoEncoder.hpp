@@ -2,21 +2,130 @@
 #define REPLAYBUFFER_VIDEOENCODER_HPP
 
 #include "BaseEncoder.hpp"
-#include "PixelBufferManager.hpp"
+#include "BoundedQueue.hpp"
+#include "VideoSource.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 class VideoEncoder : public BaseEncoder {
+public:
+  struct KeyframePolicy {
+    double intervalSeconds = 1.0; // also how finely a clip start can be placed without re-encoding
+    bool sceneChange = true;      // let the encoder add keyframes at cuts, where it supports it
+  };
+
+  // how the encoder spends bits. a fixed bitrate costs the buffer as much on a static menu as on a busy level,
+  // constant quality lets quiet scenes take almost nothing and capping it keeps busy ones from blowing up the
+  // buffer. cbr is there for when the memory has to be known up front
+  enum class RateControl { ConstantQuality, CappedVbr, Cbr };
+  static constexpr std::array<const char *, 3> kRateControlNames = { "constant quality", "capped vbr", "cbr" };
+
+  struct RateControlPolicy {
+    RateControl mode = RateControl::CappedVbr;
+    int quality = 0;         // crf-like, lower is better. 0 takes the codec's equalQualityCrf
+    double vbvSeconds = 1.0; // the vbv buffer in seconds of the bitrate, how long the cap can be overshot for
+  };
+
+  // what the policy is doing to the buffer, recomputed at most once per kStatsInterval
+  struct KeyframeStats {
+    size_t gops = 0;
+    int64_t averageGopUs = 0;
+    int64_t longestGopUs = 0; // the worst case distance from a clip start to the keyframe it snaps to
+    double bytesPerSecond = 0.0;
+    // over the last kRecentWindow, and what a full buffer would hold at that rate
+    double recentBytesPerSecond = 0.0;
+    size_t projectedBytes = 0;
+  };
+
+  // how much each pipeline stage took per item, and how often one had to wait on another. the stage that's never
+  // waited on is the one holding the others back
+  struct PipelineStats {
+    double convertUs = 0.0; // per frame
+    double encodeUs = 0.0;  // per frame, sending it and taking the packets out
+    double sinkUs = 0.0;    // per packet
+    int64_t convertStalls = 0; // conversion waited for the encode stage to hand a frame back
+    int64_t encodeStarved = 0; // the encode stage waited for a converted frame
+    int64_t sinkStalls = 0;    // the encode stage waited for the sink to take packets
+    int64_t duplicatedFrames = 0; // one capture sent for more than one pts, the source fell behind
+  };
+
+  // frames between conversion and the codec, one being converted, one being encoded and one in between
+  static constexpr size_t kPipelineFrames = 3;
+  static constexpr size_t kPacketQueueDepth = 32;
+  static constexpr int64_t kStatsIntervalUs = 1000000;
+  static constexpr int64_t kRecentWindowUs = 5000000;
+
+  // cpu encoders the live stream can use, hardware encoding stays on h.264. every entry is tuned for capture:
+  // no reordering, a fast preset and threading sized to where the encode threads run
+  struct SoftwareCodec {
+    const char *label;
+    const char *encoder;
+    const char *preset;
+    const char *tune;         // nullptr where the encoder has no tune option
+    const char *paramsOption; // the encoder's own parameter string
+    const char *params;
+    const char *sceneChangeParams[2]; // appended to params with scene change keyframes off and on
+    int threads; // 0 matches the processors the encode threads are placed on
+    int equalQualityCrf; // crfs that look about the same across the table, for comparing sizes
+  };
+
+  static constexpr std::array<SoftwareCodec, 3> kSoftwareCodecs = { {
+    { "h.264 (x264)", "libx264", "veryfast", "zerolatency", "x264-params", "", { "scenecut=0", "" }, 0, 23 },
+    { "hevc (x265)", "libx265", "ultrafast", "zerolatency", "x265-params", "log-level=error", { "scenecut=0", "" }, 0, 28 },
+    { "av1 (svt-av1)", "libsvtav1", "10", nullptr, "svtav1-params", "pred-struct=1", { "scd=0", "scd=1" }, 0, 35 },
+  } };
+
+private:
+  // a frame of the pool the conversion stage fills and the encode stage sends
+  struct PipelineFrame {
+    AVFrame *frame;
+    int fitWidth, fitHeight; // where the source lands inside the frame when it has to be letterboxed
+    bool borrowed;           // a reference to the source's frame instead of a buffer of its own
+  };
+
+  // sent count times from pts on, when conversion fell behind the clock the frame fills the gap
+  struct FrameJob {
+    PipelineFrame *frame;
+    int64_t pts;
+    int count;
+    bool keyframe;
+  };
+
   AVBufferRef *m_hwDeviceCtx;
   SwsContext *m_swsCtx;
-  int m_srcWidth, m_srcHeight;
+  AVFrame *m_sourceFrame;
   int m_dstWidth, m_dstHeight;
   int m_dstFramerate;
   bool m_isUsingGPU;
   std::string m_encoderName;
-  int64_t m_lastFrameTime;
-  int64_t m_timeBaseUs;
+  int m_softwareCodec;
   int64_t m_dstBitrate;
-  std::unique_ptr<PixelBufferManager> m_pixelBufferManager;
+  std::shared_ptr<VideoSource> m_source;
+  KeyframePolicy m_keyframePolicy;
+  RateControlPolicy m_rateControl;
+  std::atomic<bool> m_keyframeRequested;
+  std::mutex m_markerMutex; // also guards the keyframe stats cache, start resets it off the main thread
+  std::deque<int64_t> m_markers;
+  KeyframeStats m_keyframeStats;
+  int64_t m_keyframeStatsTime;
+  std::atomic<int64_t> m_caughtUpTime;
+  std::mutex m_caughtUpMutex;
+  std::condition_variable m_caughtUpCv;
+  // convert on m_thread, encode and sink on their own. frames go round from free to converted and back
+  std::vector<PipelineFrame> m_pipelineFrames;
+  BoundedQueue<PipelineFrame *> m_freeFrames;
+  BoundedQueue<FrameJob> m_convertedFrames;
+  BoundedQueue<AVPacket *> m_encodedPackets;
+  std::thread m_encodeThread, m_sinkThread;
+  std::atomic<int64_t> m_convertUs, m_encodeUs, m_sinkUs;
+  std::atomic<int64_t> m_convertedFrameCount, m_encodedFrameCount, m_sunkPacketCount, m_duplicatedFrameCount;
 
 public:
   VideoEncoder();
@@ -24,8 +133,10 @@ public:
 
   void init() override;
   void destroy() override;
+  void reset() override;
   void start() override;
   void stop() override;
+  void joinThread() override;
   void update() override;
   bool isVideo() override;
 
@@ -36,17 +147,75 @@ protected:
   void threadProc() override;
 
 private:
-  void initSwsContext();
+  void setCaughtUpTime(int64_t time);
+  void encodeProc();
+  void sinkProc();
+  // false when the source has nothing yet
+  bool scaleSourceFrame(PipelineFrame &target);
+  KeyframeStats computeKeyframeStats();
   void initCodecContext();
   void destroyCodecContext();
   void reinitCodecContext();
+  void applyCodecOptions(AVCodecContext *ctx) const;
+  static void applySoftwareCodec(AVCodecContext *ctx, const SoftwareCodec &codec, bool sceneChange);
+  // only for the live context, the compatible ones are given their own bitrate or crf
+  void applyRateControl(AVCodecContext *ctx) const;
 
 public:
-  void setSrcResolution(int width, int height);
+  struct CompatibleOptions {
+    int64_t bitrate = 0; // 0 keeps the live bitrate
+    int width = 0;       // 0 keeps the live size
+    int height = 0;
+    int crf = 0;         // constant quality instead of a bitrate, where the encoder has it
+    int softwareCodec = -1; // an entry of kSoftwareCodecs to use instead of the live encoder
+  };
+
+  // what a compatible software context takes from the live encoder, a copy stays valid after it's torn down
+  struct CompatibleSource {
+    int64_t bitrate;
+    int width, height;
+    AVRational timeBase, framerate;
+    int gopSize;
+    bool sceneChange;
+  };
+
+  AVCodecContext *createCompatibleContext(const CompatibleOptions &options = {}) const;
+  CompatibleSource getCompatibleSource() const;
+  // options.softwareCodec has to be set, the live encoder's own codec needs the encoder
+  static AVCodecContext *createSoftwareContext(const CompatibleSource &source, const CompatibleOptions &options);
+
+private:
+  static void applyCompatibleSource(AVCodecContext *ctx, const CompatibleSource &source,
+                                    const CompatibleOptions &options);
+  static AVCodecContext *openCompatibleContext(AVCodecContext *ctx, const AVCodec *codec,
+                                               const CompatibleOptions &options);
+
+public:
+  // the capture this encoder scales from, several encoders can share one
+  void setSource(std::shared_ptr<VideoSource> source);
   void setDstResolution(int width, int height);
   void setUsingGPU(bool isGPU);
   void setDstFramerate(int fps);
   void setDstBitrate(int bitrate);
+  void setKeyframePolicy(const KeyframePolicy &policy);
+  // like the keyframe policy it's picked up when the codec is opened next
+  void setRateControlPolicy(const RateControlPolicy &policy);
+  // index into kSoftwareCodecs, used when there's no hardware encoder
+  void setSoftwareCodec(int codec);
+  const std::string &getEncoderName() const;
+
+  // forces an idr on the next frame and keeps its time as a marker a clip can start at exactly
+  void requestKeyframe();
+  // capture clock microseconds of the markers still inside the buffer
+  std::vector<int64_t> getMarkers();
+  // capture clock time up to which every due frame has been converted and queued for the encode stage, -1
+  // before the first. the codec may still be working through the queue
+  int64_t getCaughtUpTime() const;
+  // blocks until getCaughtUpTime reaches time. false when the encoder stopped first or timeout went by, so a
+  // caller driving the clock by hand can't hang on an encoder that died
+  bool waitCaughtUp(int64_t time, std::chrono::milliseconds timeout);
+  KeyframeStats getKeyframeStats();
+  PipelineStats getPipelineStats() const;
 };
 
 #endif //REPLAYBUFFER_VIDEOENCODER_HPP
\ No newline at end of file
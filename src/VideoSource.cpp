@@ -0,0 +1,193 @@
+#include "VideoSource.hpp"
+#include "Timeline.hpp"
+#include "Timer.hpp"
+#include <algorithm>
+#include <cmath>
+
+VideoSource::VideoSource() : m_swsCtx(nullptr), m_convertedTime(-1), m_width(0), m_height(0), m_cropPreset(0),
+                             m_cropWidth(0), m_cropHeight(0), m_followAnchor(false), m_anchorX(0.5f),
+                             m_anchorY(0.5f), m_centerX(0.5f), m_centerY(0.5f), m_captureIntervalUs(0),
+                             m_lastCaptureTime(0), m_conversionTimeUs(0), m_conversions(0),
+                             m_tracedTime(-1) {
+  m_pixelBufferManager = std::make_unique<PixelBufferManager>();
+  m_converted = av_frame_alloc();
+}
+
+VideoSource::~VideoSource() {
+  av_frame_free(&m_converted);
+  if (m_swsCtx != nullptr) {
+    sws_free_context(&m_swsCtx);
+  }
+}
+
+void VideoSource::setClock(std::shared_ptr<CaptureClock> clock) {
+  m_clock = std::move(clock);
+}
+
+void VideoSource::setSize(int width, int height) {
+  std::lock_guard lock(m_mutex);
+  m_width = width;
+  m_height = height;
+  this->resizeCrop();
+}
+
+void VideoSource::setCropPreset(int preset) {
+  std::lock_guard lock(m_mutex);
+  m_cropPreset = std::clamp(preset, 0, static_cast<int>(kCropPresets.size()) - 1);
+  this->resizeCrop();
+}
+
+void VideoSource::resizeCrop() {
+  auto [width, height] = getCropSize(m_cropPreset, m_width, m_height);
+  if (width == m_cropWidth && height == m_cropHeight) {
+    return;
+  }
+  m_cropWidth = width;
+  m_cropHeight = height;
+  m_pixelBufferManager->changeSize(width, height);
+  m_convertedTime = -1;
+}
+
+void VideoSource::setFollowAnchor(bool follow) {
+  m_followAnchor = follow;
+}
+
+void VideoSource::setAnchor(float x, float y) {
+  m_anchorX = std::clamp(x, 0.0f, 1.0f);
+  m_anchorY = std::clamp(y, 0.0f, 1.0f);
+}
+
+std::pair<int, int> VideoSource::getCropSize(int preset, int width, int height) {
+  if (width <= 0 || height <= 0) {
+    return { 0, 0 };
+  }
+  const auto &crop = kCropPresets[std::clamp(preset, 0, static_cast<int>(kCropPresets.size()) - 1)];
+  double aspect = crop.aspectWidth > 0 ? static_cast<double>(crop.aspectWidth) / crop.aspectHeight
+                                       : static_cast<double>(width) / height;
+  double cropWidth = width, cropHeight = height;
+  if (width > height * aspect) {
+    cropWidth = height * aspect;
+  } else {
+    cropHeight = width / aspect;
+  }
+  // even sizes so the chroma planes line up
+  return { std::max(static_cast<int>(std::lround(cropWidth * crop.scale)) & ~1, 2),
+           std::max(static_cast<int>(std::lround(cropHeight * crop.scale)) & ~1, 2) };
+}
+
+void VideoSource::setFramerate(int fps) {
+  m_captureIntervalUs = fps > 0 ? 1000000 / fps : 0;
+}
+
+void VideoSource::reset() {
+  std::lock_guard lock(m_mutex);
+  m_pixelBufferManager->changeSize(m_cropWidth, m_cropHeight);
+  m_convertedTime = -1;
+  m_lastCaptureTime = 0;
+  m_centerX = m_followAnchor ? m_anchorX : 0.5f;
+  m_centerY = m_followAnchor ? m_anchorY : 0.5f;
+  m_conversionTimeUs = 0;
+  m_conversions = 0;
+  m_tracedTime = -1;
+}
+
+void VideoSource::setTrace(std::shared_ptr<CaptureTrace> trace) {
+  m_trace = std::move(trace);
+}
+
+void VideoSource::update() {
+  if (m_captureIntervalUs <= 0) {
+    return;
+  }
+  int64_t currentTime = m_clock->now();
+  if (currentTime - m_lastCaptureTime < m_captureIntervalUs) {
+    return;
+  }
+  this->capture(currentTime);
+}
+
+void VideoSource::capture(int64_t time) {
+  if (m_cropWidth <= 0 || m_cropHeight <= 0) {
+    return;
+  }
+  m_lastCaptureTime = time;
+
+  // the crop only moves, its size and so the buffers stay the same
+  m_centerX += ((m_followAnchor ? m_anchorX : 0.5f) - m_centerX) * kFollowRate;
+  m_centerY += ((m_followAnchor ? m_anchorY : 0.5f) - m_centerY) * kFollowRate;
+  int x = static_cast<int>(std::lround(m_centerX * m_width)) - m_cropWidth / 2;
+  int y = static_cast<int>(std::lround(m_centerY * m_height)) - m_cropHeight / 2;
+  m_pixelBufferManager->setOrigin(std::clamp(x, 0, m_width - m_cropWidth), std::clamp(y, 0, m_height - m_cropHeight));
+  m_pixelBufferManager->captureFrame(time);
+  {
+    // the encoder threads convert the current frame under the lock, the copy out of the pbo happened without it
+    std::lock_guard lock(m_mutex);
+    m_pixelBufferManager->publishFrame();
+  }
+
+  // the readback lags a capture behind, so what's traced is whatever frame came out of this one
+  int64_t frameTime = m_pixelBufferManager->getCurrentFrameTime();
+  if (m_trace && frameTime >= 0 && frameTime != m_tracedTime) {
+    m_trace->writeVideo(frameTime, m_pixelBufferManager->getCurrentFrame(), m_cropWidth, m_cropHeight);
+    m_tracedTime = frameTime;
+  }
+}
+
+void VideoSource::push(const uint8_t *rgba, int64_t time) {
+  std::lock_guard lock(m_mutex);
+  m_pixelBufferManager->setFrame(rgba, time);
+}
+
+std::pair<int, int> VideoSource::getReadbackSize() const {
+  return { m_cropWidth, m_cropHeight };
+}
+
+int64_t VideoSource::getFrameTime() const {
+  return m_pixelBufferManager->getCurrentFrameTime();
+}
+
+bool VideoSource::acquire(AVFrame *frame) {
+  std::lock_guard lock(m_mutex);
+  int64_t frameTime = m_pixelBufferManager->getCurrentFrameTime();
+  if (frameTime < 0) {
+    return false;
+  }
+
+  if (frameTime != m_convertedTime) {
+    Timer timer;
+    timer.start();
+    // encoders usually let go of their reference once the frame is sent, so this only allocates when one of
+    // them is still holding on to the last frame
+    if (!av_frame_is_writable(m_converted) || m_converted->width != m_cropWidth || m_converted->height != m_cropHeight) {
+      av_frame_unref(m_converted);
+      m_converted->width = m_cropWidth;
+      m_converted->height = m_cropHeight;
+      m_converted->format = AV_PIX_FMT_YUV420P;
+      if (av_frame_get_buffer(m_converted, 0) < 0) {
+        return false;
+      }
+    }
+    m_swsCtx = sws_getCachedContext(m_swsCtx, m_cropWidth, m_cropHeight, AV_PIX_FMT_RGBA, m_cropWidth, m_cropHeight,
+                                    AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+    if (m_swsCtx == nullptr) {
+      return false;
+    }
+
+    // gl reads bottom up
+    const uint8_t *src[] = { m_pixelBufferManager->getCurrentFrame() + static_cast<size_t>(m_cropHeight - 1) * m_cropWidth * 4 };
+    int stride[] = { -m_cropWidth * 4 };
+    Timeline::Scope scope("sws_scale rgba to yuv");
+    sws_scale(m_swsCtx, src, stride, 0, m_cropHeight, m_converted->data, m_converted->linesize);
+    m_convertedTime = frameTime;
+    m_conversionTimeUs += timer.stop();
+    m_conversions++;
+  }
+
+  av_frame_unref(frame);
+  return av_frame_ref(frame, m_converted) >= 0;
+}
+
+double VideoSource::getAverageConversionTime() const {
+  int64_t conversions = m_conversions;
+  return conversions > 0 ? static_cast<double>(m_conversionTimeUs) / static_cast<double>(conversions) : 0.0;
+}
@@ -0,0 +1,104 @@
+#ifndef REPLAYBUFFER_VIDEOSOURCE_HPP
+#define REPLAYBUFFER_VIDEOSOURCE_HPP
+
+#include "CaptureClock.hpp"
+#include "CaptureTrace.hpp"
+#include "PixelBufferManager.hpp"
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+
+// the game's frame, read back once and shared by every video encoder. the rgba readback is converted to yuv at
+// the capture size by whichever encoder thread asks for a new frame first, everyone else gets a reference to the
+// same buffer and only has to scale it to their own size. it can also read back just a region of the window, so
+// a crop costs less to read, convert and encode instead of more
+class VideoSource {
+public:
+  struct CropPreset {
+    const char *name;
+    int aspectWidth, aspectHeight; // 0 keeps the window's aspect ratio
+    float scale;                   // of the largest rect with that aspect that fits in the window
+  };
+
+  static constexpr std::array<CropPreset, 5> kCropPresets = { {
+    { "full window", 0, 0, 1.0f },
+    { "vertical 9:16", 9, 16, 1.0f },
+    { "square", 1, 1, 1.0f },
+    { "4:3", 4, 3, 1.0f },
+    { "half size", 0, 0, 0.5f },
+  } };
+
+  // how much of the way to the anchor the crop moves per captured frame, so it doesn't shake with the player
+  static constexpr float kFollowRate = 0.15f;
+
+private:
+  std::unique_ptr<PixelBufferManager> m_pixelBufferManager;
+  std::shared_ptr<CaptureClock> m_clock;
+  std::mutex m_mutex;
+  SwsContext *m_swsCtx;
+  AVFrame *m_converted;
+  int64_t m_convertedTime;
+  int m_width, m_height;
+  int m_cropPreset;
+  int m_cropWidth, m_cropHeight;
+  std::atomic<bool> m_followAnchor; // the settings window flips it while start reads it on the lifecycle thread
+  float m_anchorX, m_anchorY; // main thread only, normalised window coordinates with the origin bottom left
+  float m_centerX, m_centerY;
+  int64_t m_captureIntervalUs;
+  int64_t m_lastCaptureTime;
+  std::atomic<int64_t> m_conversionTimeUs;
+  std::atomic<int64_t> m_conversions;
+  std::shared_ptr<CaptureTrace> m_trace;
+  int64_t m_tracedTime;
+
+  void resizeCrop();
+
+public:
+  VideoSource();
+  ~VideoSource();
+
+  void setClock(std::shared_ptr<CaptureClock> clock);
+  // the window's size, the readback is the crop of it
+  void setSize(int width, int height);
+  // takes effect on the next capture, the encoders scale whatever size comes out to theirs. like setSize and
+  // reset it resizes the readback, so it's for the main thread or while nothing is capturing
+  void setCropPreset(int preset);
+  // keep the crop centred on a point instead of the middle of the window
+  void setFollowAnchor(bool follow);
+  // main thread, normalised window coordinates
+  void setAnchor(float x, float y);
+  // size of the region a preset reads back from a window this big
+  static std::pair<int, int> getCropSize(int preset, int width, int height);
+  // the fastest of the encoders reading from it
+  void setFramerate(int fps);
+  // drops the last session's frame, call before the encoders start
+  void reset();
+  // every frame that's read back is also written to the trace, nullptr stops that
+  void setTrace(std::shared_ptr<CaptureTrace> trace);
+
+  // main thread: moves the crop and reads back a frame when one is due
+  void update();
+  // reads back a frame right now stamped with time instead of the clock's, whether one is due or not. the
+  // offline render steps through frames with this, the readback still lags one capture behind
+  void capture(int64_t time);
+  // hands out a frame that was read back some other time instead, at the readback size. replaying a trace is
+  // the only thing that should do this, update must not be running at the same time
+  void push(const uint8_t *rgba, int64_t time);
+  // size of the region that's read back, and of the frames acquire hands out
+  std::pair<int, int> getReadbackSize() const;
+  // capture clock time of the newest readback, -1 until there is one
+  int64_t getFrameTime() const;
+  // references the newest frame as yuv420p at the capture size into frame
+  bool acquire(AVFrame *frame);
+  // microseconds per rgba to yuv conversion, paid once per frame no matter how many encoders there are
+  double getAverageConversionTime() const;
+};
+
+#endif
@@ -2,18 +2,27 @@
 #include <Geode/modify/PauseLayer.hpp>
 #include <Geode/cocos/CCDirector.h>
 #include "PixelBufferManager.hpp"
+#include <limits>
 #include <queue>
-#include <ranges>
 #include <Geode/modify/MenuLayer.hpp>
 #include <Geode/modify/LevelInfoLayer.hpp>
 #include <Geode/modify/EditLevelLayer.hpp>
 #include <Geode/modify/CCEGLViewProtocol.hpp>
 #include <Geode/modify/CCScheduler.hpp>
 #include <Geode/modify/EndLevelLayer.hpp>
+#include <Geode/modify/PlayLayer.hpp>
+#include <Geode/modify/CCKeyboardDispatcher.hpp>
 #include "AudioEncoder.hpp"
 #include "ReplayBuffer.hpp"
 #include "Recorder.hpp"
 #include "VideoEncoder.hpp"
+#include "CodecBenchmark.hpp"
+#include "IndexBenchmark.hpp"
+#include "JitterBenchmark.hpp"
+#include "TraceReplay.hpp"
+#include "Timeline.hpp"
+#include "ThreadPriority.hpp"
+#include "ThreadPool.hpp"
 #include <imgui-cocos.hpp>
 
 using namespace geode::prelude;
@@ -111,26 +120,53 @@ class $modify(ReplayBuffer_CCEGLViewProtocol, cocos2d::CCEGLViewProtocol) {
   void setFrameSize(float width, float height) override {
     CCEGLViewProtocol::setFrameSize(width, height);
 
-    auto encoders = Recorder::getInstance()->m_replayBuffer->getEncoders();
-    for (auto &encoder: encoders | std::views::values) {
-      if (encoder->isVideo()) {
-        auto videoEncoder = std::dynamic_pointer_cast<VideoEncoder>(encoder);
-        videoEncoder->setSrcResolution(width, height);
-      }
-    }
+    // the encoders scale from whatever size the source has, so only the readback needs to know
+    Recorder::getInstance()->setWindowSize(static_cast<int>(width), static_cast<int>(height));
   }
 };
 
 class $modify(ReplayBuffer_CCScheduler, cocos2d::CCScheduler) {
   void update(float dt) override {
-    CCScheduler::update(dt);
-    Recorder::getInstance()->m_replayBuffer->update();
+    auto recorder = Recorder::getInstance();
+    // an offline render steps the game by exactly one frame whatever the real frame took
+    float step = recorder->getOfflineStep();
+    CCScheduler::update(step > 0.0f ? step : dt);
+    JitterBenchmark::getInstance().onFrame();
+    if (recorder->isRecording()) {
+      // the crop follows the player around while in a level, otherwise it drifts back to the middle
+      auto *playLayer = PlayLayer::get();
+      auto winSize = CCDirector::sharedDirector()->getWinSize();
+      if (playLayer != nullptr && playLayer->m_player1 != nullptr) {
+        auto position = playLayer->m_player1->convertToWorldSpaceAR(CCPointZero);
+        recorder->m_videoSource->setAnchor(position.x / winSize.width, position.y / winSize.height);
+      } else {
+        recorder->m_videoSource->setAnchor(0.5f, 0.5f);
+      }
+    }
+    recorder->update();
+  }
+};
+
+// drops an idr marker into the video buffer
+static constexpr auto kMarkKey = KEY_F8;
+
+class $modify(ReplayBuffer_CCKeyboardDispatcher, CCKeyboardDispatcher) {
+  bool dispatchKeyboardMSG(enumKeyCodes key, bool isKeyDown, bool isKeyRepeat) {
+    if (key == kMarkKey && isKeyDown && !isKeyRepeat) {
+      Recorder::getInstance()->mark();
+    }
+    return CCKeyboardDispatcher::dispatchKeyboardMSG(key, isKeyDown, isKeyRepeat);
   }
 };
 
 class $modify(ReplayBuffer_EndLevelLayer, EndLevelLayer) {
   void customSetup() override {
     EndLevelLayer::customSetup();
+    // the auto clip settings outlive the session, only a running one has a buffer to clip
+    auto recorder = Recorder::getInstance();
+    if (recorder->isRecording()) {
+      recorder->m_autoClipper->trigger(AutoClipper::Trigger::LevelComplete);
+    }
 
     auto *menu = this->m_sideMenu;
     auto *button = CCMenuItemSpriteExtra::create(
@@ -148,8 +184,101 @@ class $modify(ReplayBuffer_EndLevelLayer, EndLevelLayer) {
   }
 };
 
+class $modify(ReplayBuffer_PlayLayer, PlayLayer) {
+  void destroyPlayer(PlayerObject *player, GameObject *object) override {
+    // the game kills the player with its anticheat spike on the first frame of every attempt, that's no death
+    bool wasDead = player->m_isDead;
+    PlayLayer::destroyPlayer(player, object);
+    auto recorder = Recorder::getInstance();
+    if (object != m_anticheatSpike && !wasDead && player->m_isDead && recorder->isRecording()) {
+      recorder->m_autoClipper->trigger(AutoClipper::Trigger::Death);
+    }
+  }
+};
+
 void SetupImGuiStyle();
 
+// thumbnail strip of the video buffer with the markers on top, dragging across it selects a range in capture
+// clock microseconds
+static void drawClipTimeline(ThumbnailCache &cache, const std::vector<int64_t> &markers, int64_t &selectionStart,
+                             int64_t &selectionEnd) {
+  constexpr float stripWidth = 480.0f;
+  constexpr float stripHeight = ThumbnailCache::kHeight * 0.75f;
+  cache.updateTextures();
+  auto [firstUs, lastUs] = cache.getRangeUs();
+  if (lastUs <= firstUs) {
+    ImGui::Text("waiting for video...");
+    return;
+  }
+
+  ImVec2 origin = ImGui::GetCursorScreenPos();
+  auto *drawList = ImGui::GetWindowDrawList();
+  auto toX = [&](int64_t us) {
+    return origin.x + stripWidth * static_cast<float>(us - firstUs) / static_cast<float>(lastUs - firstUs);
+  };
+  auto toUs = [&](float x) {
+    float t = std::clamp((x - origin.x) / stripWidth, 0.0f, 1.0f);
+    return firstUs + static_cast<int64_t>(t * static_cast<float>(lastUs - firstUs));
+  };
+
+  drawList->AddRectFilled(origin, ImVec2(origin.x + stripWidth, origin.y + stripHeight), IM_COL32(20, 20, 20, 255));
+  const auto &textures = cache.getTextures();
+  for (size_t i = 0; i < textures.size(); i++) {
+    float x0 = toX(textures[i].first);
+    float x1 = i + 1 < textures.size() ? toX(textures[i + 1].first) : origin.x + stripWidth;
+    drawList->AddImage((ImTextureID)(intptr_t)textures[i].second, ImVec2(x0, origin.y), ImVec2(x1, origin.y + stripHeight));
+  }
+  for (int64_t marker : markers) {
+    float x = toX(marker);
+    drawList->AddLine(ImVec2(x, origin.y), ImVec2(x, origin.y + stripHeight), IM_COL32(255, 200, 60, 255), 2.0f);
+  }
+
+  ImGui::InvisibleButton("timeline", ImVec2(stripWidth, stripHeight));
+  if (ImGui::IsItemClicked()) {
+    selectionStart = selectionEnd = toUs(ImGui::GetIO().MousePos.x);
+  } else if (ImGui::IsItemActive()) {
+    selectionEnd = toUs(ImGui::GetIO().MousePos.x);
+  }
+
+  if (selectionStart >= 0 && selectionStart != selectionEnd) {
+    float x0 = toX(std::max(std::min(selectionStart, selectionEnd), firstUs));
+    float x1 = toX(std::min(std::max(selectionStart, selectionEnd), lastUs));
+    drawList->AddRectFilled(ImVec2(x0, origin.y), ImVec2(x1, origin.y + stripHeight), IM_COL32(120, 160, 255, 80));
+    drawList->AddRect(ImVec2(x0, origin.y), ImVec2(x1, origin.y + stripHeight), IM_COL32(120, 160, 255, 255));
+    ImGui::Text("selected %.1fs to %.1fs ago", (lastUs - std::min(selectionStart, selectionEnd)) / 1000000.0,
+                (lastUs - std::max(selectionStart, selectionEnd)) / 1000000.0);
+  } else {
+    ImGui::Text("drag across the timeline to pick a range");
+  }
+}
+
+// picks up what a job started from the settings window came back with, true while it's still running. a
+// std::string it threw goes to the error popup instead
+template <typename T, typename Result>
+static bool pollJob(std::future<T> &job, Result &result, std::string &error) {
+  if (!job.valid()) {
+    return false;
+  }
+  if (job.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+    return true;
+  }
+  try {
+    result = job.get();
+  } catch (const std::string &e) {
+    error = e;
+    ImGui::OpenPopup("error");
+  }
+  return false;
+}
+
+// the button that starts such a job, greyed out with runningLabel on it while one runs
+static bool jobButton(const char *label, const char *runningLabel, bool running) {
+  ImGui::BeginDisabled(running);
+  bool pressed = ImGui::Button(running ? runningLabel : label);
+  ImGui::EndDisabled();
+  return pressed;
+}
+
 $on_mod(Loaded) {
   if (!Mod::get()->setSavedValue("set-default-values", true)) {
     auto view_size = CCDirector::sharedDirector()->getOpenGLView()->getFrameSize();
@@ -173,16 +302,40 @@ $on_mod(Loaded) {
     Mod::get()->setSavedValue<std::string>("settings-output-dir"_spr, "please select an output folder");
   }
 
-  Mod::get()->setSavedValue<bool>("is-recording"_spr, false);
+  // a journal that wasn't closed cleanly means the last session crashed, keep it aside so the next recording
+  // doesn't overwrite it before the user had a chance to export it
+  std::error_code ec;
+  if (PacketJournal::probe(Recorder::getJournalPath())) {
+    std::filesystem::rename(Recorder::getJournalPath(), Recorder::getCrashedJournalPath(), ec);
+  }
+  static std::optional<PacketJournal::RecoveryInfo> crashedJournal = PacketJournal::probe(Recorder::getCrashedJournalPath());
+  static int recoverSeconds = 30;
+
+  setThreadPlacementEnabled(Mod::get()->getSavedValue<bool>("settings-thread-placement"_spr, true));
+  placeGameThread();
 
   static int outputWidth, outputHeight, outputFramerate, outputBitrate, outputLength, outputTrackCount;
-  static std::vector<int> audioTracks;
+  static int compactAge, compactBitrate, exportPreset, softwareCodec;
+  static int proxyHeight, proxyBitrate, clipStreams, cropPreset, rateControl, quality;
+  static float vbvSeconds;
+  static float autoClipPreRoll, autoClipPostRoll;
+  static std::future<std::vector<CodecBenchmark::Result>> benchmark;
+  static std::vector<CodecBenchmark::Result> benchmarkResults;
+  static std::future<IndexBenchmark::Result> indexBenchmark;
+  static std::optional<IndexBenchmark::Result> indexBenchmarkResult;
+  static std::future<TraceReplay::Result> traceReplay;
+  static std::optional<TraceReplay::Result> traceReplayResult;
+  static float keyframeInterval;
+  static std::vector<int> audioTracks, audioGains;
   static std::array<char, 256> outputDir;
-  static bool isUsingGPU;
+  static bool isUsingGPU, isAccurateStart, isMixingAudio, isMixOnly, isDeferredAudio, isJournaling, isSceneChange, isPlacingThreads, isProxy, isCropFollowing;
+  static bool isAutoClipComplete, isAutoClipDeath, isTracing, isTraceCompressed, isPremuxing, isOffline;
   static std::vector<std::string> deviceList;
-  static std::string errorString, clipPath;
+  static std::string errorString, clipPath, timelineStatus;
+  static int64_t selectionStart = -1, selectionEnd = -1;
   static std::vector<const char *> deviceListCStr;
   ImGuiCocos::get().setup([] {
+    Timeline::setThreadName("main");
     deviceList = AudioEncoder::getDeviceList();
     deviceListCStr.reserve(deviceList.size());
     for (const auto &deviceName : deviceList) {
@@ -190,16 +343,51 @@ $on_mod(Loaded) {
     }
     int audioTrackAmount = Mod::get()->getSavedValue<int>("settings-audio-amt"_spr);
     audioTracks.resize(audioTrackAmount);
+    audioGains.resize(audioTrackAmount);
     outputWidth = Mod::get()->getSavedValue<int>("settings-width"_spr);
     outputHeight = Mod::get()->getSavedValue<int>("settings-height"_spr);
     outputFramerate = Mod::get()->getSavedValue<int>("settings-framerate"_spr);
     outputBitrate = Mod::get()->getSavedValue<int>("settings-bitrate"_spr);
     outputLength = Mod::get()->getSavedValue<int>("settings-length"_spr);
+    softwareCodec = std::clamp(Mod::get()->getSavedValue<int>("settings-codec"_spr), 0,
+                               static_cast<int>(VideoEncoder::kSoftwareCodecs.size()) - 1);
+    rateControl = std::clamp(Mod::get()->getSavedValue<int>("settings-rate-control"_spr, 1), 0,
+                             static_cast<int>(VideoEncoder::kRateControlNames.size()) - 1);
+    quality = Mod::get()->getSavedValue<int>("settings-quality"_spr);
+    vbvSeconds = static_cast<float>(Mod::get()->getSavedValue<double>("settings-vbv-seconds"_spr, 1.0));
+    keyframeInterval = static_cast<float>(Mod::get()->getSavedValue<double>("settings-keyframe-interval"_spr, 1.0));
+    isSceneChange = Mod::get()->getSavedValue<bool>("settings-scene-change"_spr, true);
+    isProxy = Mod::get()->getSavedValue<bool>("settings-proxy"_spr);
+    isAutoClipComplete = Mod::get()->getSavedValue<bool>("settings-auto-clip-complete"_spr);
+    isAutoClipDeath = Mod::get()->getSavedValue<bool>("settings-auto-clip-death"_spr);
+    autoClipPreRoll = static_cast<float>(Mod::get()->getSavedValue<double>("settings-auto-clip-preroll"_spr, 10.0));
+    autoClipPostRoll = static_cast<float>(Mod::get()->getSavedValue<double>("settings-auto-clip-postroll"_spr, 3.0));
+    cropPreset = std::clamp(Mod::get()->getSavedValue<int>("settings-crop"_spr), 0,
+                            static_cast<int>(VideoSource::kCropPresets.size()) - 1);
+    isCropFollowing = Mod::get()->getSavedValue<bool>("settings-crop-follow"_spr);
+    proxyHeight = Mod::get()->getSavedValue<int>("settings-proxy-height"_spr, 480);
+    proxyBitrate = Mod::get()->getSavedValue<int>("settings-proxy-bitrate"_spr, 2000);
+    clipStreams = std::clamp(Mod::get()->getSavedValue<int>("settings-clip-streams"_spr), 0, 2);
+    compactAge = Mod::get()->getSavedValue<int>("settings-compact-age"_spr);
+    compactBitrate = Mod::get()->getSavedValue<int>("settings-compact-bitrate"_spr, 2500);
+    exportPreset = std::clamp(Mod::get()->getSavedValue<int>("settings-export-preset"_spr), 0,
+                              static_cast<int>(ClipExporter::kPresets.size()) - 1);
     outputTrackCount = audioTrackAmount;
     for (int i = 1; i <= audioTrackAmount; i++) {
       audioTracks[i - 1] = Mod::get()->getSavedValue<int>("settings-audio-id-"_spr + std::to_string(i));
+      audioGains[i - 1] = Mod::get()->getSavedValue<int>("settings-audio-gain-"_spr + std::to_string(i), 100);
     }
     isUsingGPU = Mod::get()->getSavedValue<bool>("settings-hw-accel"_spr);
+    isAccurateStart = Mod::get()->getSavedValue<bool>("settings-accurate-start"_spr);
+    isMixingAudio = Mod::get()->getSavedValue<bool>("settings-audio-mix"_spr);
+    isMixOnly = Mod::get()->getSavedValue<bool>("settings-audio-mix-only"_spr);
+    isDeferredAudio = Mod::get()->getSavedValue<bool>("settings-audio-deferred"_spr);
+    isJournaling = Mod::get()->getSavedValue<bool>("settings-journal"_spr);
+    isTracing = Mod::get()->getSavedValue<bool>("settings-trace"_spr);
+    isTraceCompressed = Mod::get()->getSavedValue<bool>("settings-trace-compress"_spr, true);
+    isPremuxing = Mod::get()->getSavedValue<bool>("settings-premux"_spr);
+    isOffline = Mod::get()->getSavedValue<bool>("settings-offline"_spr);
+    isPlacingThreads = isThreadPlacementEnabled();
 
     std::string outputDirSetting = Mod::get()->getSavedValue<std::string>("settings-output-dir"_spr);
     outputDir.fill(0);
@@ -218,14 +406,125 @@ $on_mod(Loaded) {
       ImGui::InputInt("width", &outputWidth, 0);
       ImGui::InputInt("height", &outputHeight, 0);
       ImGui::InputInt("framerate", &outputFramerate, 0);
-      ImGui::InputInt("bitrate (kbps)", &outputBitrate, 0);
+      auto rateMode = static_cast<VideoEncoder::RateControl>(rateControl);
+      ImGui::InputInt(rateMode == VideoEncoder::RateControl::CappedVbr ? "bitrate cap (kbps)" : "bitrate (kbps)",
+                      &outputBitrate, 0);
+      ImGui::Combo("rate control", &rateControl, VideoEncoder::kRateControlNames.data(),
+                   static_cast<int>(VideoEncoder::kRateControlNames.size()));
+      if (rateMode != VideoEncoder::RateControl::Cbr) {
+        if (ImGui::InputInt("quality (crf, 0 = codec default)", &quality, 0)) {
+          quality = std::clamp(quality, 0, 63);
+        }
+      }
+      if (rateMode != VideoEncoder::RateControl::ConstantQuality) {
+        if (ImGui::InputFloat("vbv buffer (seconds)", &vbvSeconds, 0.0f, 0.0f, "%.1f")) {
+          vbvSeconds = std::clamp(vbvSeconds, 0.1f, 10.0f);
+        }
+      }
       ImGui::InputInt("length (seconds)", &outputLength, 0);
+      if (ImGui::InputFloat("keyframe interval (seconds)", &keyframeInterval, 0.0f, 0.0f, "%.1f")) {
+        keyframeInterval = std::max(keyframeInterval, 0.1f);
+      }
+      ImGui::Checkbox("keyframe on scene change", &isSceneChange);
+      if (ImGui::InputInt("compact history older than (seconds, 0 = off)", &compactAge, 0)) {
+        compactAge = std::max(compactAge, 0);
+      }
+      if (compactAge > 0) {
+        ImGui::InputInt("compact bitrate (kbps)", &compactBitrate, 0);
+      }
       ImGui::Checkbox("hardware acceleration", &isUsingGPU);
-      ImGui::BeginDisabled(true);
-      //ImGui::InputInt("audio track count (not implemented yet)", &settingsValues[5]);
-      ImGui::EndDisabled();
+      if (ImGui::BeginCombo(isUsingGPU ? "codec without hardware encoder" : "codec",
+                            VideoEncoder::kSoftwareCodecs[softwareCodec].label)) {
+        for (int i = 0; i < static_cast<int>(VideoEncoder::kSoftwareCodecs.size()); i++) {
+          if (ImGui::Selectable(VideoEncoder::kSoftwareCodecs[i].label, i == softwareCodec)) {
+            softwareCodec = i;
+          }
+        }
+        ImGui::EndCombo();
+      }
+      // the crop can change while recording, a different aspect ratio is letterboxed until the next start
+      if (ImGui::BeginCombo("crop", VideoSource::kCropPresets[cropPreset].name)) {
+        for (int i = 0; i < static_cast<int>(VideoSource::kCropPresets.size()); i++) {
+          if (ImGui::Selectable(VideoSource::kCropPresets[i].name, i == cropPreset)) {
+            cropPreset = i;
+            Recorder::getInstance()->m_videoSource->setCropPreset(cropPreset);
+          }
+        }
+        ImGui::EndCombo();
+      }
+      if (cropPreset > 0) {
+        ImGui::SameLine();
+        if (ImGui::Checkbox("follow the player", &isCropFollowing)) {
+          Recorder::getInstance()->m_videoSource->setFollowAnchor(isCropFollowing);
+        }
+      }
+      ImGui::Checkbox("record a proxy stream", &isProxy);
+      if (isProxy) {
+        ImGui::InputInt("proxy height", &proxyHeight, 0);
+        ImGui::InputInt("proxy bitrate (kbps)", &proxyBitrate, 0);
+        static constexpr const char *kClipStreamNames[] = { "full size", "proxy", "both" };
+        ImGui::Combo("clip video streams", &clipStreams, kClipStreamNames, 3);
+      }
+      ImGui::Checkbox("frame-accurate clip start", &isAccurateStart);
+      ImGui::Checkbox("auto-clip level completes", &isAutoClipComplete);
+      ImGui::SameLine();
+      ImGui::Checkbox("auto-clip deaths", &isAutoClipDeath);
+      if (isAutoClipComplete || isAutoClipDeath) {
+        if (ImGui::InputFloat("seconds before", &autoClipPreRoll, 0.0f, 0.0f, "%.1f")) {
+          autoClipPreRoll = std::max(autoClipPreRoll, 0.0f);
+        }
+        if (ImGui::InputFloat("seconds after", &autoClipPostRoll, 0.0f, 0.0f, "%.1f")) {
+          autoClipPostRoll = std::max(autoClipPostRoll, 0.0f);
+        }
+      }
+      if (ImGui::BeginCombo("export preset", ClipExporter::kPresets[exportPreset].name)) {
+        for (int i = 0; i < static_cast<int>(ClipExporter::kPresets.size()); i++) {
+          if (ImGui::Selectable(ClipExporter::kPresets[i].name, i == exportPreset)) {
+            exportPreset = i;
+          }
+        }
+        ImGui::EndCombo();
+      }
+      if (ImGui::InputInt("audio track count", &outputTrackCount, 0)) {
+        outputTrackCount = std::max(outputTrackCount, 0);
+      }
       for (int i = 1; i <= Mod::get()->getSavedValue<int>("settings-audio-amt"_spr); i++) {
         ImGui::Combo(("audio track " + std::to_string(i)).c_str(), &audioTracks[i - 1], deviceListCStr.data(), deviceList.size());
+        if (isMixingAudio) {
+          ImGui::SliderInt(("track " + std::to_string(i) + " gain (%)").c_str(), &audioGains[i - 1], 0, 200);
+        }
+      }
+      ImGui::Checkbox("mix audio tracks", &isMixingAudio);
+      if (isMixingAudio) {
+        ImGui::SameLine();
+        ImGui::Checkbox("only keep the mixed track", &isMixOnly);
+      }
+      ImGui::Checkbox("encode audio when clipping", &isDeferredAudio);
+      ImGui::Checkbox("crash-safe journal", &isJournaling);
+      ImGui::Checkbox("record a capture trace", &isTracing);
+      if (isTracing) {
+        ImGui::SameLine();
+        ImGui::Checkbox("delta compress frames", &isTraceCompressed);
+      }
+      ImGui::BeginDisabled(isDeferredAudio);
+      ImGui::Checkbox("keep the buffer muxed ahead for instant clips (twice the memory)", &isPremuxing);
+      ImGui::EndDisabled();
+      ImGui::Checkbox("render offline: fixed timestep, every frame encoded, no audio", &isOffline);
+      if (isOffline) {
+        ImGui::Text("  uncap the game's fps to render faster than real time");
+      }
+      ImGui::Checkbox("keep capture threads off the game's core", &isPlacingThreads);
+      ImGui::SameLine();
+      auto &jitter = JitterBenchmark::getInstance();
+      if (jobButton("measure frame jitter", "measuring...", jitter.isRunning())) {
+        jitter.start();
+      }
+      if (jitter.hasResults()) {
+        for (bool placed : { false, true }) {
+          const auto &result = jitter.getResult(placed);
+          ImGui::Text("  %s: %.2f ms frames, %.2f ms stddev, %.2f ms p99 jitter", placed ? "placed" : "unplaced",
+                      result.meanMs, result.stddevMs, result.p99Ms);
+        }
       }
       ImGui::InputText("", outputDir.data(), 256);
       ImGui::SameLine();
@@ -246,8 +545,21 @@ $on_mod(Loaded) {
       ImGui::Text("output folder");
       ImGui::PopItemWidth();
 
-      bool isRecording = Mod::get()->getSavedValue<bool>("is-recording"_spr);
-      if (isRecording) {
+      auto state = Recorder::getInstance()->getState();
+      bool isRecording = state == Recorder::State::Recording;
+      if (auto error = Recorder::getInstance()->takeError()) {
+        errorString = *error;
+        ImGui::OpenPopup("error");
+      }
+      if (state == Recorder::State::Starting || state == Recorder::State::Stopping) {
+        ImGui::BeginDisabled(true);
+        ImGui::Button("save settings");
+        ImGui::SameLine();
+        ImGui::Button(state == Recorder::State::Starting ? "starting..." : "stopping...");
+        ImGui::SameLine();
+        ImGui::Button("clip");
+        ImGui::EndDisabled();
+      } else if (isRecording) {
         ImGui::BeginDisabled(true);
         ImGui::Button("save settings");
         ImGui::EndDisabled();
@@ -266,13 +578,24 @@ $on_mod(Loaded) {
             ImGui::OpenPopup("success");
           }
         }
+        ImGui::SameLine();
+        if (ImGui::Button("instant replay")) {
+          auto result = Recorder::getInstance()->openReplay();
+          if (result.isErr()) {
+            errorString = result.unwrapErr();
+            ImGui::OpenPopup("error");
+          } else {
+            Recorder::getInstance()->m_player->play();
+          }
+        }
       } else {
         if (ImGui::Button("save settings")) {
           int audioTrackAmount = Mod::get()->getSavedValue<int>("settings-audio-amt"_spr);
           if (outputTrackCount != audioTrackAmount) {
             audioTracks.resize(outputTrackCount);
+            audioGains.resize(outputTrackCount, 100);
             if (outputTrackCount > audioTrackAmount) {
-              for (int i = audioTrackAmount; i <= outputTrackCount; i++) {
+              for (int i = audioTrackAmount + 1; i <= outputTrackCount; i++) {
                 audioTracks[i - 1] = 0;
               }
             }
@@ -282,12 +605,44 @@ $on_mod(Loaded) {
           Mod::get()->setSavedValue<int>("settings-height"_spr, outputHeight);
           Mod::get()->setSavedValue<int>("settings-framerate"_spr, outputFramerate);
           Mod::get()->setSavedValue<bool>("settings-hw-accel"_spr, isUsingGPU);
+          Mod::get()->setSavedValue<int>("settings-codec"_spr, softwareCodec);
+          Mod::get()->setSavedValue<bool>("settings-accurate-start"_spr, isAccurateStart);
           Mod::get()->setSavedValue<int>("settings-bitrate"_spr, outputBitrate);
+          Mod::get()->setSavedValue<int>("settings-rate-control"_spr, rateControl);
+          Mod::get()->setSavedValue<int>("settings-quality"_spr, quality);
+          Mod::get()->setSavedValue<double>("settings-vbv-seconds"_spr, vbvSeconds);
           Mod::get()->setSavedValue<int>("settings-length"_spr, outputLength);
+          Mod::get()->setSavedValue<double>("settings-keyframe-interval"_spr, keyframeInterval);
+          Mod::get()->setSavedValue<bool>("settings-scene-change"_spr, isSceneChange);
+          Mod::get()->setSavedValue<int>("settings-crop"_spr, cropPreset);
+          Mod::get()->setSavedValue<bool>("settings-crop-follow"_spr, isCropFollowing);
+          Mod::get()->setSavedValue<bool>("settings-proxy"_spr, isProxy);
+          Mod::get()->setSavedValue<bool>("settings-auto-clip-complete"_spr, isAutoClipComplete);
+          Mod::get()->setSavedValue<bool>("settings-auto-clip-death"_spr, isAutoClipDeath);
+          Mod::get()->setSavedValue<double>("settings-auto-clip-preroll"_spr, autoClipPreRoll);
+          Mod::get()->setSavedValue<double>("settings-auto-clip-postroll"_spr, autoClipPostRoll);
+          Mod::get()->setSavedValue<int>("settings-proxy-height"_spr, proxyHeight);
+          Mod::get()->setSavedValue<int>("settings-proxy-bitrate"_spr, proxyBitrate);
+          Mod::get()->setSavedValue<int>("settings-clip-streams"_spr, clipStreams);
+          Mod::get()->setSavedValue<int>("settings-compact-age"_spr, compactAge);
+          Mod::get()->setSavedValue<int>("settings-compact-bitrate"_spr, compactBitrate);
+          Mod::get()->setSavedValue<int>("settings-export-preset"_spr, exportPreset);
           Mod::get()->setSavedValue<int>("settings-audio-amt"_spr, audioTrackAmount);
           for (int i = 1; i <= audioTrackAmount; i++) {
             Mod::get()->setSavedValue<int>("settings-audio-id-"_spr + std::to_string(i), audioTracks[i - 1]);
+            Mod::get()->setSavedValue<int>("settings-audio-gain-"_spr + std::to_string(i), audioGains[i - 1]);
           }
+          Mod::get()->setSavedValue<bool>("settings-audio-mix"_spr, isMixingAudio);
+          Mod::get()->setSavedValue<bool>("settings-audio-mix-only"_spr, isMixOnly);
+          Mod::get()->setSavedValue<bool>("settings-audio-deferred"_spr, isDeferredAudio);
+          Mod::get()->setSavedValue<bool>("settings-journal"_spr, isJournaling);
+          Mod::get()->setSavedValue<bool>("settings-trace"_spr, isTracing);
+          Mod::get()->setSavedValue<bool>("settings-trace-compress"_spr, isTraceCompressed);
+          Mod::get()->setSavedValue<bool>("settings-premux"_spr, isPremuxing);
+          Mod::get()->setSavedValue<bool>("settings-offline"_spr, isOffline);
+          Mod::get()->setSavedValue<bool>("settings-thread-placement"_spr, isPlacingThreads);
+          setThreadPlacementEnabled(isPlacingThreads);
+          placeGameThread();
           Mod::get()->setSavedValue<std::string>("settings-output-dir"_spr, std::string(outputDir.data()));
         }
         ImGui::SameLine();
@@ -302,6 +657,241 @@ $on_mod(Loaded) {
         ImGui::BeginDisabled(true);
         ImGui::Button("clip");
         ImGui::EndDisabled();
+
+        // replays go through encoders of their own, but not while recording so the numbers mean something
+        if (pollJob(traceReplay, traceReplayResult, errorString)) {
+          jobButton("replay trace", "replaying trace...", true);
+        } else if (std::filesystem::exists(Recorder::getTracePath())) {
+          for (auto pace : { TraceReplay::Pace::Lockstep, TraceReplay::Pace::RealTime }) {
+            if (ImGui::Button(pace == TraceReplay::Pace::Lockstep ? "replay trace (as fast as possible)" : "replay trace (real time)")) {
+              traceReplay = std::async(std::launch::async, [options = Recorder::readTraceReplayOptions(pace)] {
+                placeCurrentThread(ThreadRole::Encode);
+                return TraceReplay::run(Recorder::getTracePath(), options);
+              });
+            }
+            ImGui::SameLine();
+          }
+          ImGui::NewLine();
+        }
+        if (traceReplayResult) {
+          const auto &result = *traceReplayResult;
+          ImGui::Text("  %zu frames and %zu audio chunks, %.1f s of trace in %.1f s (%.0f readbacks/s, %.2fx real time)",
+                      result.videoFrames, result.audioChunks, result.traceUs / 1000000.0, result.wallUs / 1000000.0,
+                      result.videoFrames * 1000000.0 / std::max(result.wallUs, static_cast<int64_t>(1)),
+                      static_cast<double>(result.traceUs) / std::max(result.wallUs, static_cast<int64_t>(1)));
+          ImGui::Text("  %.2f ms colour conversion per frame, %.0f us audio encode per second, %zu packets, %.1f MB",
+                      result.conversionUs / 1000.0, result.audioEncodeCost, result.packets, result.bytes / 1048576.0);
+        }
+      }
+
+      if (isRecording) {
+        auto recorder = Recorder::getInstance();
+        auto videoEncoder = std::dynamic_pointer_cast<VideoEncoder>(recorder->m_replayBuffer->getStreamEncoder(Recorder::kVideoStream));
+        auto markers = videoEncoder->getMarkers();
+        drawClipTimeline(*recorder->m_thumbnails, markers, selectionStart, selectionEnd);
+        ImGui::BeginDisabled(selectionStart < 0 || selectionStart == selectionEnd);
+        if (ImGui::Button("clip selection")) {
+          auto result = recorder->clip(std::min(selectionStart, selectionEnd), std::max(selectionStart, selectionEnd));
+          if (result.isErr()) {
+            errorString = result.unwrapErr();
+            ImGui::OpenPopup("error");
+          } else {
+            clipPath = result.unwrap();
+            ImGui::OpenPopup("success");
+          }
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("clear selection")) {
+          selectionStart = selectionEnd = -1;
+        }
+        ImGui::EndDisabled();
+        ImGui::SameLine();
+        ImGui::BeginDisabled(markers.empty());
+        if (ImGui::Button("clip from last mark")) {
+          auto result = recorder->clip(markers.back(), std::numeric_limits<int64_t>::max());
+          if (result.isErr()) {
+            errorString = result.unwrapErr();
+            ImGui::OpenPopup("error");
+          } else {
+            clipPath = result.unwrap();
+            ImGui::OpenPopup("success");
+          }
+        }
+        ImGui::EndDisabled();
+        ImGui::SameLine();
+        ImGui::Text("(F8 marks)");
+        auto &autoClipper = *recorder->m_autoClipper;
+        if (autoClipper.getPendingCount() > 0 || autoClipper.getRunningCount() > 0 || !autoClipper.getLog().empty()) {
+          ImGui::Text("auto clips: %zu waiting (next in %.1fs), %zu exporting, %zu triggers merged",
+                      autoClipper.getPendingCount(), std::max(autoClipper.getNextExportIn(), static_cast<int64_t>(0)) / 1000000.0,
+                      autoClipper.getRunningCount(), autoClipper.getMergedTriggerCount());
+          for (const auto &entry : autoClipper.getLog()) {
+            ImGui::Text("  %s", entry.c_str());
+          }
+        }
+        auto keyframeStats = videoEncoder->getKeyframeStats();
+        ImGui::Text("gops: %.2f s average, %.2f s longest (clip start granularity), %.0f kB/s buffered",
+                    keyframeStats.averageGopUs / 1000000.0, keyframeStats.longestGopUs / 1000000.0,
+                    keyframeStats.bytesPerSecond / 1000.0);
+        ImGui::Text("rate: %.0f kB/s over the last %d s, a full buffer at that rate holds %.1f MB",
+                    keyframeStats.recentBytesPerSecond / 1000.0, static_cast<int>(VideoEncoder::kRecentWindowUs / 1000000),
+                    keyframeStats.projectedBytes / 1048576.0);
+        ImGui::Text("encoder: %s", videoEncoder->getEncoderName().c_str());
+        auto pipelineStats = videoEncoder->getPipelineStats();
+        ImGui::Text("pipeline: convert %.2f ms, encode %.2f ms per frame, sink %.1f us per packet",
+                    pipelineStats.convertUs / 1000.0, pipelineStats.encodeUs / 1000.0, pipelineStats.sinkUs);
+        ImGui::Text("  waits: convert on encode %lld, encode on convert %lld, encode on sink %lld",
+                    static_cast<long long>(pipelineStats.convertStalls), static_cast<long long>(pipelineStats.encodeStarved),
+                    static_cast<long long>(pipelineStats.sinkStalls));
+        bool benchmarkRunning = pollJob(benchmark, benchmarkResults, errorString);
+        ImGui::SameLine();
+        if (jobButton("benchmark codecs", "benchmarking...", benchmarkRunning)) {
+          // a thread of its own, it would hold a pool worker the live session needs for seconds
+          benchmark = std::async(std::launch::async, [input = CodecBenchmark::capture(videoEncoder)]() mutable {
+            placeCurrentThread(ThreadRole::Worker);
+            return CodecBenchmark::run(std::move(input));
+          });
+        }
+        for (const auto &result : benchmarkResults) {
+          if (!result.available) {
+            ImGui::Text("  %s: not available", result.label);
+            continue;
+          }
+          ImGui::Text("  %s: %.0f fps, %.0f kB per buffered second (%.2fx the history of h.264)", result.label,
+                      result.fps, result.bytesPerSecond / 1000.0,
+                      benchmarkResults[0].available && result.bytesPerSecond > 0.0
+                        ? benchmarkResults[0].bytesPerSecond / result.bytesPerSecond : 0.0);
+        }
+        ImGui::Text("last start: %.1f ms off the main thread%s", recorder->m_lastTransitionUs / 1000.0,
+                    recorder->m_lastStartWarm ? " (encoders kept warm)" : "");
+        ImGui::Text("thumbnail decode: %.2f ms per gop", recorder->m_thumbnails->getAverageDecodeTime() / 1000.0);
+        ImGui::Text("colour conversion: %.2f ms per captured frame, shared by %s",
+                    recorder->m_videoSource->getAverageConversionTime() / 1000.0,
+                    recorder->m_replayBuffer->hasStream(Recorder::kProxyStream) ? "both video streams" : "the video stream");
+        auto [readbackWidth, readbackHeight] = recorder->m_videoSource->getReadbackSize();
+        auto frameSize = CCDirector::sharedDirector()->getOpenGLView()->getFrameSize();
+        ImGui::Text("readback: %dx%d, %.0f%% of the window", readbackWidth, readbackHeight,
+                    100.0 * readbackWidth * readbackHeight / std::max(frameSize.width * frameSize.height, 1.0f));
+        ImGui::Text("video history: %.1f MB, %.1f MB saved by compacting %lld gops",
+                    recorder->m_replayBuffer->getStreamEncoder(Recorder::kVideoStream)->getBufferedBytes() / 1048576.0,
+                    recorder->m_compactor->getSavedBytes() / 1048576.0,
+                    static_cast<long long>(recorder->m_compactor->getCompactedGopCount()));
+        bool indexBenchmarkRunning = pollJob(indexBenchmark, indexBenchmarkResult, errorString);
+        ImGui::SameLine();
+        if (jobButton("benchmark packet index", "benchmarking...", indexBenchmarkRunning)) {
+          indexBenchmark = ThreadPool::getInstance()->submit([] { return IndexBenchmark::run(); });
+        }
+        if (indexBenchmarkResult) {
+          ImGui::Text("  %zu packets (%d minutes), indexed in %.1f ms", indexBenchmarkResult->packets,
+                      IndexBenchmark::kMinutes, indexBenchmarkResult->buildMs);
+          for (const auto &query : indexBenchmarkResult->queries) {
+            ImGui::Text("  %s: %.3f us indexed, %.1f us walking the packets", query.name, query.indexedUs, query.scanUs);
+          }
+        }
+        if (recorder->m_fragmentRing->isRunning()) {
+          auto ringStats = recorder->m_fragmentRing->getStats();
+          ImGui::Text("premux: %zu fragments, %.1f MB, %.2f ms per fragment, last clip %.1f MB in %.1f ms",
+                      ringStats.fragments, ringStats.bytes / 1048576.0, ringStats.muxUs / 1000.0,
+                      ringStats.lastClipBytes / 1048576.0, ringStats.lastClipUs / 1000.0);
+        }
+        if (recorder->m_offline) {
+          auto offlineStats = recorder->getOfflineStats();
+          ImGui::Text("offline: %lld frames, %.1f s of video in %.1f s (%.2fx real time), %.2f ms per frame waiting on "
+                      "the encoders, %lld duplicated",
+                      static_cast<long long>(offlineStats.frames), offlineStats.videoUs / 1000000.0,
+                      offlineStats.wallUs / 1000000.0,
+                      static_cast<double>(offlineStats.videoUs) / std::max(offlineStats.wallUs, static_cast<int64_t>(1)),
+                      offlineStats.waitUs / 1000.0 / std::max(offlineStats.frames, static_cast<int64_t>(1)),
+                      static_cast<long long>(pipelineStats.duplicatedFrames));
+        }
+        if (recorder->m_trace->isOpen()) {
+          ImGui::Text("trace: %.1f MB written for %.1f MB of input, %lld frames dropped",
+                      recorder->m_trace->getStoredBytes() / 1048576.0, recorder->m_trace->getRawBytes() / 1048576.0,
+                      static_cast<long long>(recorder->m_trace->getDroppedFrames()));
+        }
+        ImGui::Text("audio ring overruns: %lld", static_cast<long long>(Recorder::getInstance()->m_audioPump->getOverrunCount()));
+        for (const auto &[idx, encoder] : Recorder::getInstance()->m_replayBuffer->getEncoders()) {
+          auto audioEncoder = std::dynamic_pointer_cast<AudioEncoder>(encoder);
+          if (!audioEncoder) {
+            continue;
+          }
+          ImGui::Text("track %d: %.0f us encode per second, last clip encode %.1f ms", idx - Recorder::kAudioStreamBase + 1,
+                      audioEncoder->getEncodeCost(), audioEncoder->getLastDeferredEncodeTime() / 1000.0);
+        }
+      }
+      if (isRecording && Mod::get()->getSavedValue<bool>("settings-audio-mix"_spr)) {
+        ImGui::Text("mix cost: %.2f us per 1024-sample frame", Recorder::getInstance()->m_audioMixer->getAverageMixTime());
+      }
+
+      // not a saved setting, it's switched on for as long as something is being looked at
+      bool isTimelineRecording = Timeline::isEnabled();
+      if (ImGui::Checkbox("record a thread timeline", &isTimelineRecording)) {
+        Timeline::setEnabled(isTimelineRecording);
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("dump timeline")) {
+        try {
+          size_t markers = Timeline::dump(Mod::get()->getSaveDir() / "timeline.json");
+          timelineStatus = fmt::format("{} markers written to timeline.json, open it in perfetto or chrome://tracing",
+                                       markers);
+        } catch (const std::string &e) {
+          errorString = e;
+          ImGui::OpenPopup("error");
+        }
+      }
+      if (!timelineStatus.empty()) {
+        ImGui::Text("%s", timelineStatus.c_str());
+      }
+
+      if (ImGui::BeginPopupModal("error")) {
+        ImGui::Text("%s", errorString.c_str());
+        ImGui::Separator();
+        if (ImGui::Button("ok")) {
+            ImGui::CloseCurrentPopup();
+        }
+        ImGui::EndPopup();
+      }
+
+      if (ImGui::BeginPopupModal("success")) {
+        ImGui::Text("clip saved at %s", clipPath.c_str());
+        ImGui::Separator();
+        if (ImGui::Button("ok")) {
+            ImGui::CloseCurrentPopup();
+        }
+        ImGui::EndPopup();
+      }
+
+      ImGui::End();
+    }
+
+    if (crashedJournal) {
+      ImGui::Begin("recover after crash", nullptr, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoCollapse);
+      ImGui::Text("the last session ended without stopping, %.1f seconds (%zu packets) can be recovered",
+                  crashedJournal->durationUs / 1000000.0, crashedJournal->packets);
+      ImGui::PushItemWidth(200);
+      if (ImGui::InputInt("seconds to export", &recoverSeconds, 0)) {
+        recoverSeconds = std::max(recoverSeconds, 1);
+      }
+      ImGui::PopItemWidth();
+      if (ImGui::Button("export")) {
+        std::filesystem::path output_dir = Mod::get()->getSavedValue<std::string>("settings-output-dir"_spr);
+        char buffer[80];
+        std::time_t now = std::time(nullptr);
+        std::strftime(buffer, sizeof(buffer), "recovered %Y-%m-%d %H-%M-%S.mp4", std::localtime(&now));
+        try {
+          PacketJournal::recover(Recorder::getCrashedJournalPath(), output_dir / buffer, recoverSeconds);
+          clipPath = (output_dir / buffer).string();
+          ImGui::OpenPopup("success");
+        } catch (const std::string &e) {
+          errorString = e;
+          ImGui::OpenPopup("error");
+        }
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("discard")) {
+        std::error_code ec;
+        std::filesystem::remove(Recorder::getCrashedJournalPath(), ec);
+        crashedJournal.reset();
       }
 
       if (ImGui::BeginPopupModal("error")) {
@@ -321,8 +911,34 @@ $on_mod(Loaded) {
         }
         ImGui::EndPopup();
       }
+      ImGui::End();
+    }
 
+    auto &player = Recorder::getInstance()->m_player;
+    if (player->isOpen()) {
+      player->update();
+      bool open = true;
+      ImGui::Begin("instant replay", &open, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoCollapse);
+      if (player->getTexture() != 0) {
+        ImGui::Image((ImTextureID)(intptr_t)player->getTexture(), ImVec2(player->getWidth(), player->getHeight()));
+      } else {
+        ImGui::Dummy(ImVec2(player->getWidth(), player->getHeight()));
+      }
+      if (ImGui::Button(player->isPlaying() ? "pause" : "play")) {
+        player->isPlaying() ? player->pause() : player->play();
+      }
+      ImGui::SameLine();
+      auto [firstUs, lastUs] = player->getRange();
+      float position = static_cast<float>(player->getPosition() - firstUs) / 1000000.0f;
+      ImGui::PushItemWidth(player->getWidth() - 80.0f);
+      if (ImGui::SliderFloat("##position", &position, 0.0f, static_cast<float>(lastUs - firstUs) / 1000000.0f, "%.1f s")) {
+        player->seek(firstUs + static_cast<int64_t>(position * 1000000.0f));
+      }
+      ImGui::PopItemWidth();
       ImGui::End();
+      if (!open) {
+        player->close();
+      }
     }
   });
 }